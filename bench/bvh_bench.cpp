@@ -0,0 +1,162 @@
+// Times rg::DynamicBVH creating, moving, querying and destroying 100k proxies, and checks the
+// frustum and box queries against a brute-force test of every proxy's fat box.
+// Usage: bvh_bench [proxies]
+
+#include <rg/BVH.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace {
+
+const unsigned FRAMES = 100;
+// per frame, of every thousand proxies
+const unsigned DRIFTING = 100;
+const unsigned JUMPING = 5;
+const unsigned QUERIES_PER_FRAME = 4;
+const float WORLD_SIZE = 1000.0f;
+
+std::mt19937 generator(42);
+
+float uniform(float min, float max) {
+    return std::uniform_real_distribution<float>(min, max)(generator);
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+rg::AABB randomBox() {
+    glm::vec3 center(uniform(0.0f, WORLD_SIZE), uniform(0.0f, 50.0f), uniform(0.0f, WORLD_SIZE));
+    glm::vec3 extent(uniform(0.2f, 2.0f), uniform(0.2f, 4.0f), uniform(0.2f, 2.0f));
+    rg::AABB box;
+    box.min = center - extent;
+    box.max = center + extent;
+    return box;
+}
+
+rg::AABB moved(const rg::AABB& box, const glm::vec3& offset) {
+    rg::AABB result;
+    result.min = box.min + offset;
+    result.max = box.max + offset;
+    return result;
+}
+
+rg::Frustum randomCamera() {
+    glm::vec3 eye(uniform(0.0f, WORLD_SIZE), uniform(2.0f, 30.0f), uniform(0.0f, WORLD_SIZE));
+    glm::vec3 target = eye + glm::vec3(uniform(-1.0f, 1.0f), uniform(-0.3f, 0.1f), uniform(-1.0f, 1.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    return rg::Frustum(projection * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f)));
+}
+
+// the tree has to report exactly the proxies whose fat box isn't outside the frustum
+bool sameAsBruteForce(const rg::DynamicBVH& bvh, const std::vector<int>& proxies, const rg::Frustum& frustum) {
+    std::vector<unsigned> found, expected;
+    bvh.query(frustum, [&found](unsigned object) { found.push_back(object); });
+    for (int proxy : proxies) {
+        if (frustum.classify(bvh.fatBounds(proxy)) != rg::Containment::Outside)
+            expected.push_back(bvh.userData(proxy));
+    }
+    std::sort(found.begin(), found.end());
+    return found == expected;
+}
+
+bool sameAsBruteForce(const rg::DynamicBVH& bvh, const std::vector<int>& proxies, const rg::AABB& box) {
+    std::vector<unsigned> found, expected;
+    bvh.query(box, [&found](unsigned object) { found.push_back(object); });
+    for (int proxy : proxies) {
+        if (bvh.fatBounds(proxy).overlaps(box))
+            expected.push_back(bvh.userData(proxy));
+    }
+    std::sort(found.begin(), found.end());
+    return found == expected;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    const unsigned count = argc > 1 ? (unsigned) std::atoi(argv[1]) : 100000;
+
+    std::vector<rg::AABB> boxes(count);
+    for (rg::AABB& box : boxes)
+        box = randomBox();
+
+    rg::DynamicBVH bvh;
+    std::vector<int> proxies(count);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < count; ++i)
+        proxies[i] = bvh.createProxy(boxes[i], i);
+    double createMs = millisecondsSince(start);
+    const int createdHeight = bvh.height();
+
+    double moveMs = 0.0, queryMs = 0.0, bruteForceMs = 0.0;
+    unsigned moves = 0, treeChanges = 0, queries = 0, visible = 0, mismatches = 0;
+    for (unsigned frame = 0; frame < FRAMES; ++frame) {
+        // most moving objects drift a little, a few teleport across the world
+        std::vector<unsigned> moving;
+        for (unsigned i = 0; i < count; ++i) {
+            unsigned roll = (unsigned) (uniform(0.0f, 1000.0f));
+            if (roll < DRIFTING + JUMPING) {
+                glm::vec3 offset = roll < JUMPING ? randomBox().min - boxes[i].min
+                                                  : glm::vec3(uniform(-0.3f, 0.3f), 0.0f, uniform(-0.3f, 0.3f));
+                boxes[i] = moved(boxes[i], offset);
+                moving.push_back(i);
+            }
+        }
+        start = std::chrono::steady_clock::now();
+        for (unsigned i : moving)
+            treeChanges += bvh.moveProxy(proxies[i], boxes[i]) ? 1 : 0;
+        moveMs += millisecondsSince(start);
+        moves += (unsigned) moving.size();
+
+        for (unsigned q = 0; q < QUERIES_PER_FRAME; ++q) {
+            rg::Frustum frustum = randomCamera();
+            unsigned found = 0;
+            start = std::chrono::steady_clock::now();
+            bvh.query(frustum, [&found](unsigned) { ++found; });
+            queryMs += millisecondsSince(start);
+            ++queries;
+            visible += found;
+
+            unsigned bruteForceFound = 0;
+            start = std::chrono::steady_clock::now();
+            for (int proxy : proxies)
+                bruteForceFound += frustum.intersects(bvh.fatBounds(proxy)) ? 1 : 0;
+            bruteForceMs += millisecondsSince(start);
+            if (found != bruteForceFound)
+                ++mismatches;
+        }
+        // comparing the actual objects is slower, a few frames are enough
+        if (frame % 10 == 0) {
+            if (!sameAsBruteForce(bvh, proxies, randomCamera()))
+                ++mismatches;
+            rg::AABB region = randomBox();
+            region.min -= glm::vec3(20.0f);
+            region.max += glm::vec3(20.0f);
+            if (!sameAsBruteForce(bvh, proxies, region))
+                ++mismatches;
+        }
+    }
+
+    const int movedHeight = bvh.height();
+    start = std::chrono::steady_clock::now();
+    for (int proxy : proxies)
+        bvh.destroyProxy(proxy);
+    double destroyMs = millisecondsSince(start);
+
+    std::cout << count << " proxies" << std::endl
+              << "create: " << createMs << " ms, height " << createdHeight << std::endl
+              << "move: " << moves / FRAMES << " per frame, " << moveMs / FRAMES << " ms per frame, "
+              << treeChanges * 100.0 / moves << "% changed the tree, height " << movedHeight << std::endl
+              << "frustum query: " << queryMs / queries << " ms, " << visible / queries << " visible, brute force "
+              << bruteForceMs / queries << " ms" << std::endl
+              << "destroy: " << destroyMs << " ms" << std::endl
+              << mismatches << " queries differ from brute force" << std::endl;
+    return mismatches ? 1 : 0;
+}
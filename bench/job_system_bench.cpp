@@ -0,0 +1,124 @@
+// Stress test and task throughput of rg::JobSystem for a range of worker counts.
+// Usage: job_system_bench [max workers]
+
+#include <rg/JobSystem.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const unsigned STRESS_ROUNDS = 200;
+const unsigned THROUGHPUT_JOBS = 200000;
+const unsigned PARALLEL_FOR_COUNT = 1000000;
+const unsigned PARALLEL_FOR_GRAIN = 256;
+const unsigned PARALLEL_FOR_REPEATS = 50;
+
+unsigned failures = 0;
+
+void expect(bool condition, const char* what, unsigned workers) {
+    if (condition)
+        return;
+    std::cerr << "FAILED with " << workers << " workers: " << what << std::endl;
+    ++failures;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// dependency chains, fan out/in, main thread jobs, nested parallelFor and background jobs
+// that schedule more work, checked for order and completeness
+void stress(unsigned workers) {
+    rg::JobSystem jobs(workers);
+    std::vector<int> data(50000, 0);
+    for (unsigned round = 0; round < STRESS_ROUNDS; ++round) {
+        jobs.parallelFor((unsigned) data.size(), 97, [&](unsigned, unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i)
+                ++data[i];
+        });
+
+        std::atomic<int> order(0);
+        int first = -1, second = -1, joined = -1, onMain = -1;
+        std::atomic<int> fanned(0);
+        rg::JobHandle a = jobs.schedule([&]() { first = order++; });
+        rg::JobHandle b = jobs.schedule([&]() { second = order++; }, {a});
+        std::vector<rg::JobHandle> fan;
+        for (unsigned i = 0; i < 64; ++i)
+            fan.push_back(jobs.schedule([&]() { ++fanned; }, {b}));
+        int fannedWhenJoined = -1;
+        rg::JobHandle join = jobs.schedule([&]() {
+            fannedWhenJoined = fanned.load();
+            joined = order++;
+        }, fan);
+        rg::JobHandle main = jobs.scheduleOnMainThread([&]() { onMain = order++; }, {join});
+
+        std::atomic<unsigned> nested(0);
+        std::vector<rg::JobHandle> outer;
+        for (unsigned i = 0; i < 8; ++i) {
+            outer.push_back(jobs.schedule([&]() {
+                jobs.parallelFor(1000, 10, [&](unsigned, unsigned begin, unsigned end) { nested += end - begin; });
+            }));
+        }
+
+        std::atomic<unsigned> background(0);
+        rg::JobHandle bake = jobs.scheduleBackground([&]() {
+            jobs.parallelFor(1000, 10, [&](unsigned, unsigned begin, unsigned end) { background += end - begin; });
+        });
+
+        jobs.wait(main);
+        jobs.wait(outer);
+        jobs.wait(bake);
+        expect(first == 0 && second == 1 && joined == 2 && onMain == 3, "dependency order", workers);
+        expect(fannedWhenJoined == 64, "fan in", workers);
+        expect(nested == 8000, "nested parallelFor", workers);
+        expect(background == 1000, "background job", workers);
+    }
+    bool complete = std::all_of(data.begin(), data.end(), [](int v) { return v == (int) STRESS_ROUNDS; });
+    expect(complete, "parallelFor coverage", workers);
+}
+
+// independent small jobs scheduled from the main thread, and parallelFor over a large range
+void throughput(unsigned workers) {
+    rg::JobSystem jobs(workers);
+    std::atomic<unsigned> ran(0);
+    std::vector<rg::JobHandle> handles;
+    handles.reserve(THROUGHPUT_JOBS);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < THROUGHPUT_JOBS; ++i)
+        handles.push_back(jobs.schedule([&ran]() { ran.fetch_add(1, std::memory_order_relaxed); }));
+    jobs.wait(handles);
+    double scheduleMs = millisecondsSince(start);
+    expect(ran == THROUGHPUT_JOBS, "independent jobs", workers);
+
+    std::vector<float> values(PARALLEL_FOR_COUNT, 1.0f);
+    start = std::chrono::steady_clock::now();
+    for (unsigned repeat = 0; repeat < PARALLEL_FOR_REPEATS; ++repeat) {
+        jobs.parallelFor(PARALLEL_FOR_COUNT, PARALLEL_FOR_GRAIN, [&](unsigned, unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i)
+                values[i] = values[i] * 0.999f + 0.001f;
+        });
+    }
+    double parallelForMs = millisecondsSince(start) / PARALLEL_FOR_REPEATS;
+
+    std::cout << workers << " workers: " << THROUGHPUT_JOBS / (scheduleMs / 1000.0) / 1e6 << " M jobs/s, "
+              << "parallelFor over " << PARALLEL_FOR_COUNT << " items " << parallelForMs << " ms" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    unsigned maxWorkers = argc > 1 ? (unsigned) std::atoi(argv[1])
+                                   : std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for (unsigned workers = 0; workers <= maxWorkers; ++workers)
+        stress(workers);
+    std::cout << (failures ? "stress test failed" : "stress test passed") << std::endl;
+    for (unsigned workers = 0; workers <= maxWorkers; ++workers)
+        throughput(workers);
+    return failures ? 1 : 0;
+}
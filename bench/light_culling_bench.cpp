@@ -0,0 +1,147 @@
+// Times rg::LightClusterBuilder on 1k point lights and 10k objects and checks both the
+// cluster lists and the per-object lists against a brute-force test of every light.
+// light_culling_bench uses the SSE path, light_culling_bench_scalar the scalar one.
+// Usage: light_culling_bench [workers]
+
+#include <rg/LightClusters.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const unsigned LIGHT_COUNT = 1000;
+const unsigned OBJECT_COUNT = 10000;
+const unsigned REPEATS = 20;
+const unsigned CLUSTER_SAMPLES = 100000;
+
+const float FOVY = 0.7854f;
+const float ASPECT = 1000.0f / 650.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+
+std::mt19937 generator(1234);
+
+float uniform(float min, float max) {
+    return std::uniform_real_distribution<float>(min, max)(generator);
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool touches(const rg::PointLight& light, const rg::AABB& box) {
+    glm::vec3 d = glm::max(glm::vec3(0.0f), glm::max(box.min - light.position, light.position - box.max));
+    float range = rg::lightRange(light);
+    return glm::dot(d, d) <= range * range;
+}
+
+// every light reaching a point inside the frustum has to be listed in the point's cluster;
+// the lists may hold more, the cluster boxes are conservative
+unsigned missingFromClusters(const std::vector<rg::PointLight>& lights, const rg::LightClusters& clusters) {
+    const float tanY = std::tan(FOVY / 2.0f), tanX = tanY * ASPECT;
+    unsigned missing = 0;
+    for (unsigned sample = 0; sample < CLUSTER_SAMPLES; ++sample) {
+        float depth = std::exp(uniform(std::log(NEAR_PLANE), std::log(FAR_PLANE)));
+        float x = uniform(-0.999f, 0.999f), y = uniform(-0.999f, 0.999f);
+        glm::vec3 point(x * depth * tanX, y * depth * tanY, -depth);
+        int tileX = std::min((int) rg::LightClusters::TILES_X - 1, (int) ((x * 0.5f + 0.5f) * rg::LightClusters::TILES_X));
+        int tileY = std::min((int) rg::LightClusters::TILES_Y - 1, (int) ((y * 0.5f + 0.5f) * rg::LightClusters::TILES_Y));
+        int slice = (int) (std::log(depth) * clusters.sliceScaleBias.x + clusters.sliceScaleBias.y);
+        slice = std::max(0, std::min((int) rg::LightClusters::SLICES - 1, slice));
+        glm::uvec2 range = clusters.ranges[(slice * rg::LightClusters::TILES_Y + tileY) * rg::LightClusters::TILES_X + tileX];
+        for (unsigned i = 0; i < lights.size(); ++i) {
+            if (glm::length(lights[i].position - point) >= rg::lightRange(lights[i]))
+                continue;
+            const GLuint* first = clusters.indices.data() + range.x;
+            if (std::find(first, first + range.y, (GLuint) i) == first + range.y)
+                ++missing;
+        }
+    }
+    return missing;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    unsigned workers = argc > 1 ? (unsigned) std::atoi(argv[1])
+                                : std::max(1u, std::thread::hardware_concurrency()) - 1;
+
+    // the camera sits at the origin looking down -z, so world and view space are the same
+    std::vector<rg::PointLight> lights;
+    for (unsigned i = 0; i < LIGHT_COUNT; ++i) {
+        rg::PointLight light;
+        light.position = glm::vec3(uniform(-40.0f, 40.0f), uniform(-25.0f, 25.0f), uniform(-90.0f, 2.0f));
+        light.ambient = glm::vec3(0.0f);
+        light.diffuse = glm::vec3(0.8f);
+        light.specular = glm::vec3(0.3f);
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = i % 3 ? 1.8f : 20.0f;
+        lights.push_back(light);
+    }
+    std::vector<rg::AABB> bounds;
+    std::vector<unsigned char> wanted;
+    for (unsigned i = 0; i < OBJECT_COUNT; ++i) {
+        glm::vec3 center(uniform(-50.0f, 50.0f), uniform(-30.0f, 30.0f), uniform(-100.0f, 5.0f));
+        rg::AABB box;
+        box.min = center - glm::vec3(uniform(0.1f, 3.0f));
+        box.max = center + glm::vec3(uniform(0.1f, 3.0f));
+        bounds.push_back(box);
+        wanted.push_back(i % 10 != 0);
+    }
+
+    rg::JobSystem jobs(workers);
+    rg::LightClusterBuilder builder(jobs);
+    rg::LightClusters clusters;
+    double clustersMs = 0.0, objectsMs = 0.0;
+    for (unsigned repeat = 0; repeat < REPEATS; ++repeat) {
+        auto start = std::chrono::steady_clock::now();
+        builder.build(lights, glm::mat4(1.0f), FOVY, ASPECT, NEAR_PLANE, FAR_PLANE, clusters);
+        clustersMs += millisecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        builder.addObjectLists(bounds, wanted, clusters);
+        objectsMs += millisecondsSince(start);
+    }
+
+    std::vector<std::vector<GLuint>> expected(OBJECT_COUNT);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned object = 0; object < OBJECT_COUNT; ++object) {
+        if (!wanted[object])
+            continue;
+        for (unsigned i = 0; i < LIGHT_COUNT; ++i) {
+            if (touches(lights[i], bounds[object]))
+                expected[object].push_back(i);
+        }
+    }
+    double bruteForceMs = millisecondsSince(start);
+
+    unsigned mismatches = 0;
+    for (unsigned object = 0; object < OBJECT_COUNT; ++object) {
+        glm::uvec2 range = clusters.ranges[rg::LightClusters::COUNT + object];
+        std::vector<GLuint> listed(clusters.indices.begin() + range.x, clusters.indices.begin() + range.x + range.y);
+        if (listed != expected[object])
+            ++mismatches;
+    }
+    unsigned missing = missingFromClusters(lights, clusters);
+
+#ifdef RG_LIGHT_SPHERES_SSE
+    const char* path = "SSE";
+#else
+    const char* path = "scalar";
+#endif
+    std::cout << path << " path, " << workers << " workers" << std::endl
+              << "clusters: " << clustersMs / REPEATS << " ms, " << missing << " lights missing at "
+              << CLUSTER_SAMPLES << " sampled points, at most " << clusters.maxLightsPerCluster << " per cluster"
+              << std::endl
+              << OBJECT_COUNT << " objects x " << LIGHT_COUNT << " lights: " << objectsMs / REPEATS
+              << " ms, brute force " << bruteForceMs << " ms, " << mismatches << " mismatching lists, at most "
+              << clusters.maxLightsPerObject << " per object" << std::endl;
+    return missing || mismatches ? 1 : 0;
+}
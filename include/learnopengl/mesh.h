@@ -7,6 +7,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/GLStateCache.h>
 
 #include <string>
 #include <vector>
@@ -23,6 +25,8 @@ struct Vertex {
     glm::vec3 Tangent;
     // bitangent
     glm::vec3 Bitangent;
+    // second UV set, where the vertex lies in the model's share of the lightmap, see rg::LightmapAtlas
+    glm::vec2 LightmapCoords;
 };
 
 
@@ -41,7 +45,12 @@ public:
     vector<Texture>      textures;
 
     unsigned int VAO;
+    // position-only stream for the depth pre-pass, shares the index buffer with VAO
+    unsigned int depthVAO;
     std::string glslIdentifierPrefix;
+    // object space bounds, computed once at import
+    rg::AABB bounds;
+    rg::BoundingSphere sphere;
     // constructor
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
     {
@@ -51,6 +60,31 @@ public:
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
         setupMesh();
+        computeBounds();
+    }
+
+    // true if the mesh, placed with the given model matrix, can be seen through the frustum
+    bool IsVisible(const glm::mat4 &model, const rg::Frustum &frustum) const
+    {
+        // the sphere test is cheaper and rejects most meshes, the box is tighter for the ones that remain
+        if (!frustum.intersects(sphere.transformed(model)))
+            return false;
+        return frustum.intersects(bounds.transformed(model));
+    }
+
+    // replaces the geometry, as long as the surface stays the same; the bounds are kept
+    void SetGeometry(vector<Vertex> vertices, vector<unsigned int> indices)
+    {
+        // a deleted VAO reads as unbound to GL, the cache would skip binding its recycled name
+        rg::glState().bindVertexArray(0);
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &depthVAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &positionVBO);
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        setupMesh();
     }
 
     // render the mesh
@@ -63,7 +97,6 @@ public:
         unsigned int heightNr   = 1;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -78,24 +111,40 @@ public:
 
             // now set the sampler to the correct texture unit
             glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            // and finally bind the texture, the state cache skips units that already hold it
+            rg::glState().bindTexture(i, GL_TEXTURE_2D, textures[i].id);
         }
 
-
-
-        // draw mesh
-        glBindVertexArray(VAO);
+        // draw mesh; the VAO stays bound, whoever draws next binds its own through the state cache
+        rg::glState().bindVertexArray(VAO);
         glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+    }
 
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    // render only the positions, for depth-only passes
+    void DrawDepth()
+    {
+        rg::glState().bindVertexArray(depthVAO);
+        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
     }
 
 private:
     // render data
     unsigned int VBO, EBO;
+    unsigned int positionVBO;
+
+    void computeBounds()
+    {
+        for (const Vertex &vertex : vertices)
+            bounds.expand(vertex.Position);
+        sphere.center = bounds.center();
+        float radius2 = 0.0f;
+        for (const Vertex &vertex : vertices)
+        {
+            glm::vec3 d = vertex.Position - sphere.center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        sphere.radius = std::sqrt(radius2);
+    }
 
     // initializes all the buffer objects/arrays
     void setupMesh()
@@ -105,7 +154,7 @@ private:
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        rg::glState().bindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
@@ -132,8 +181,25 @@ private:
         // vertex bitangent
         glEnableVertexAttribArray(4);
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        // vertex lightmap coords
+        glEnableVertexAttribArray(5);
+        glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, LightmapCoords));
+
+        // tightly packed positions, a depth-only pass fetches 12 bytes per vertex instead of the whole Vertex
+        vector<glm::vec3> positions;
+        positions.reserve(vertices.size());
+        for (const Vertex &vertex : vertices)
+            positions.push_back(vertex.Position);
+        glGenVertexArrays(1, &depthVAO);
+        glGenBuffers(1, &positionVBO);
+        rg::glState().bindVertexArray(depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
 
-        glBindVertexArray(0);
+        rg::glState().bindVertexArray(0);
     }
 };
 #endif
\ No newline at end of file
@@ -12,17 +12,29 @@
 
 #include <learnopengl/mesh.h>
 #include <learnopengl/shader.h>
+#include <rg/Image.h>
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromImage(const rg::Image &image);
 
+// the CPU half of loading a model: the assimp scene and its decoded textures, keyed by the
+// path the materials use. Doesn't touch GL, so it can be produced on any thread.
+struct ModelImport
+{
+    string path;
+    unique_ptr<Assimp::Importer> importer;
+    const aiScene* scene = nullptr;
+    map<string, rg::Image> images;
+};
 
 
 class Model
@@ -37,7 +49,46 @@ public:
     // constructor, expects a filepath to a 3D model.
     Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
     {
-        loadModel(path);
+        ModelImport import = Import(path);
+        loadModel(import);
+    }
+
+    // creates the GL objects for a model imported earlier, possibly on another thread
+    explicit Model(ModelImport &import, bool gamma = false) : gammaCorrection(gamma)
+    {
+        loadModel(import);
+    }
+
+    // reads the file via ASSIMP and decodes every texture its materials reference
+    static ModelImport Import(string const &path)
+    {
+        ModelImport import;
+        import.path = path;
+        import.importer.reset(new Assimp::Importer());
+        const aiScene* scene = import.importer->ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+        // check for errors
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << import.importer->GetErrorString() << endl;
+            return import;
+        }
+        import.scene = scene;
+        string directory = path.substr(0, path.find_last_of('/'));
+        const aiTextureType types[] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_HEIGHT, aiTextureType_AMBIENT };
+        for(unsigned int m = 0; m < scene->mNumMaterials; m++)
+        {
+            for(aiTextureType type : types)
+            {
+                for(unsigned int i = 0; i < scene->mMaterials[m]->GetTextureCount(type); i++)
+                {
+                    aiString str;
+                    scene->mMaterials[m]->GetTexture(type, i, &str);
+                    if(import.images.count(str.C_Str()) == 0)
+                        import.images[str.C_Str()] = rg::Image::decode(directory + '/' + str.C_Str(), false);
+                }
+            }
+        }
+        return import;
     }
 
     // draws the model, and thus all its meshes
@@ -47,29 +98,63 @@ public:
             meshes[i].Draw(shader);
     }
 
+    // draws only the meshes of [firstMesh, firstMesh + meshCount) that are inside the view frustum
+    // when placed with the given model matrix
+    void Draw(Shader &shader, unsigned int firstMesh, unsigned int meshCount,
+              const glm::mat4 &model, const rg::Frustum &frustum, rg::CullStats &stats)
+    {
+        for(unsigned int i = firstMesh; i < firstMesh + meshCount; i++)
+        {
+            if (!meshes[i].IsVisible(model, frustum))
+            {
+                ++stats.culled;
+                continue;
+            }
+            ++stats.visible;
+            meshes[i].Draw(shader);
+        }
+    }
+
+    // depth-only version of the culled Draw, used by the depth pre-pass
+    void DrawDepth(unsigned int firstMesh, unsigned int meshCount, const glm::mat4 &model, const rg::Frustum &frustum)
+    {
+        for(unsigned int i = firstMesh; i < firstMesh + meshCount; i++)
+        {
+            if (meshes[i].IsVisible(model, frustum))
+                meshes[i].DrawDepth();
+        }
+    }
+
+    // object space bounds of a range of meshes together
+    rg::AABB Bounds(unsigned int firstMesh, unsigned int meshCount) const
+    {
+        rg::AABB box;
+        for (unsigned int i = firstMesh; i < firstMesh + meshCount; i++)
+            box.expand(meshes[i].bounds);
+        return box;
+    }
+
     void SetShaderTextureNamePrefix(std::string prefix) {
         for (Mesh& mesh: meshes) {
             mesh.glslIdentifierPrefix = prefix;
         }
     }
 private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    // images decoded by Import(), only set while loadModel runs
+    const map<string, rg::Image> *decodedImages = nullptr;
+
+    // stores the meshes of an imported ASSIMP scene in the meshes vector and uploads them.
+    void loadModel(ModelImport &import)
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-        {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+        if(!import.scene)
             return;
-        }
         // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
+        directory = import.path.substr(0, import.path.find_last_of('/'));
 
         // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        decodedImages = &import.images;
+        processNode(import.scene->mRootNode, import.scene);
+        decodedImages = nullptr;
     }
 
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -138,6 +223,8 @@ private:
             }
             else
                 vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+            // filled in by rg::LightmapAtlas for static geometry
+            vertex.LightmapCoords = glm::vec2(0.0f, 0.0f);
 
             vertices.push_back(vertex);
 
@@ -205,7 +292,9 @@ private:
             if(!skip)
             {   // if texture hasn't been loaded already, load it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
+                auto decoded = decodedImages->find(str.C_Str());
+                texture.id = decoded != decodedImages->end() ? TextureFromImage(decoded->second)
+                                                             : TextureFromFile(str.C_Str(), this->directory);
                 texture.type = typeName;
                 texture.path = str.C_Str();
                 textures.push_back(texture);
@@ -222,36 +311,36 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     string filename = string(path);
     filename = directory + '/' + filename;
 
+    return TextureFromImage(rg::Image::decode(filename, false));
+}
+
+unsigned int TextureFromImage(const rg::Image &image)
+{
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
+    if (image.valid())
     {
         GLenum format;
-        if (nrComponents == 1)
+        if (image.channels == 1)
             format = GL_RED;
-        else if (nrComponents == 3)
+        else if (image.channels == 3)
             format = GL_RGB;
-        else if (nrComponents == 4)
+        else if (image.channels == 4)
             format = GL_RGBA;
 
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.pixels.data());
         glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        std::cout << "Texture failed to load at path: " << image.path << std::endl;
     }
 
     return textureID;
@@ -9,13 +9,17 @@
 #include <sstream>
 #include <iostream>
 #include <common.h>
+#include <rg/GLStateCache.h>
+#include <rg/ProgramCache.h>
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly; defines, a block of #define lines, is
+    // inserted after the #version line of every stage
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const std::string& defines = std::string())
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -46,8 +50,8 @@ public:
             vShaderFile.close();
             fShaderFile.close();
             // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
+            vertexCode = withDefines(vShaderStream.str(), defines);
+            fragmentCode = withDefines(fShaderStream.str(), defines);
             // if geometry shader path is present, also load a geometry shader
             if(geometryPath != nullptr)
             {
@@ -57,16 +61,22 @@ public:
                 std::stringstream gShaderStream;
                 gShaderStream << gShaderFile.rdbuf();
                 gShaderFile.close();
-                geometryCode = gShaderStream.str();
+                geometryCode = withDefines(gShaderStream.str(), defines);
             }
         }
         catch (std::ifstream::failure& e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        // 2. reuse the binary a previous run linked from the same sources, see rg::ProgramCache
+        std::string sources = vertexCode + '\0' + fragmentCode + '\0' + geometryCode;
+        ID = rg::programCache().load(sources);
+        if (ID != 0)
+            return;
+        std::chrono::steady_clock::time_point compileStart = std::chrono::steady_clock::now();
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        // 3. compile shaders
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -94,8 +104,10 @@ public:
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
             glAttachShader(ID, geometry);
+        rg::programCache().prepare(ID);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        rg::programCache().store(sources, ID, rg::ProgramCache::milliseconds(compileStart));
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -107,7 +119,7 @@ public:
     // ------------------------------------------------------------------------
     void use() 
     { 
-        glUseProgram(ID); 
+        rg::glState().useProgram(ID); 
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
@@ -121,6 +133,11 @@ public:
         glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
     }
     // ------------------------------------------------------------------------
+    void setUint(const std::string &name, unsigned int value) const
+    { 
+        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value); 
+    }
+    // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
         glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
@@ -169,6 +186,18 @@ public:
     }
 
 private:
+    static std::string withDefines(const std::string& source, const std::string& defines)
+    {
+        if (defines.empty())
+            return source;
+        // #version has to stay the first line
+        std::string::size_type lineEnd = source.find('\n');
+        if (source.compare(0, 8, "#version") != 0 || lineEnd == std::string::npos)
+            return defines + source;
+        // #line keeps the line numbers of compile errors matching the file
+        return source.substr(0, lineEnd + 1) + defines + "#line 2\n" + source.substr(lineEnd + 1);
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
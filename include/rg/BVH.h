@@ -0,0 +1,371 @@
+#ifndef PROJECT_BASE_BVH_H
+#define PROJECT_BASE_BVH_H
+
+#include <glm/glm.hpp>
+#include <rg/Bounds.h>
+#include <rg/Error.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace rg {
+
+// Dynamic bounding volume hierarchy over placed objects. Leaves store a slightly
+// enlarged ("fat") box so objects that wiggle in place don't touch the tree at all;
+// small moves refit the ancestors, larger ones reinsert the leaf. Insertion uses the
+// surface area heuristic and rotations keep the tree balanced, so queries stay
+// logarithmic as the object count grows.
+class DynamicBVH {
+public:
+    static const int NULL_NODE = -1;
+
+    explicit DynamicBVH(float margin = 0.1f) : m_Margin(margin) {}
+
+    int createProxy(const AABB& box, unsigned userData) {
+        int proxy = allocateNode();
+        m_Nodes[proxy].box = box.inflated(m_Margin);
+        m_Nodes[proxy].userData = userData;
+        m_Nodes[proxy].height = 0;
+        insertLeaf(proxy);
+        return proxy;
+    }
+
+    void destroyProxy(int proxy) {
+        ASSERT(m_Nodes[proxy].isLeaf(), "Only leaves can be destroyed");
+        removeLeaf(proxy);
+        freeNode(proxy);
+    }
+
+    // returns true if the tree had to change
+    bool moveProxy(int proxy, const AABB& box) {
+        Node& node = m_Nodes[proxy];
+        if (node.box.contains(box))
+            return false;
+        AABB fat = box.inflated(m_Margin);
+        if (node.box.overlaps(fat) && node.parent != NULL_NODE) {
+            // the object only drifted, growing the ancestors is cheaper than a reinsert
+            node.box = fat;
+            refitAncestors(node.parent);
+        } else {
+            removeLeaf(proxy);
+            m_Nodes[proxy].box = fat;
+            insertLeaf(proxy);
+        }
+        return true;
+    }
+
+    unsigned userData(int proxy) const {
+        return m_Nodes[proxy].userData;
+    }
+
+    const AABB& fatBounds(int proxy) const {
+        return m_Nodes[proxy].box;
+    }
+
+    int height() const {
+        return m_Root == NULL_NODE ? 0 : m_Nodes[m_Root].height;
+    }
+
+    int proxyCount() const {
+        return m_ProxyCount;
+    }
+
+    // calls visit(userData) for every proxy that may be visible; subtrees outside the frustum are
+    // skipped as a whole and subtrees completely inside are reported without further plane tests
+    template<typename Visitor>
+    void query(const Frustum& frustum, Visitor&& visit) const {
+        query(m_Root, frustum, visit);
+    }
+
+    // the same, limited to the subtree under root
+    template<typename Visitor>
+    void query(int root, const Frustum& frustum, Visitor&& visit) const {
+        if (root == NULL_NODE)
+            return;
+        std::vector<std::pair<int, bool>> stack;
+        stack.reserve(64);
+        stack.emplace_back(root, false);
+        while (!stack.empty()) {
+            int id = stack.back().first;
+            bool inside = stack.back().second;
+            stack.pop_back();
+            const Node& node = m_Nodes[id];
+            if (!inside) {
+                Containment c = frustum.classify(node.box);
+                if (c == Containment::Outside)
+                    continue;
+                inside = c == Containment::Inside;
+            }
+            if (node.isLeaf()) {
+                visit(node.userData);
+            } else {
+                stack.emplace_back(node.child1, inside);
+                stack.emplace_back(node.child2, inside);
+            }
+        }
+    }
+
+    // roots of at most maxCount disjoint subtrees that together hold every proxy, for
+    // spreading a query over several threads; the largest subtrees are split first
+    void splitRoots(unsigned maxCount, std::vector<int>& roots) const {
+        roots.clear();
+        if (m_Root == NULL_NODE)
+            return;
+        roots.push_back(m_Root);
+        while (roots.size() < maxCount) {
+            auto tallest = std::max_element(roots.begin(), roots.end(), [this](int a, int b) {
+                return m_Nodes[a].height < m_Nodes[b].height;
+            });
+            const Node& node = m_Nodes[*tallest];
+            if (node.isLeaf())
+                break;
+            *tallest = node.child1;
+            roots.push_back(node.child2);
+        }
+    }
+
+    // calls visit(userData) for every proxy whose fat box overlaps the given box
+    template<typename Visitor>
+    void query(const AABB& box, Visitor&& visit) const {
+        if (m_Root == NULL_NODE)
+            return;
+        std::vector<int> stack;
+        stack.reserve(64);
+        stack.push_back(m_Root);
+        while (!stack.empty()) {
+            const Node& node = m_Nodes[stack.back()];
+            stack.pop_back();
+            if (!node.box.overlaps(box))
+                continue;
+            if (node.isLeaf()) {
+                visit(node.userData);
+            } else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+    // walks the proxies hit by the ray; visit(userData, tEnter) returns the new maximum distance,
+    // so returning tEnter (or an exact hit distance) finds the closest object and 0 stops the walk
+    template<typename Visitor>
+    void raycast(const glm::vec3& origin, const glm::vec3& direction, float maxT, Visitor&& visit) const {
+        if (m_Root == NULL_NODE)
+            return;
+        glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        std::vector<int> stack;
+        stack.reserve(64);
+        stack.push_back(m_Root);
+        while (!stack.empty()) {
+            const Node& node = m_Nodes[stack.back()];
+            stack.pop_back();
+            float tEnter;
+            if (!node.box.intersectRay(origin, invDir, maxT, tEnter))
+                continue;
+            if (node.isLeaf()) {
+                maxT = visit(node.userData, tEnter);
+                if (maxT <= 0.0f)
+                    return;
+            } else {
+                stack.push_back(node.child1);
+                stack.push_back(node.child2);
+            }
+        }
+    }
+
+private:
+    struct Node {
+        AABB box;
+        int parent = NULL_NODE;
+        int child1 = NULL_NODE;
+        int child2 = NULL_NODE;
+        // leaf = 0, free node = -1
+        int height = -1;
+        unsigned userData = 0;
+
+        bool isLeaf() const {
+            return child1 == NULL_NODE;
+        }
+    };
+
+    int allocateNode() {
+        if (m_FreeList == NULL_NODE) {
+            m_Nodes.emplace_back();
+            m_Nodes.back().height = 0;
+            return (int) m_Nodes.size() - 1;
+        }
+        int id = m_FreeList;
+        m_FreeList = m_Nodes[id].parent;
+        m_Nodes[id] = Node();
+        m_Nodes[id].height = 0;
+        return id;
+    }
+
+    void freeNode(int id) {
+        m_Nodes[id].parent = m_FreeList;
+        m_Nodes[id].height = -1;
+        m_FreeList = id;
+    }
+
+    void insertLeaf(int leaf) {
+        ++m_ProxyCount;
+        if (m_Root == NULL_NODE) {
+            m_Root = leaf;
+            m_Nodes[leaf].parent = NULL_NODE;
+            return;
+        }
+
+        // descend towards the sibling that increases the total surface area the least
+        const AABB leafBox = m_Nodes[leaf].box;
+        int index = m_Root;
+        while (!m_Nodes[index].isLeaf()) {
+            const Node& node = m_Nodes[index];
+            float area = node.box.surfaceArea();
+            float combinedArea = merge(node.box, leafBox).surfaceArea();
+            // cost of making a new parent for this node and the new leaf
+            float cost = 2.0f * combinedArea;
+            // minimum cost of pushing the leaf further down the tree
+            float inheritanceCost = 2.0f * (combinedArea - area);
+            float cost1 = descendCost(node.child1, leafBox) + inheritanceCost;
+            float cost2 = descendCost(node.child2, leafBox) + inheritanceCost;
+            if (cost < cost1 && cost < cost2)
+                break;
+            index = cost1 < cost2 ? node.child1 : node.child2;
+        }
+
+        int sibling = index;
+        int oldParent = m_Nodes[sibling].parent;
+        int newParent = allocateNode();
+        m_Nodes[newParent].parent = oldParent;
+        m_Nodes[newParent].box = merge(leafBox, m_Nodes[sibling].box);
+        m_Nodes[newParent].height = m_Nodes[sibling].height + 1;
+        m_Nodes[newParent].child1 = sibling;
+        m_Nodes[newParent].child2 = leaf;
+        m_Nodes[sibling].parent = newParent;
+        m_Nodes[leaf].parent = newParent;
+        if (oldParent != NULL_NODE) {
+            if (m_Nodes[oldParent].child1 == sibling)
+                m_Nodes[oldParent].child1 = newParent;
+            else
+                m_Nodes[oldParent].child2 = newParent;
+        } else {
+            m_Root = newParent;
+        }
+
+        refitAncestors(newParent);
+    }
+
+    float descendCost(int child, const AABB& leafBox) const {
+        const Node& node = m_Nodes[child];
+        float combinedArea = merge(node.box, leafBox).surfaceArea();
+        if (node.isLeaf())
+            return combinedArea;
+        return combinedArea - node.box.surfaceArea();
+    }
+
+    void removeLeaf(int leaf) {
+        --m_ProxyCount;
+        if (leaf == m_Root) {
+            m_Root = NULL_NODE;
+            return;
+        }
+
+        int parent = m_Nodes[leaf].parent;
+        int grandParent = m_Nodes[parent].parent;
+        int sibling = m_Nodes[parent].child1 == leaf ? m_Nodes[parent].child2 : m_Nodes[parent].child1;
+
+        if (grandParent != NULL_NODE) {
+            if (m_Nodes[grandParent].child1 == parent)
+                m_Nodes[grandParent].child1 = sibling;
+            else
+                m_Nodes[grandParent].child2 = sibling;
+            m_Nodes[sibling].parent = grandParent;
+            freeNode(parent);
+            refitAncestors(grandParent);
+        } else {
+            m_Root = sibling;
+            m_Nodes[sibling].parent = NULL_NODE;
+            freeNode(parent);
+        }
+    }
+
+    // recomputes boxes and heights from index up to the root, rebalancing on the way
+    void refitAncestors(int index) {
+        while (index != NULL_NODE) {
+            index = balance(index);
+            Node& node = m_Nodes[index];
+            const Node& child1 = m_Nodes[node.child1];
+            const Node& child2 = m_Nodes[node.child2];
+            node.height = 1 + std::max(child1.height, child2.height);
+            node.box = merge(child1.box, child2.box);
+            index = node.parent;
+        }
+    }
+
+    // performs a left or right rotation if node a is imbalanced, returns the new subtree root
+    int balance(int iA) {
+        Node& a = m_Nodes[iA];
+        if (a.isLeaf() || a.height < 2)
+            return iA;
+
+        int iB = a.child1;
+        int iC = a.child2;
+        int diff = m_Nodes[iC].height - m_Nodes[iB].height;
+        if (diff > 1)
+            return rotate(iA, iC, iB);
+        if (diff < -1)
+            return rotate(iA, iB, iC);
+        return iA;
+    }
+
+    // lifts the higher child up so it replaces a; other is a's remaining child
+    int rotate(int iA, int iUp, int iOther) {
+        Node& a = m_Nodes[iA];
+        Node& up = m_Nodes[iUp];
+        int iF = up.child1;
+        int iG = up.child2;
+        Node& f = m_Nodes[iF];
+        Node& g = m_Nodes[iG];
+
+        up.child1 = iA;
+        up.parent = a.parent;
+        a.parent = iUp;
+        if (up.parent != NULL_NODE) {
+            if (m_Nodes[up.parent].child1 == iA)
+                m_Nodes[up.parent].child1 = iUp;
+            else
+                m_Nodes[up.parent].child2 = iUp;
+        } else {
+            m_Root = iUp;
+        }
+
+        // keep the taller grandchild next to a's new position, hand the smaller one to a
+        bool upWasChild2 = a.child2 == iUp;
+        int iKeep = f.height > g.height ? iF : iG;
+        int iGive = iKeep == iF ? iG : iF;
+        up.child2 = iKeep;
+        if (upWasChild2)
+            a.child2 = iGive;
+        else
+            a.child1 = iGive;
+        m_Nodes[iGive].parent = iA;
+
+        const Node& other = m_Nodes[iOther];
+        const Node& give = m_Nodes[iGive];
+        const Node& keep = m_Nodes[iKeep];
+        a.box = merge(other.box, give.box);
+        a.height = 1 + std::max(other.height, give.height);
+        up.box = merge(a.box, keep.box);
+        up.height = 1 + std::max(a.height, keep.height);
+        return iUp;
+    }
+
+    std::vector<Node> m_Nodes;
+    int m_Root = NULL_NODE;
+    int m_FreeList = NULL_NODE;
+    int m_ProxyCount = 0;
+    float m_Margin;
+};
+
+}
+#endif //PROJECT_BASE_BVH_H
@@ -0,0 +1,130 @@
+#ifndef PROJECT_BASE_BLOOMPYRAMID_H
+#define PROJECT_BASE_BLOOMPYRAMID_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <learnopengl/shader.h>
+#include <rg/GLStateCache.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace rg {
+
+// Bloom from a chain of targets each half the size of the one before, instead of a full
+// resolution Gaussian ping-pong. The bright pass is filtered down level by level with a small
+// 13-tap filter, then carried back up with a 3x3 tent, every level blending the upsampled
+// level below into its own image. The filters stay the same size in texels, so each level
+// reaches twice as far on screen as the previous one, and the whole chain reads and writes
+// about as many texels as a single pass at half resolution.
+class BloomPyramid {
+public:
+    static const unsigned MAX_LEVELS = 6;
+    // no level is made smaller than this on either side
+    static const int MIN_SIZE = 8;
+
+    // width and height of the bright pass the chain starts from
+    BloomPyramid(int width, int height) {
+        glGenFramebuffers(1, &m_FBO);
+        resize(width, height);
+    }
+
+    ~BloomPyramid() {
+        releaseLevels();
+        glState().deleteFramebuffers(1, &m_FBO);
+    }
+
+    BloomPyramid(const BloomPyramid&) = delete;
+    BloomPyramid& operator=(const BloomPyramid&) = delete;
+
+    void resize(int width, int height) {
+        releaseLevels();
+        int levelWidth = width / 2, levelHeight = height / 2;
+        while (m_Levels.size() < MAX_LEVELS && levelWidth >= MIN_SIZE && levelHeight >= MIN_SIZE) {
+            Level level;
+            level.width = levelWidth;
+            level.height = levelHeight;
+            glGenTextures(1, &level.texture);
+            glState().bindTexture(0, GL_TEXTURE_2D, level.texture);
+            // half the bytes of RGBA16F; bloom needs no alpha and is never negative
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R11F_G11F_B10F, levelWidth, levelHeight, 0, GL_RGB, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            m_Levels.push_back(level);
+            levelWidth /= 2;
+            levelHeight /= 2;
+        }
+    }
+
+    unsigned levels() const {
+        return (unsigned) m_Levels.size();
+    }
+
+    // the finished bloom, half the size of the bright pass
+    GLuint texture() const {
+        return m_Levels.empty() ? 0 : m_Levels[0].texture;
+    }
+
+    // Filters source down the chain and back up. scatter is how much of the wider levels each
+    // level takes in on the way up, 0 keeps only the sharpest. sourceScale is the part of source
+    // to read when the scene rendered to less than all of it; the levels always cover all of
+    // theirs. Leaves its framebuffer bound and the viewport at the first level's size.
+    void render(GLuint source, Shader& downsample, Shader& upsample, float scatter,
+                const std::function<void()>& drawQuad, const glm::vec2& sourceScale = glm::vec2(1.0f)) {
+        if (m_Levels.empty())
+            return;
+        // no depth attachment, the depth test has nothing to test against
+        GLStateCache& gl = glState();
+        gl.bindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+        gl.disable(GL_BLEND);
+        downsample.use();
+        for (unsigned i = 0; i < m_Levels.size(); ++i) {
+            target(i);
+            gl.bindTexture(0, GL_TEXTURE_2D, i == 0 ? source : m_Levels[i - 1].texture);
+            // only the bright pass may be partly drawn to
+            if (i < 2)
+                downsample.setVec2("uvScale", i == 0 ? sourceScale : glm::vec2(1.0f));
+            drawQuad();
+        }
+
+        // level = (1 - scatter) * level + scatter * tent(level below), so the weights still sum to one
+        upsample.use();
+        gl.enable(GL_BLEND);
+        glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        glBlendColor(0.0f, 0.0f, 0.0f, std::min(std::max(scatter, 0.0f), 1.0f));
+        for (unsigned i = (unsigned) m_Levels.size() - 1; i-- > 0;) {
+            target(i);
+            gl.bindTexture(0, GL_TEXTURE_2D, m_Levels[i + 1].texture);
+            drawQuad();
+        }
+        gl.disable(GL_BLEND);
+    }
+
+private:
+    struct Level {
+        GLuint texture = 0;
+        int width = 0;
+        int height = 0;
+    };
+
+    void target(unsigned level) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_Levels[level].texture, 0);
+        glState().viewport(0, 0, m_Levels[level].width, m_Levels[level].height);
+    }
+
+    void releaseLevels() {
+        for (const Level& level : m_Levels)
+            glState().deleteTextures(1, &level.texture);
+        m_Levels.clear();
+    }
+
+    GLuint m_FBO = 0;
+    std::vector<Level> m_Levels;
+};
+
+}
+#endif //PROJECT_BASE_BLOOMPYRAMID_H
@@ -0,0 +1,314 @@
+#ifndef PROJECT_BASE_BLURENGINE_H
+#define PROJECT_BASE_BLURENGINE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/Error.h>
+#include <rg/GLExtensions.h>
+#include <rg/GLStateCache.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// One side of a symmetric blur kernel; [0] is the centre tap, offsets are in texels.
+struct BlurKernel {
+    int radius = 0;
+    std::vector<float> weights;
+    std::vector<float> offsets;
+
+    // Gaussian over [-radius, radius] with sigma = radius / 2, normalized over the texels it covers
+    static BlurKernel gaussian(int radius) {
+        BlurKernel kernel;
+        kernel.radius = radius;
+        float sigma = std::max(radius * 0.5f, 0.5f);
+        float sum = 0.0f;
+        for (int i = 0; i <= radius; ++i) {
+            float weight = std::exp(-(float) (i * i) / (2.0f * sigma * sigma));
+            kernel.weights.push_back(weight);
+            kernel.offsets.push_back((float) i);
+            sum += i == 0 ? weight : 2.0f * weight;
+        }
+        for (float& weight : kernel.weights)
+            weight /= sum;
+        return kernel;
+    }
+
+    // The same kernel with neighbouring texel pairs merged into one bilinear fetch between
+    // them, placed where the filtering weighs the two as the kernel does: radius + 1 fetches
+    // per side become 1 + ceil(radius / 2).
+    BlurKernel linear() const {
+        BlurKernel merged;
+        merged.radius = radius;
+        merged.weights.push_back(weights[0]);
+        merged.offsets.push_back(0.0f);
+        for (int i = 1; i <= radius; i += 2) {
+            float first = weights[i];
+            float second = i + 1 <= radius ? weights[i + 1] : 0.0f;
+            merged.weights.push_back(first + second);
+            merged.offsets.push_back((i * first + (i + 1) * second) / (first + second));
+        }
+        return merged;
+    }
+};
+
+struct BlurTiming {
+    int width = 0;
+    int height = 0;
+    int radius = 0;
+    float fragmentMs = 0.0f;
+    // negative when compute shaders aren't available
+    float computeMs = -1.0f;
+};
+
+// Separable Gaussian blur of any radius up to MAX_RADIUS, horizontal then vertical. The
+// kernels are built once at construction. The fragment path draws full screen quads with the
+// linear-sampled kernel, so the texture units do half the work. With GL 4.3 or
+// ARB_compute_shader there is also a compute path: a workgroup loads its row (or column)
+// segment plus the kernel's reach on both sides into shared memory once, and every thread
+// blurs from there with the plain discrete kernel. glad only covers 3.3, so the compute entry
+// points are fetched by hand, like ProgramCache does, and without them the fragment path is
+// the only one.
+class BlurEngine {
+public:
+    static const int MAX_RADIUS = 32;
+    // fetches per side of the linear-sampled kernel, the centre included
+    static const int MAX_TAPS = MAX_RADIUS / 2 + 1;
+    // texels one compute workgroup writes
+    static const int TILE = 128;
+
+    explicit BlurEngine(GLADloadproc load)
+            : m_Fragment("resources/shaders/framebuffers.vs", "resources/shaders/blur.fs", nullptr,
+                         "#define MAX_TAPS " + std::to_string(MAX_TAPS) + "\n") {
+        for (int radius = 0; radius <= MAX_RADIUS; ++radius) {
+            m_Discrete.push_back(BlurKernel::gaussian(radius));
+            m_Linear.push_back(m_Discrete.back().linear());
+        }
+        m_Fragment.use();
+        m_Fragment.setInt("image", 0);
+        glGenFramebuffers(2, m_FBOs);
+        if (hasGL(4, 3, "GL_ARB_compute_shader") && hasGL(4, 2, "GL_ARB_shader_image_load_store")) {
+            m_DispatchCompute = (DispatchComputeProc) load("glDispatchCompute");
+            m_BindImageTexture = (BindImageTextureProc) load("glBindImageTexture");
+            m_MemoryBarrier = (MemoryBarrierProc) load("glMemoryBarrier");
+            if (m_DispatchCompute && m_BindImageTexture && m_MemoryBarrier)
+                m_Compute = compileCompute("resources/shaders/blur.comp");
+        }
+    }
+
+    ~BlurEngine() {
+        releaseTargets();
+        glState().deleteFramebuffers(2, m_FBOs);
+        if (m_Compute)
+            glDeleteProgram(m_Compute);
+    }
+
+    BlurEngine(const BlurEngine&) = delete;
+    BlurEngine& operator=(const BlurEngine&) = delete;
+
+    bool computeSupported() const {
+        return m_Compute != 0;
+    }
+
+    const BlurKernel& kernel(int radius) const {
+        return m_Discrete[clampRadius(radius)];
+    }
+
+    // Blurs source, a width x height texture with linear filtering, and returns the texture
+    // holding the result, valid until the next call. The fragment path draws with drawQuad
+    // and leaves the viewport at the blurred size.
+    GLuint blur(GLuint source, int width, int height, int radius, bool compute,
+                const std::function<void()>& drawQuad) {
+        if (width != m_Width || height != m_Height)
+            allocateTargets(width, height);
+        GLStateCache& gl = glState();
+        gl.viewport(0, 0, width, height);
+        for (int pass = 0; pass < 2; ++pass) {
+            gl.bindFramebuffer(GL_FRAMEBUFFER, m_FBOs[pass]);
+            this->pass(pass == 0 ? source : m_Targets[0], m_Targets[pass], pass == 1, width, height, radius, compute,
+                       drawQuad);
+        }
+        return m_Targets[1];
+    }
+
+    // One direction of the blur, for callers that own the targets. target is RGBA16F and as big
+    // as source; width x height is the corner of both that is blurred, uvScale that corner's
+    // share of the textures, 1 when it is all of them. The fragment path draws into the bound
+    // framebuffer, which must have target attached and the viewport on that corner, the compute
+    // path stores into target directly.
+    void pass(GLuint source, GLuint target, bool vertical, int width, int height, int radius, bool compute,
+              const std::function<void()>& drawQuad, const glm::vec2& uvScale = glm::vec2(1.0f)) {
+        radius = clampRadius(radius);
+        if (compute && m_Compute) {
+            dispatch(source, target, vertical ? glm::ivec2(0, 1) : glm::ivec2(1, 0), width, height, radius);
+            return;
+        }
+        m_Fragment.use();
+        const BlurKernel& taps = m_Linear[radius];
+        glUniform1i(glGetUniformLocation(m_Fragment.ID, "taps"), (GLint) taps.weights.size());
+        glUniform1fv(glGetUniformLocation(m_Fragment.ID, "weights"), (GLsizei) taps.weights.size(), taps.weights.data());
+        glUniform1fv(glGetUniformLocation(m_Fragment.ID, "offsets"), (GLsizei) taps.offsets.size(), taps.offsets.data());
+        glState().bindTexture(0, GL_TEXTURE_2D, source);
+        // one texel of the whole texture
+        glm::vec2 texel = uvScale / glm::vec2(width, height);
+        m_Fragment.setVec2("direction", vertical ? glm::vec2(0.0f, texel.y) : glm::vec2(texel.x, 0.0f));
+        m_Fragment.setVec2("uvScale", uvScale);
+        drawQuad();
+    }
+
+    // GPU time of both paths for every size and radius, averaged over repeats blurs each; waits
+    // on the GPU for every result, so it stalls rendering while it runs
+    std::vector<BlurTiming> benchmark(const std::vector<glm::ivec2>& sizes, const std::vector<int>& radii,
+                                      unsigned repeats, const std::function<void()>& drawQuad) {
+        std::vector<BlurTiming> timings;
+        GLuint query;
+        glGenQueries(1, &query);
+        for (const glm::ivec2& size : sizes) {
+            GLuint source = createTarget(size.x, size.y);
+            for (int radius : radii) {
+                BlurTiming timing;
+                timing.width = size.x;
+                timing.height = size.y;
+                timing.radius = clampRadius(radius);
+                for (int path = 0; path < (m_Compute ? 2 : 1); ++path) {
+                    // the first blur reallocates the targets and warms up the program
+                    blur(source, size.x, size.y, radius, path == 1, drawQuad);
+                    glBeginQuery(GL_TIME_ELAPSED, query);
+                    for (unsigned i = 0; i < repeats; ++i)
+                        blur(source, size.x, size.y, radius, path == 1, drawQuad);
+                    glEndQuery(GL_TIME_ELAPSED);
+                    GLuint64 nanoseconds = 0;
+                    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+                    float ms = (float) (nanoseconds / 1.0e6) / std::max(repeats, 1u);
+                    (path == 0 ? timing.fragmentMs : timing.computeMs) = ms;
+                }
+                timings.push_back(timing);
+            }
+            glState().deleteTextures(1, &source);
+        }
+        glDeleteQueries(1, &query);
+        return timings;
+    }
+
+private:
+    static int clampRadius(int radius) {
+        // copied, std::min binding MAX_RADIUS itself would need its out-of-class definition
+        const int maxRadius = MAX_RADIUS;
+        return std::min(std::max(radius, 0), maxRadius);
+    }
+
+    GLuint compileCompute(const char* path) {
+        std::ifstream file(path);
+        std::stringstream source;
+        source << file.rdbuf();
+        std::string code = source.str();
+        std::string::size_type lineEnd = code.find('\n');
+        if (!file || lineEnd == std::string::npos) {
+            LOG(std::cerr) << "Couldn't read " << path << '\n';
+            return 0;
+        }
+        std::ostringstream defines;
+        defines << "#define TILE " << TILE << "\n#define MAX_RADIUS " << MAX_RADIUS << "\n#line 2\n";
+        code.insert(lineEnd + 1, defines.str());
+        const char* text = code.c_str();
+        GLuint shader = glCreateShader(COMPUTE_SHADER);
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+        GLchar infoLog[1024];
+        GLint compiled = 0;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            glGetShaderInfoLog(shader, sizeof(infoLog), nullptr, infoLog);
+            LOG(std::cerr) << "The compute blur didn't compile, only the fragment path is left:\n" << infoLog << '\n';
+            glDeleteShader(shader);
+            return 0;
+        }
+        GLuint program = glCreateProgram();
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        glDeleteShader(shader);
+        GLint linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            glGetProgramInfoLog(program, sizeof(infoLog), nullptr, infoLog);
+            LOG(std::cerr) << "The compute blur didn't link, only the fragment path is left:\n" << infoLog << '\n';
+            glDeleteProgram(program);
+            return 0;
+        }
+        glState().useProgram(program);
+        glUniform1i(glGetUniformLocation(program, "image"), 0);
+        return program;
+    }
+
+    void dispatch(GLuint source, GLuint target, glm::ivec2 direction, int width, int height, int radius) {
+        GLStateCache& gl = glState();
+        gl.useProgram(m_Compute);
+        gl.bindTexture(0, GL_TEXTURE_2D, source);
+        m_BindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        const BlurKernel& kernel = m_Discrete[radius];
+        glUniform2i(glGetUniformLocation(m_Compute, "direction"), direction.x, direction.y);
+        glUniform1i(glGetUniformLocation(m_Compute, "radius"), radius);
+        glUniform2i(glGetUniformLocation(m_Compute, "size"), width, height);
+        glUniform1fv(glGetUniformLocation(m_Compute, "weights"), (GLsizei) kernel.weights.size(), kernel.weights.data());
+        // one workgroup per TILE texels of a row, or of a column for the vertical pass
+        int length = direction.x ? width : height;
+        int lines = direction.x ? height : width;
+        m_DispatchCompute((GLuint) ((length + TILE - 1) / TILE), (GLuint) lines, 1);
+        // the vertical pass and whatever follows fetch what was stored
+        m_MemoryBarrier(TEXTURE_FETCH_BARRIER_BIT | SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    GLuint createTarget(int width, int height) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glState().bindTexture(0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // the linear taps past the border read the edge texel, as the compute path does
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void allocateTargets(int width, int height) {
+        releaseTargets();
+        m_Width = width;
+        m_Height = height;
+        for (int i = 0; i < 2; ++i) {
+            m_Targets[i] = createTarget(width, height);
+            glState().bindFramebuffer(GL_FRAMEBUFFER, m_FBOs[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_Targets[i], 0);
+        }
+    }
+
+    void releaseTargets() {
+        glState().deleteTextures(2, m_Targets);
+        m_Targets[0] = m_Targets[1] = 0;
+        m_Width = m_Height = 0;
+    }
+
+    Shader m_Fragment;
+    std::vector<BlurKernel> m_Discrete;
+    std::vector<BlurKernel> m_Linear;
+    GLuint m_FBOs[2] = {};
+    // horizontal pass output, then the result
+    GLuint m_Targets[2] = {};
+    int m_Width = 0;
+    int m_Height = 0;
+    GLuint m_Compute = 0;
+    DispatchComputeProc m_DispatchCompute = nullptr;
+    BindImageTextureProc m_BindImageTexture = nullptr;
+    MemoryBarrierProc m_MemoryBarrier = nullptr;
+};
+
+}
+#endif //PROJECT_BASE_BLURENGINE_H
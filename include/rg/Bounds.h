@@ -0,0 +1,198 @@
+#ifndef PROJECT_BASE_BOUNDS_H
+#define PROJECT_BASE_BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace rg {
+
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    AABB() = default;
+    AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void expand(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const AABB& other) {
+        if (other.empty())
+            return;
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    glm::vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 extents() const {
+        return (max - min) * 0.5f;
+    }
+
+    float surfaceArea() const {
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    bool contains(const AABB& other) const {
+        return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+               max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+    }
+
+    bool contains(const glm::vec3& point) const {
+        return point.x >= min.x && point.y >= min.y && point.z >= min.z &&
+               point.x <= max.x && point.y <= max.y && point.z <= max.z;
+    }
+
+    bool overlaps(const AABB& other) const {
+        return min.x <= other.max.x && max.x >= other.min.x &&
+               min.y <= other.max.y && max.y >= other.min.y &&
+               min.z <= other.max.z && max.z >= other.min.z;
+    }
+
+    AABB inflated(float margin) const {
+        return AABB(min - glm::vec3(margin), max + glm::vec3(margin));
+    }
+
+    // slab test against a ray given by its origin and 1/direction; tEnter is the entry distance
+    bool intersectRay(const glm::vec3& origin, const glm::vec3& invDir, float maxT, float& tEnter) const {
+        float tMin = 0.0f;
+        float tMax = maxT;
+        for (int i = 0; i < 3; ++i) {
+            float t1 = (min[i] - origin[i]) * invDir[i];
+            float t2 = (max[i] - origin[i]) * invDir[i];
+            tMin = std::max(tMin, std::min(t1, t2));
+            tMax = std::min(tMax, std::max(t1, t2));
+        }
+        tEnter = tMin;
+        return tMin <= tMax;
+    }
+
+    // box that encloses this one after an affine transformation (Arvo's method)
+    AABB transformed(const glm::mat4& m) const {
+        if (empty())
+            return *this;
+        glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+        glm::vec3 e = extents();
+        glm::vec3 r;
+        for (int i = 0; i < 3; ++i)
+            r[i] = std::abs(m[0][i]) * e.x + std::abs(m[1][i]) * e.y + std::abs(m[2][i]) * e.z;
+        return AABB(c - r, c + r);
+    }
+};
+
+inline AABB merge(const AABB& a, const AABB& b) {
+    AABB r = a;
+    r.expand(b);
+    return r;
+}
+
+struct BoundingSphere {
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+
+    BoundingSphere() = default;
+    BoundingSphere(const glm::vec3& center, float radius) : center(center), radius(radius) {}
+
+    // non-uniform scale is handled conservatively by taking the largest axis
+    BoundingSphere transformed(const glm::mat4& m) const {
+        float sx = glm::length(glm::vec3(m[0]));
+        float sy = glm::length(glm::vec3(m[1]));
+        float sz = glm::length(glm::vec3(m[2]));
+        return BoundingSphere(glm::vec3(m * glm::vec4(center, 1.0f)), radius * std::max(sx, std::max(sy, sz)));
+    }
+};
+
+enum class Containment {
+    Outside,
+    Intersecting,
+    Inside
+};
+
+// six planes (left, right, bottom, top, near, far) pointing inwards, extracted from projection * view
+class Frustum {
+public:
+    glm::vec4 planes[6];
+
+    Frustum() = default;
+
+    explicit Frustum(const glm::mat4& projView) {
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; ++i)
+            row[i] = glm::vec4(projView[0][i], projView[1][i], projView[2][i], projView[3][i]);
+        planes[0] = row[3] + row[0];
+        planes[1] = row[3] - row[0];
+        planes[2] = row[3] + row[1];
+        planes[3] = row[3] - row[1];
+        planes[4] = row[3] + row[2];
+        planes[5] = row[3] - row[2];
+        for (glm::vec4& p : planes)
+            p /= glm::length(glm::vec3(p));
+    }
+
+    // frustum that every volume passes, used when culling is switched off
+    static Frustum infinite() {
+        Frustum f;
+        for (glm::vec4& p : f.planes)
+            p = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        return f;
+    }
+
+    bool intersects(const BoundingSphere& sphere) const {
+        for (const glm::vec4& p : planes) {
+            if (glm::dot(glm::vec3(p), sphere.center) + p.w < -sphere.radius)
+                return false;
+        }
+        return true;
+    }
+
+    // like intersects(), but also tells apart boxes that are completely inside, so hierarchies can stop testing
+    Containment classify(const AABB& box) const {
+        Containment result = Containment::Inside;
+        for (const glm::vec4& p : planes) {
+            glm::vec3 n(p);
+            glm::vec3 positive(p.x >= 0.0f ? box.max.x : box.min.x,
+                               p.y >= 0.0f ? box.max.y : box.min.y,
+                               p.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(n, positive) + p.w < 0.0f)
+                return Containment::Outside;
+            glm::vec3 negative(p.x >= 0.0f ? box.min.x : box.max.x,
+                               p.y >= 0.0f ? box.min.y : box.max.y,
+                               p.z >= 0.0f ? box.min.z : box.max.z);
+            if (glm::dot(n, negative) + p.w < 0.0f)
+                result = Containment::Intersecting;
+        }
+        return result;
+    }
+
+    // tests the corner furthest along each plane normal, conservative near the frustum edges
+    bool intersects(const AABB& box) const {
+        for (const glm::vec4& p : planes) {
+            glm::vec3 positive(p.x >= 0.0f ? box.max.x : box.min.x,
+                               p.y >= 0.0f ? box.max.y : box.min.y,
+                               p.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(p), positive) + p.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+struct CullStats {
+    unsigned visible = 0;
+    unsigned culled = 0;
+};
+
+}
+#endif //PROJECT_BASE_BOUNDS_H
@@ -0,0 +1,78 @@
+#ifndef PROJECT_BASE_DYNAMICRESOLUTION_H
+#define PROJECT_BASE_DYNAMICRESOLUTION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace rg {
+
+// Picks the scale of the window the scene renders at, so the GPU frame time stays near a
+// budget. The scene passes draw into that part of targets allocated at the full window size,
+// so changing the scale never reallocates, and the screen pass stretches it over the window.
+// GPU time is read back frames late, so every reading comes with the number of the frame it
+// measured and the ones drawn before the last change are ignored. The scale moves on the
+// average of a few raw readings at the current scale: quickly down when over the budget,
+// slowly back up, and not at all within a small band around it.
+class DynamicResolution {
+public:
+    static constexpr float MIN_SCALE = 0.5f;
+    static constexpr float MAX_SCALE = 1.0f;
+    // readings at the current scale averaged for one decision
+    static const unsigned SAMPLES = 4;
+    // no change while the time is this close to the budget, relative
+    static constexpr float TOLERANCE = 0.05f;
+
+    // one measured GPU frame time and the frame it was measured for; frame is the one about to
+    // be built, the first drawn at whatever scale this picks, and budgetMs what it should take
+    void update(float gpuMs, unsigned measuredFrame, unsigned frame, float budgetMs) {
+        if (measuredFrame < m_FirstFrame || gpuMs <= 0.0f)
+            return;
+        m_Sum += gpuMs;
+        if (++m_Samples < SAMPLES)
+            return;
+        const float average = m_Sum / (float) m_Samples;
+        m_Sum = 0.0f;
+        m_Samples = 0;
+        if (budgetMs <= 0.0f || std::abs(average - budgetMs) < TOLERANCE * budgetMs)
+            return;
+        // the work goes with the pixel count, so the side with the square root of the time
+        float wanted = m_Scale * std::sqrt(budgetMs / average);
+        float rate = wanted < m_Scale ? 0.6f : 0.25f;
+        float scale = glm::clamp(m_Scale + (wanted - m_Scale) * rate, MIN_SCALE, MAX_SCALE);
+        if (scale != m_Scale) {
+            m_Scale = scale;
+            m_FirstFrame = frame;
+        }
+    }
+
+    // back to full resolution, e.g. while the controller is switched off; frame is the one
+    // being built, which is still drawn at the scale picked by hand
+    void reset(unsigned frame) {
+        m_Scale = MAX_SCALE;
+        m_FirstFrame = frame + 1;
+        m_Sum = 0.0f;
+        m_Samples = 0;
+    }
+
+    float scale() const {
+        return m_Scale;
+    }
+
+    // the part of a window of the given size the scene renders to at scale
+    static glm::ivec2 renderSize(int windowWidth, int windowHeight, float scale) {
+        return glm::ivec2(std::max(1, (int) std::lround(windowWidth * scale)),
+                          std::max(1, (int) std::lround(windowHeight * scale)));
+    }
+
+private:
+    float m_Scale = MAX_SCALE;
+    // the first frame drawn at m_Scale
+    unsigned m_FirstFrame = 0;
+    float m_Sum = 0.0f;
+    unsigned m_Samples = 0;
+};
+
+}
+#endif //PROJECT_BASE_DYNAMICRESOLUTION_H
@@ -0,0 +1,108 @@
+#ifndef PROJECT_BASE_FRAMEQUEUE_H
+#define PROJECT_BASE_FRAMEQUEUE_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace rg {
+
+// Hands finished frame packets from the simulation thread to the render thread. At most
+// depth() packets are in flight, queued or being rendered: 2 lets the simulation of frame
+// N+1 overlap the submission of frame N, 3 also absorbs one slow frame on either side at the
+// cost of a frame more latency. Consumed packets come back through recycle() so their
+// vectors keep their capacity from frame to frame.
+template<typename Packet>
+class FrameQueue {
+public:
+    static const unsigned MAX_DEPTH = 3;
+
+    explicit FrameQueue(unsigned depth = 2) {
+        setDepth(depth);
+    }
+
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    // takes effect for the next push(), packets already in flight stay
+    void setDepth(unsigned depth) {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Depth = std::max(1u, std::min(depth, (unsigned) MAX_DEPTH));
+        }
+        m_Recycled.notify_all();
+    }
+
+    unsigned depth() const {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Depth;
+    }
+
+    // producer: an empty packet to fill, reusing a recycled one when there is one
+    std::unique_ptr<Packet> acquire() {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Free.empty())
+            return std::unique_ptr<Packet>(new Packet());
+        std::unique_ptr<Packet> packet = std::move(m_Free.back());
+        m_Free.pop_back();
+        return packet;
+    }
+
+    // producer: blocks while depth() packets are in flight
+    void push(std::unique_ptr<Packet> packet) {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Recycled.wait(lock, [this]() { return m_Closed || m_InFlight < m_Depth; });
+        if (m_Closed)
+            return;
+        ++m_InFlight;
+        m_Queued.push_back(std::move(packet));
+        m_Pushed.notify_one();
+    }
+
+    // consumer: blocks until a packet arrives; null once the queue is closed and drained
+    std::unique_ptr<Packet> pop() {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Pushed.wait(lock, [this]() { return m_Closed || !m_Queued.empty(); });
+        if (m_Queued.empty())
+            return nullptr;
+        std::unique_ptr<Packet> packet = std::move(m_Queued.front());
+        m_Queued.pop_front();
+        return packet;
+    }
+
+    // consumer: the packet is done with, its slot is free for the producer
+    void recycle(std::unique_ptr<Packet> packet) {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            --m_InFlight;
+            m_Free.push_back(std::move(packet));
+        }
+        m_Recycled.notify_one();
+    }
+
+    // no more packets; the consumer still gets the ones already queued
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            m_Closed = true;
+        }
+        m_Pushed.notify_all();
+        m_Recycled.notify_all();
+    }
+
+private:
+    mutable std::mutex m_Mutex;
+    std::condition_variable m_Pushed;
+    std::condition_variable m_Recycled;
+    std::deque<std::unique_ptr<Packet>> m_Queued;
+    std::vector<std::unique_ptr<Packet>> m_Free;
+    unsigned m_Depth = 2;
+    unsigned m_InFlight = 0;
+    bool m_Closed = false;
+};
+
+}
+#endif //PROJECT_BASE_FRAMEQUEUE_H
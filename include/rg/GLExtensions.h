@@ -0,0 +1,55 @@
+#ifndef PROJECT_BASE_GLEXTENSIONS_H
+#define PROJECT_BASE_GLEXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+namespace rg {
+
+// glad only covers GL 3.3. Features past it are used when the driver has them: the classes
+// check with hasGL() and fetch the entry points with the loader they are given; the enums and
+// entry point types they need are here.
+
+// whether the current context is at least major.minor or exposes extension
+inline bool hasGL(int major, int minor, const char* extension) {
+    GLint contextMajor = 0, contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    if (contextMajor > major || (contextMajor == major && contextMinor >= minor))
+        return true;
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions; ++i) {
+        if (std::strcmp((const char*) glGetStringi(GL_EXTENSIONS, i), extension) == 0)
+            return true;
+    }
+    return false;
+}
+
+// GL 4.1, ARB_get_program_binary
+const GLenum PROGRAM_BINARY_RETRIEVABLE_HINT = 0x8257;
+const GLenum PROGRAM_BINARY_LENGTH = 0x8741;
+const GLenum NUM_PROGRAM_BINARY_FORMATS = 0x87FE;
+
+typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length,
+                                              GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary,
+                                           GLsizei length);
+
+// GL 4.2, ARB_shader_image_load_store
+const GLbitfield SHADER_IMAGE_ACCESS_BARRIER_BIT = 0x20;
+const GLbitfield TEXTURE_FETCH_BARRIER_BIT = 0x08;
+
+typedef void (APIENTRYP BindImageTextureProc)(GLuint unit, GLuint texture, GLint level, GLboolean layered,
+                                              GLint layer, GLenum access, GLenum format);
+typedef void (APIENTRYP MemoryBarrierProc)(GLbitfield barriers);
+
+// GL 4.3, ARB_compute_shader
+const GLenum COMPUTE_SHADER = 0x91B9;
+
+typedef void (APIENTRYP DispatchComputeProc)(GLuint x, GLuint y, GLuint z);
+
+}
+#endif //PROJECT_BASE_GLEXTENSIONS_H
@@ -0,0 +1,285 @@
+#ifndef PROJECT_BASE_GLSTATECACHE_H
+#define PROJECT_BASE_GLSTATECACHE_H
+
+#include <glad/glad.h>
+
+namespace rg {
+
+// Shadow copy of the OpenGL state we touch every frame. Every setter compares the
+// requested value with the last one we sent to the driver and only forwards the
+// call when it actually changes something, counting both outcomes per frame.
+// Code that talks to GL directly (model loading, ImGui backend) must either restore
+// the state it changes or call invalidate() afterwards.
+class GLStateCache {
+public:
+    static const unsigned MAX_TEXTURE_UNITS = 32;
+
+    struct FrameStats {
+        unsigned issued = 0;
+        unsigned elided = 0;
+    };
+
+    GLStateCache() {
+        invalidate();
+    }
+
+    // forget everything we know, the next call of each setter always reaches the driver
+    void invalidate() {
+        m_Program = UNKNOWN;
+        m_VAO = UNKNOWN;
+        m_ActiveUnit = UNKNOWN;
+        m_DrawFBO = UNKNOWN;
+        m_ReadFBO = UNKNOWN;
+        for (unsigned i = 0; i < MAX_TEXTURE_UNITS; ++i) {
+            for (unsigned t = 0; t < TARGET_COUNT; ++t)
+                m_Textures[i][t] = UNKNOWN;
+            m_Samplers[i] = UNKNOWN;
+        }
+        for (unsigned i = 0; i < CAP_COUNT; ++i)
+            m_Caps[i] = UNKNOWN_BOOL;
+        m_DepthFunc = UNKNOWN;
+        m_DepthMask = UNKNOWN_BOOL;
+        m_ColorMask = UNKNOWN_BOOL;
+        m_CullFace = UNKNOWN;
+        m_Viewport[0] = m_Viewport[1] = m_Viewport[2] = m_Viewport[3] = -1;
+        m_ClearColorValid = false;
+    }
+
+    // start counting a new frame, the counters of the finished one stay readable through lastFrame()
+    void beginFrame() {
+        m_LastFrame = m_Current;
+        m_Current = FrameStats();
+    }
+
+    const FrameStats& lastFrame() const {
+        return m_LastFrame;
+    }
+
+    void useProgram(GLuint program) {
+        if (changed(m_Program, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(GLuint vao) {
+        if (changed(m_VAO, vao))
+            glBindVertexArray(vao);
+    }
+
+    void activeTexture(unsigned unit) {
+        if (changed(m_ActiveUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void bindTexture(unsigned unit, GLenum target, GLuint texture) {
+        int t = targetIndex(target);
+        if (unit >= MAX_TEXTURE_UNITS || t < 0) {
+            activeTexture(unit);
+            glBindTexture(target, texture);
+            ++m_Current.issued;
+            return;
+        }
+        if (m_Textures[unit][t] == texture) {
+            ++m_Current.elided;
+            return;
+        }
+        activeTexture(unit);
+        m_Textures[unit][t] = texture;
+        glBindTexture(target, texture);
+        ++m_Current.issued;
+    }
+
+    void bindSampler(unsigned unit, GLuint sampler) {
+        if (unit >= MAX_TEXTURE_UNITS) {
+            glBindSampler(unit, sampler);
+            ++m_Current.issued;
+            return;
+        }
+        if (changed(m_Samplers[unit], sampler))
+            glBindSampler(unit, sampler);
+    }
+
+    void bindFramebuffer(GLenum target, GLuint fbo) {
+        bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+        bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+        if ((!draw || m_DrawFBO == fbo) && (!read || m_ReadFBO == fbo)) {
+            ++m_Current.elided;
+            return;
+        }
+        if (draw)
+            m_DrawFBO = fbo;
+        if (read)
+            m_ReadFBO = fbo;
+        glBindFramebuffer(target, fbo);
+        ++m_Current.issued;
+    }
+
+    void enable(GLenum cap) {
+        setEnabled(cap, true);
+    }
+
+    void disable(GLenum cap) {
+        setEnabled(cap, false);
+    }
+
+    void setEnabled(GLenum cap, bool enabled) {
+        int c = capIndex(cap);
+        if (c >= 0) {
+            if (!changed(m_Caps[c], enabled ? 1u : 0u))
+                return;
+        } else {
+            ++m_Current.issued;
+        }
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+    }
+
+    void depthFunc(GLenum func) {
+        if (changed(m_DepthFunc, func))
+            glDepthFunc(func);
+    }
+
+    void depthMask(bool write) {
+        if (changed(m_DepthMask, write ? 1u : 0u))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    void colorMask(bool write) {
+        if (changed(m_ColorMask, write ? 1u : 0u)) {
+            GLboolean w = write ? GL_TRUE : GL_FALSE;
+            glColorMask(w, w, w, w);
+        }
+    }
+
+    void cullFace(GLenum face) {
+        if (changed(m_CullFace, face))
+            glCullFace(face);
+    }
+
+    void viewport(int x, int y, int width, int height) {
+        if (m_Viewport[0] == x && m_Viewport[1] == y && m_Viewport[2] == width && m_Viewport[3] == height) {
+            ++m_Current.elided;
+            return;
+        }
+        m_Viewport[0] = x;
+        m_Viewport[1] = y;
+        m_Viewport[2] = width;
+        m_Viewport[3] = height;
+        glViewport(x, y, width, height);
+        ++m_Current.issued;
+    }
+
+    void clearColor(float r, float g, float b, float a) {
+        if (m_ClearColorValid && m_ClearColor[0] == r && m_ClearColor[1] == g && m_ClearColor[2] == b && m_ClearColor[3] == a) {
+            ++m_Current.elided;
+            return;
+        }
+        m_ClearColorValid = true;
+        m_ClearColor[0] = r;
+        m_ClearColor[1] = g;
+        m_ClearColor[2] = b;
+        m_ClearColor[3] = a;
+        glClearColor(r, g, b, a);
+        ++m_Current.issued;
+    }
+
+    GLuint boundProgram() const {
+        return m_Program;
+    }
+
+    // Deleting unbinds the names wherever they are bound, and a new object can get a deleted
+    // one's name, so objects that come and go while rendering are deleted through the cache to
+    // keep it from eliding the new object's first bind.
+    void deleteTextures(GLsizei count, const GLuint* textures) {
+        for (GLsizei i = 0; i < count; ++i) {
+            for (unsigned unit = 0; unit < MAX_TEXTURE_UNITS; ++unit) {
+                for (unsigned t = 0; t < TARGET_COUNT; ++t) {
+                    if (m_Textures[unit][t] == textures[i])
+                        m_Textures[unit][t] = 0;
+                }
+            }
+        }
+        glDeleteTextures(count, textures);
+    }
+
+    void deleteFramebuffers(GLsizei count, const GLuint* framebuffers) {
+        for (GLsizei i = 0; i < count; ++i) {
+            if (m_DrawFBO == framebuffers[i])
+                m_DrawFBO = 0;
+            if (m_ReadFBO == framebuffers[i])
+                m_ReadFBO = 0;
+        }
+        glDeleteFramebuffers(count, framebuffers);
+    }
+
+private:
+    static const unsigned UNKNOWN = 0xFFFFFFFFu;
+    static const unsigned UNKNOWN_BOOL = 2u;
+    static const unsigned TARGET_COUNT = 5;
+    static const unsigned CAP_COUNT = 8;
+
+    // returns true (and remembers the new value) when the call has to reach the driver
+    bool changed(unsigned& cached, unsigned value) {
+        if (cached == value) {
+            ++m_Current.elided;
+            return false;
+        }
+        cached = value;
+        ++m_Current.issued;
+        return true;
+    }
+
+    static int targetIndex(GLenum target) {
+        switch (target) {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_CUBE_MAP: return 1;
+            case GL_TEXTURE_2D_ARRAY: return 2;
+            case GL_TEXTURE_BUFFER: return 3;
+            case GL_TEXTURE_3D: return 4;
+        }
+        return -1;
+    }
+
+    static int capIndex(GLenum cap) {
+        switch (cap) {
+            case GL_DEPTH_TEST: return 0;
+            case GL_CULL_FACE: return 1;
+            case GL_BLEND: return 2;
+            case GL_MULTISAMPLE: return 3;
+            case GL_SCISSOR_TEST: return 4;
+            case GL_STENCIL_TEST: return 5;
+            case GL_DEPTH_CLAMP: return 6;
+            case GL_POLYGON_OFFSET_FILL: return 7;
+        }
+        return -1;
+    }
+
+    unsigned m_Program;
+    unsigned m_VAO;
+    unsigned m_ActiveUnit;
+    unsigned m_DrawFBO;
+    unsigned m_ReadFBO;
+    unsigned m_Textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+    unsigned m_Samplers[MAX_TEXTURE_UNITS];
+    unsigned m_Caps[CAP_COUNT];
+    unsigned m_DepthFunc;
+    unsigned m_DepthMask;
+    unsigned m_ColorMask;
+    unsigned m_CullFace;
+    int m_Viewport[4];
+    float m_ClearColor[4];
+    bool m_ClearColorValid;
+
+    FrameStats m_Current;
+    FrameStats m_LastFrame;
+};
+
+// the one cache shared by everything that renders on the GL thread
+inline GLStateCache& glState() {
+    static GLStateCache cache;
+    return cache;
+}
+
+}
+#endif //PROJECT_BASE_GLSTATECACHE_H
@@ -0,0 +1,142 @@
+#ifndef PROJECT_BASE_GPUTIMER_H
+#define PROJECT_BASE_GPUTIMER_H
+
+#include <glad/glad.h>
+
+namespace rg {
+
+// Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries. Results are
+// read a few frames later from a small ring of queries so the CPU never waits on the GPU.
+// Only one timer can be running at a time (GL doesn't nest time elapsed queries).
+class GpuTimer {
+public:
+    static const unsigned LATENCY = 4;
+
+    GpuTimer() {
+        glGenQueries(LATENCY, m_Queries);
+    }
+
+    ~GpuTimer() {
+        glDeleteQueries(LATENCY, m_Queries);
+    }
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    void begin() {
+        glBeginQuery(GL_TIME_ELAPSED, m_Queries[m_Index]);
+    }
+
+    void end() {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_Issued[m_Index] = true;
+        m_Index = (m_Index + 1) % LATENCY;
+        // the query we are about to reuse next is the oldest one, its result is usually there by now
+        if (m_Issued[m_Index]) {
+            GLint available = 0;
+            glGetQueryObjectiv(m_Queries[m_Index], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(m_Queries[m_Index], GL_QUERY_RESULT, &nanoseconds);
+                float ms = (float) (nanoseconds / 1.0e6);
+                // light smoothing so the numbers in the UI are readable
+                m_Milliseconds = m_HasResult ? m_Milliseconds * 0.9f + ms * 0.1f : ms;
+                m_HasResult = true;
+            }
+            m_Issued[m_Index] = false;
+        }
+    }
+
+    float milliseconds() const {
+        return m_Milliseconds;
+    }
+
+    bool hasResult() const {
+        return m_HasResult;
+    }
+
+private:
+    GLuint m_Queries[LATENCY];
+    bool m_Issued[LATENCY] = {};
+    unsigned m_Index = 0;
+    float m_Milliseconds = 0.0f;
+    bool m_HasResult = false;
+};
+
+// GPU time of a whole frame, from timestamps instead of a time elapsed query so the GpuTimers
+// of the single passes can run inside it. Same ring of queries and smoothing as GpuTimer; the
+// last raw reading is kept too, with the number of the frame it belongs to, for controllers
+// that must not act on time measured before their previous change.
+class GpuFrameTimer {
+public:
+    static const unsigned LATENCY = GpuTimer::LATENCY;
+
+    GpuFrameTimer() {
+        glGenQueries(2 * LATENCY, m_Queries);
+    }
+
+    ~GpuFrameTimer() {
+        glDeleteQueries(2 * LATENCY, m_Queries);
+    }
+
+    GpuFrameTimer(const GpuFrameTimer&) = delete;
+    GpuFrameTimer& operator=(const GpuFrameTimer&) = delete;
+
+    void begin(unsigned frame) {
+        glQueryCounter(m_Queries[2 * m_Index], GL_TIMESTAMP);
+        m_Frames[m_Index] = frame;
+    }
+
+    void end() {
+        glQueryCounter(m_Queries[2 * m_Index + 1], GL_TIMESTAMP);
+        m_Issued[m_Index] = true;
+        m_Index = (m_Index + 1) % LATENCY;
+        if (m_Issued[m_Index]) {
+            // the end stamp comes last, when it is there the start is too
+            GLint available = 0;
+            glGetQueryObjectiv(m_Queries[2 * m_Index + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 start = 0, end = 0;
+                glGetQueryObjectui64v(m_Queries[2 * m_Index], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(m_Queries[2 * m_Index + 1], GL_QUERY_RESULT, &end);
+                float ms = (float) ((end - start) / 1.0e6);
+                m_Milliseconds = m_HasResult ? m_Milliseconds * 0.9f + ms * 0.1f : ms;
+                m_LastMilliseconds = ms;
+                m_LastFrame = m_Frames[m_Index];
+                m_HasResult = true;
+            }
+            m_Issued[m_Index] = false;
+        }
+    }
+
+    float milliseconds() const {
+        return m_Milliseconds;
+    }
+
+    // the newest reading unsmoothed, and the frame begin() was given for it
+    float lastMilliseconds() const {
+        return m_LastMilliseconds;
+    }
+
+    unsigned lastFrame() const {
+        return m_LastFrame;
+    }
+
+    bool hasResult() const {
+        return m_HasResult;
+    }
+
+private:
+    // start and end stamp of every frame in the ring
+    GLuint m_Queries[2 * LATENCY];
+    unsigned m_Frames[LATENCY] = {};
+    bool m_Issued[LATENCY] = {};
+    unsigned m_Index = 0;
+    float m_Milliseconds = 0.0f;
+    float m_LastMilliseconds = 0.0f;
+    unsigned m_LastFrame = 0;
+    bool m_HasResult = false;
+};
+
+}
+#endif //PROJECT_BASE_GPUTIMER_H
@@ -0,0 +1,46 @@
+#ifndef PROJECT_BASE_IMAGE_H
+#define PROJECT_BASE_IMAGE_H
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// Decoded pixels on the CPU, produced off the GL thread and uploaded later.
+// stb's vertical flip is a process-wide flag, so rows are flipped here instead
+// and decoding stays safe to run on several threads at once.
+struct Image {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<unsigned char> pixels;
+    std::string path;
+
+    bool valid() const {
+        return !pixels.empty();
+    }
+
+    static Image decode(const std::string& path, bool flipVertically) {
+        Image image;
+        image.path = path;
+        unsigned char* data = stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0);
+        if (!data)
+            return image;
+        size_t rowBytes = (size_t) image.width * image.channels;
+        image.pixels.assign(data, data + rowBytes * image.height);
+        stbi_image_free(data);
+        if (flipVertically) {
+            for (int top = 0, bottom = image.height - 1; top < bottom; ++top, --bottom)
+                std::swap_ranges(&image.pixels[top * rowBytes], &image.pixels[top * rowBytes] + rowBytes,
+                                 &image.pixels[bottom * rowBytes]);
+        }
+        return image;
+    }
+};
+
+}
+#endif //PROJECT_BASE_IMAGE_H
@@ -0,0 +1,310 @@
+#ifndef PROJECT_BASE_JOBSYSTEM_H
+#define PROJECT_BASE_JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace rg {
+
+// A scheduled job. It becomes runnable once every job it depends on has finished.
+class Job {
+public:
+    bool finished() const {
+        return m_Finished.load(std::memory_order_acquire);
+    }
+
+private:
+    friend class JobSystem;
+
+    std::function<void()> m_Function;
+    // unfinished dependencies, plus one held while the job is being scheduled
+    std::atomic<int> m_Pending{1};
+    std::atomic<bool> m_Finished{false};
+    bool m_MainThread = false;
+    bool m_Background = false;
+    // guards m_Continuations against jobs registering while this one finishes
+    std::mutex m_Mutex;
+    std::vector<std::shared_ptr<Job>> m_Continuations;
+};
+
+using JobHandle = std::shared_ptr<Job>;
+
+// Work-stealing scheduler. Every worker owns a deque: jobs it schedules go to the back and
+// it works from the back, so related work stays on one core while it is still in cache;
+// idle workers steal the oldest jobs from the front of the others' deques. Jobs that have to
+// run on the thread that created the system (anything touching GL) go to a separate queue
+// drained by runMainThreadJobs() or while that thread waits. Waiting never blocks a thread
+// that could be working: wait() runs other ready jobs until the awaited one is done.
+// Background jobs are for work that takes seconds, like a bake: only the workers run them and
+// only when no other job is ready, and whatever they schedule is background work too, so the
+// main thread never ends up inside one while it waits for its own jobs.
+class JobSystem {
+public:
+    // the creating thread helps whenever it waits, so one core is left to it by default
+    explicit JobSystem(unsigned workers = std::max(1u, std::thread::hardware_concurrency()) - 1)
+            : m_Queues(std::max(1u, workers)), m_MainThread(std::this_thread::get_id()) {
+        for (unsigned i = 0; i < workers; ++i)
+            m_Threads.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(m_SleepMutex);
+            m_Stop = true;
+        }
+        m_Wake.notify_all();
+        for (std::thread& thread : m_Threads)
+            thread.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    unsigned workerCount() const {
+        return (unsigned) m_Threads.size();
+    }
+
+    JobHandle schedule(std::function<void()> function, std::initializer_list<JobHandle> dependencies = {}) {
+        return submit(std::move(function), dependencies.begin(), dependencies.end(), false);
+    }
+
+    JobHandle schedule(std::function<void()> function, const std::vector<JobHandle>& dependencies) {
+        return submit(std::move(function), dependencies.begin(), dependencies.end(), false);
+    }
+
+    JobHandle scheduleOnMainThread(std::function<void()> function, std::initializer_list<JobHandle> dependencies = {}) {
+        return submit(std::move(function), dependencies.begin(), dependencies.end(), true);
+    }
+
+    JobHandle scheduleOnMainThread(std::function<void()> function, const std::vector<JobHandle>& dependencies) {
+        return submit(std::move(function), dependencies.begin(), dependencies.end(), true);
+    }
+
+    // without workers this is an ordinary job, it only runs once some thread waits for it
+    JobHandle scheduleBackground(std::function<void()> function) {
+        const JobHandle* none = nullptr;
+        return submit(std::move(function), none, none, false, true);
+    }
+
+    void wait(const JobHandle& job) {
+        while (!job->finished()) {
+            if (!runOne())
+                std::this_thread::yield();
+        }
+    }
+
+    void wait(const std::vector<JobHandle>& jobs) {
+        for (const JobHandle& job : jobs)
+            wait(job);
+    }
+
+    // runs the main thread jobs that are ready; call it from the main thread
+    unsigned runMainThreadJobs() {
+        unsigned count = 0;
+        while (JobHandle job = popMainThreadJob()) {
+            execute(job);
+            ++count;
+        }
+        return count;
+    }
+
+    // calls body(chunk, begin, end) for consecutive chunks of [0, count) and returns when
+    // all of them are done; chunk indices are dense, so results can go to per-chunk slots.
+    // The chunks are handed out from a shared counter, which balances uneven chunks better
+    // than a fixed split, and the calling thread takes chunks too.
+    template<typename Body>
+    void parallelFor(unsigned count, unsigned grain, const Body& body) {
+        if (count == 0)
+            return;
+        const unsigned chunks = (count + grain - 1) / grain;
+        std::atomic<unsigned> next(0);
+        auto run = [&]() {
+            for (unsigned chunk = next.fetch_add(1); chunk < chunks; chunk = next.fetch_add(1))
+                body(chunk, chunk * grain, std::min(count, (chunk + 1) * grain));
+        };
+        std::vector<JobHandle> helpers;
+        for (unsigned i = 0, n = std::min(workerCount(), chunks - 1); i < n; ++i)
+            helpers.push_back(schedule(run));
+        run();
+        // the helpers reference this call's locals, so every one of them has to be finished
+        wait(helpers);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    template<typename Iterator>
+    JobHandle submit(std::function<void()> function, Iterator first, Iterator last, bool mainThread,
+                     bool background = false) {
+        JobHandle job = std::make_shared<Job>();
+        job->m_Function = std::move(function);
+        job->m_MainThread = mainThread;
+        // without workers nobody else could run it, the waiting thread has to
+        job->m_Background = !mainThread && !m_Threads.empty() && (background || runningBackground());
+        for (Iterator dependency = first; dependency != last; ++dependency) {
+            Job& before = **dependency;
+            std::lock_guard<std::mutex> lock(before.m_Mutex);
+            if (before.m_Finished.load(std::memory_order_relaxed))
+                continue;
+            job->m_Pending.fetch_add(1, std::memory_order_relaxed);
+            before.m_Continuations.push_back(job);
+        }
+        release(job);
+        return job;
+    }
+
+    // drops one pending count, the last one makes the job runnable
+    void release(const JobHandle& job) {
+        if (job->m_Pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            enqueue(job);
+    }
+
+    void enqueue(const JobHandle& job) {
+        if (job->m_MainThread) {
+            std::lock_guard<std::mutex> lock(m_MainMutex);
+            m_MainJobs.push_back(job);
+            return;
+        }
+        if (job->m_Background) {
+            std::lock_guard<std::mutex> lock(m_Background.mutex);
+            m_Background.jobs.push_back(job);
+        } else {
+            int self = workerIndex();
+            Queue& queue = m_Queues[self >= 0 ? (unsigned) self : m_NextQueue.fetch_add(1) % m_Queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(job);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_SleepMutex);
+            ++m_Queued;
+        }
+        m_Wake.notify_one();
+    }
+
+    // the caller's own deque from the back, then the others from the front, then background
+    // work if the caller is a worker
+    JobHandle take(int self) {
+        const unsigned count = (unsigned) m_Queues.size();
+        const unsigned start = self >= 0 ? (unsigned) self : 0;
+        for (unsigned i = 0; i < count; ++i) {
+            Queue& queue = m_Queues[(start + i) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                continue;
+            JobHandle job;
+            if (i == 0 && self >= 0) {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+            } else {
+                job = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+            }
+            m_Queued.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+        if (self < 0)
+            return nullptr;
+        std::lock_guard<std::mutex> lock(m_Background.mutex);
+        if (m_Background.jobs.empty())
+            return nullptr;
+        JobHandle job = std::move(m_Background.jobs.front());
+        m_Background.jobs.pop_front();
+        m_Queued.fetch_sub(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    JobHandle popMainThreadJob() {
+        std::lock_guard<std::mutex> lock(m_MainMutex);
+        if (m_MainJobs.empty())
+            return nullptr;
+        JobHandle job = std::move(m_MainJobs.front());
+        m_MainJobs.pop_front();
+        return job;
+    }
+
+    bool runOne() {
+        JobHandle job;
+        if (std::this_thread::get_id() == m_MainThread)
+            job = popMainThreadJob();
+        if (!job)
+            job = take(workerIndex());
+        if (!job)
+            return false;
+        execute(job);
+        return true;
+    }
+
+    void execute(const JobHandle& job) {
+        // a worker waiting inside a background job can run a normal one meanwhile
+        bool& background = runningBackground();
+        const bool outer = background;
+        background = job->m_Background;
+        job->m_Function();
+        background = outer;
+        job->m_Function = nullptr;
+        std::vector<JobHandle> continuations;
+        {
+            std::lock_guard<std::mutex> lock(job->m_Mutex);
+            job->m_Finished.store(true, std::memory_order_release);
+            continuations.swap(job->m_Continuations);
+        }
+        for (const JobHandle& next : continuations)
+            release(next);
+    }
+
+    void workerLoop(unsigned index) {
+        currentWorker() = std::make_pair(this, (int) index);
+        for (;;) {
+            if (JobHandle job = take((int) index)) {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_SleepMutex);
+            if (m_Stop)
+                return;
+            m_Wake.wait(lock, [this]() { return m_Stop || m_Queued.load(std::memory_order_relaxed) > 0; });
+        }
+    }
+
+    static std::pair<const JobSystem*, int>& currentWorker() {
+        static thread_local std::pair<const JobSystem*, int> worker(nullptr, -1);
+        return worker;
+    }
+
+    static bool& runningBackground() {
+        static thread_local bool background = false;
+        return background;
+    }
+
+    int workerIndex() const {
+        const std::pair<const JobSystem*, int>& worker = currentWorker();
+        return worker.first == this ? worker.second : -1;
+    }
+
+    std::vector<Queue> m_Queues;
+    Queue m_Background;
+    std::vector<std::thread> m_Threads;
+    std::atomic<unsigned> m_NextQueue{0};
+    std::atomic<int> m_Queued{0};
+    std::mutex m_SleepMutex;
+    std::condition_variable m_Wake;
+    bool m_Stop = false;
+    std::thread::id m_MainThread;
+    std::mutex m_MainMutex;
+    std::deque<JobHandle> m_MainJobs;
+};
+
+}
+#endif //PROJECT_BASE_JOBSYSTEM_H
@@ -0,0 +1,332 @@
+#ifndef PROJECT_BASE_LIGHTCLUSTERS_H
+#define PROJECT_BASE_LIGHTCLUSTERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <rg/Bounds.h>
+#include <rg/GLStateCache.h>
+#include <rg/JobSystem.h>
+#include <rg/LightSpheres.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+struct PointLight {
+    glm::vec3 position;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+// Distance at which the light's brightest channel falls below threshold, solving
+// constant + linear * d + quadratic * d^2 = brightness / threshold. Past it the light is
+// treated as having no effect at all.
+inline float lightRange(const PointLight& light, float threshold = 1.0f / 256.0f) {
+    glm::vec3 total = glm::abs(light.ambient) + glm::abs(light.diffuse) + glm::abs(light.specular);
+    float brightness = std::max(total.x, std::max(total.y, total.z));
+    float c = light.constant - brightness / threshold;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (light.quadratic <= 0.0f)
+        return light.linear > 0.0f ? -c / light.linear : 1e30f;
+    return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) /
+           (2.0f * light.quadratic);
+}
+
+// What the lighting shader reads: the lights, then per cluster an (offset, count) range into
+// one compact list of light indices. Per-object ranges, when built, follow the COUNT cluster
+// ranges and index the same list.
+struct LightClusters {
+    static const unsigned TILES_X = 16;
+    static const unsigned TILES_Y = 9;
+    static const unsigned SLICES = 24;
+    static const unsigned COUNT = TILES_X * TILES_Y * SLICES;
+    // RGBA32F texels per light: position and range, ambient and constant, diffuse and
+    // linear, specular and quadratic
+    static const unsigned TEXELS_PER_LIGHT = 4;
+
+    std::vector<glm::vec4> lights;
+    std::vector<glm::uvec2> ranges;
+    std::vector<GLuint> indices;
+    // slice = log(view depth) * scale + bias
+    glm::vec2 sliceScaleBias = glm::vec2(0.0f);
+    unsigned maxLightsPerCluster = 0;
+    unsigned maxLightsPerObject = 0;
+};
+
+// Clustered light assignment. The view frustum is cut into TILES_X x TILES_Y screen tiles
+// and SLICES depth slices spaced exponentially, so near clusters aren't stretched thin along
+// the view direction. Lights outside the frustum are dropped, the rest are tested against
+// the view space boxes of the clusters in the slices they reach, four at a time with
+// LightSpheres; the slices are filled in parallel jobs and concatenated. A fragment then
+// shades only the lights listed for its cluster. addObjectLists() does the same for world
+// space object bounds, for shading an object with one list instead of a per-fragment lookup.
+class LightClusterBuilder {
+public:
+    explicit LightClusterBuilder(JobSystem& jobs) : m_Jobs(jobs) {}
+
+    void build(const std::vector<PointLight>& lights, const glm::mat4& view, float fovy, float aspect,
+               float zNear, float zFar, LightClusters& out) {
+        if (fovy != m_Fovy || aspect != m_Aspect || zNear != m_Near || zFar != m_Far)
+            buildClusterBoxes(fovy, aspect, zNear, zFar);
+
+        out.lights.resize(lights.size() * LightClusters::TEXELS_PER_LIGHT);
+        m_Bounds.clear();
+        m_WorldSpheres.clear();
+        for (unsigned i = 0; i < lights.size(); ++i) {
+            const PointLight& light = lights[i];
+            float range = lightRange(light);
+            glm::vec4* texels = &out.lights[i * LightClusters::TEXELS_PER_LIGHT];
+            texels[0] = glm::vec4(light.position, range);
+            texels[1] = glm::vec4(light.ambient, light.constant);
+            texels[2] = glm::vec4(light.diffuse, light.linear);
+            texels[3] = glm::vec4(light.specular, light.quadratic);
+            if (range <= 0.0f)
+                continue;
+            m_WorldSpheres.add(light.position, range, i);
+            LightBounds bounds;
+            if (footprint(glm::vec3(view * glm::vec4(light.position, 1.0f)), range, i, bounds))
+                m_Bounds.push_back(bounds);
+        }
+
+        // one job per slice, each writes the lists of its own clusters
+        m_Slices.resize(LightClusters::SLICES);
+        m_Jobs.parallelFor(LightClusters::SLICES, 1, [&](unsigned, unsigned begin, unsigned end) {
+            for (unsigned slice = begin; slice < end; ++slice)
+                fillSlice(slice);
+        });
+
+        out.ranges.resize(LightClusters::COUNT);
+        out.indices.clear();
+        out.maxLightsPerCluster = 0;
+        out.maxLightsPerObject = 0;
+        for (unsigned slice = 0; slice < LightClusters::SLICES; ++slice) {
+            const Slice& in = m_Slices[slice];
+            unsigned base = (unsigned) out.indices.size();
+            for (unsigned tile = 0; tile < TILES_PER_SLICE; ++tile) {
+                out.ranges[slice * TILES_PER_SLICE + tile] = glm::uvec2(base + in.offsets[tile], in.counts[tile]);
+                out.maxLightsPerCluster = std::max(out.maxLightsPerCluster, in.counts[tile]);
+            }
+            out.indices.insert(out.indices.end(), in.indices.begin(), in.indices.end());
+        }
+        float logDepthRange = std::log(zFar / zNear);
+        out.sliceScaleBias = glm::vec2(LightClusters::SLICES / logDepthRange,
+                                       -(float) LightClusters::SLICES * std::log(zNear) / logDepthRange);
+    }
+
+    // appends a range per object after the cluster ranges, for the objects flagged in
+    // wanted, with the lights whose sphere touches the object's world box; the others get
+    // an empty range. Has to follow build() for the same lights.
+    void addObjectLists(const std::vector<AABB>& bounds, const std::vector<unsigned char>& wanted, LightClusters& out) {
+        const unsigned count = (unsigned) bounds.size();
+        const unsigned chunks = (count + OBJECTS_PER_CHUNK - 1) / OBJECTS_PER_CHUNK;
+        m_ObjectChunks.resize(std::max(m_ObjectChunks.size(), (size_t) chunks));
+        m_Jobs.parallelFor(count, OBJECTS_PER_CHUNK, [&](unsigned chunk, unsigned begin, unsigned end) {
+            Slice& list = m_ObjectChunks[chunk];
+            list.indices.clear();
+            list.offsets.resize(end - begin);
+            list.counts.resize(end - begin);
+            for (unsigned id = begin; id < end; ++id) {
+                list.offsets[id - begin] = (unsigned) list.indices.size();
+                if (wanted[id] && !bounds[id].empty())
+                    m_WorldSpheres.overlapping(bounds[id].min, bounds[id].max, list.indices);
+                list.counts[id - begin] = (unsigned) list.indices.size() - list.offsets[id - begin];
+            }
+        });
+
+        out.ranges.resize(LightClusters::COUNT + count);
+        for (unsigned chunk = 0; chunk < chunks; ++chunk) {
+            const Slice& in = m_ObjectChunks[chunk];
+            unsigned base = (unsigned) out.indices.size();
+            for (unsigned i = 0; i < in.counts.size(); ++i) {
+                out.ranges[LightClusters::COUNT + chunk * OBJECTS_PER_CHUNK + i] = glm::uvec2(base + in.offsets[i], in.counts[i]);
+                out.maxLightsPerObject = std::max(out.maxLightsPerObject, in.counts[i]);
+            }
+            out.indices.insert(out.indices.end(), in.indices.begin(), in.indices.end());
+        }
+    }
+
+private:
+    static const unsigned OBJECTS_PER_CHUNK = 64;
+    static const unsigned TILES_PER_SLICE = LightClusters::TILES_X * LightClusters::TILES_Y;
+
+    struct LightBounds {
+        glm::vec3 center;
+        float radius;
+        unsigned light;
+        int sliceMin;
+        int sliceMax;
+    };
+
+    struct Slice {
+        // view space spheres of the lights reaching the slice
+        LightSpheres spheres;
+        std::vector<GLuint> indices;
+        std::vector<unsigned> offsets;
+        std::vector<unsigned> counts;
+    };
+
+    struct Box {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    void buildClusterBoxes(float fovy, float aspect, float zNear, float zFar) {
+        m_Fovy = fovy;
+        m_Aspect = aspect;
+        m_Near = zNear;
+        m_Far = zFar;
+        m_TanY = std::tan(fovy / 2.0f);
+        m_TanX = m_TanY * aspect;
+        m_Boxes.resize(LightClusters::COUNT);
+        for (unsigned slice = 0; slice < LightClusters::SLICES; ++slice) {
+            float depths[2] = {sliceDepth(slice), sliceDepth(slice + 1)};
+            for (unsigned y = 0; y < LightClusters::TILES_Y; ++y) {
+                for (unsigned x = 0; x < LightClusters::TILES_X; ++x) {
+                    float ndcX[2] = {-1.0f + 2.0f * x / LightClusters::TILES_X, -1.0f + 2.0f * (x + 1) / LightClusters::TILES_X};
+                    float ndcY[2] = {-1.0f + 2.0f * y / LightClusters::TILES_Y, -1.0f + 2.0f * (y + 1) / LightClusters::TILES_Y};
+                    Box box;
+                    box.min = glm::vec3(1e30f);
+                    box.max = glm::vec3(-1e30f);
+                    for (float depth : depths) {
+                        for (unsigned corner = 0; corner < 4; ++corner) {
+                            glm::vec3 p(ndcX[corner & 1] * depth * m_TanX, ndcY[corner >> 1] * depth * m_TanY, -depth);
+                            box.min = glm::min(box.min, p);
+                            box.max = glm::max(box.max, p);
+                        }
+                    }
+                    m_Boxes[(slice * LightClusters::TILES_Y + y) * LightClusters::TILES_X + x] = box;
+                }
+            }
+        }
+    }
+
+    float sliceDepth(unsigned slice) const {
+        return m_Near * std::pow(m_Far / m_Near, (float) slice / LightClusters::SLICES);
+    }
+
+    int depthSlice(float depth) const {
+        float slice = std::log(depth / m_Near) / std::log(m_Far / m_Near) * LightClusters::SLICES;
+        return std::max(0, std::min((int) LightClusters::SLICES - 1, (int) std::floor(slice)));
+    }
+
+    // the slices the view space sphere can touch, from its depth range; false when its
+    // bounding box projects outside the screen
+    bool footprint(const glm::vec3& center, float radius, unsigned light, LightBounds& bounds) const {
+        float nearDepth = -center.z - radius;
+        float farDepth = -center.z + radius;
+        if (farDepth < m_Near || nearDepth > m_Far)
+            return false;
+        bounds.center = center;
+        bounds.radius = radius;
+        bounds.light = light;
+        bounds.sliceMin = depthSlice(std::max(nearDepth, m_Near));
+        bounds.sliceMax = depthSlice(std::min(farDepth, m_Far));
+        // spheres reaching through the near plane can cover any part of the screen
+        if (nearDepth > m_Near) {
+            glm::vec2 ndcMin(1e30f), ndcMax(-1e30f);
+            for (unsigned corner = 0; corner < 8; ++corner) {
+                glm::vec3 p = center + radius * glm::vec3(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f,
+                                                          corner & 4 ? 1.0f : -1.0f);
+                glm::vec2 ndc(p.x / (-p.z * m_TanX), p.y / (-p.z * m_TanY));
+                ndcMin = glm::min(ndcMin, ndc);
+                ndcMax = glm::max(ndcMax, ndc);
+            }
+            if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+                return false;
+        }
+        return true;
+    }
+
+    void fillSlice(unsigned slice) {
+        Slice& out = m_Slices[slice];
+        out.spheres.clear();
+        for (const LightBounds& light : m_Bounds) {
+            if ((int) slice >= light.sliceMin && (int) slice <= light.sliceMax)
+                out.spheres.add(light.center, light.radius, light.light);
+        }
+        out.indices.clear();
+        out.offsets.assign(TILES_PER_SLICE, 0);
+        out.counts.assign(TILES_PER_SLICE, 0);
+        for (unsigned tile = 0; tile < TILES_PER_SLICE; ++tile) {
+            const Box& box = m_Boxes[slice * TILES_PER_SLICE + tile];
+            out.offsets[tile] = (unsigned) out.indices.size();
+            out.spheres.overlapping(box.min, box.max, out.indices);
+            out.counts[tile] = (unsigned) out.indices.size() - out.offsets[tile];
+        }
+    }
+
+    JobSystem& m_Jobs;
+    std::vector<LightBounds> m_Bounds;
+    LightSpheres m_WorldSpheres;
+    std::vector<Slice> m_Slices;
+    std::vector<Slice> m_ObjectChunks;
+    std::vector<Box> m_Boxes;
+    float m_Fovy = 0.0f;
+    float m_Aspect = 0.0f;
+    float m_Near = 0.0f;
+    float m_Far = 0.0f;
+    float m_TanX = 0.0f;
+    float m_TanY = 0.0f;
+};
+
+// The three texture buffers the lighting shader reads LightClusters from. Lives on the GL thread.
+class LightClusterBuffers {
+public:
+    LightClusterBuffers() {
+        glGenBuffers(3, m_Buffers);
+        glGenTextures(3, m_Textures);
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        for (unsigned i = 0; i < 3; ++i) {
+            glBindBuffer(GL_TEXTURE_BUFFER, m_Buffers[i]);
+            // a texture buffer needs storage before it can be attached
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, m_Textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_Buffers[i]);
+        }
+    }
+
+    ~LightClusterBuffers() {
+        glDeleteTextures(3, m_Textures);
+        glDeleteBuffers(3, m_Buffers);
+    }
+
+    LightClusterBuffers(const LightClusterBuffers&) = delete;
+    LightClusterBuffers& operator=(const LightClusterBuffers&) = delete;
+
+    // the whole set is rewritten every frame, so each upload orphans the old storage
+    void upload(const LightClusters& clusters) {
+        fill(LIGHTS, clusters.lights.size() * sizeof(glm::vec4), clusters.lights.data());
+        fill(RANGES, clusters.ranges.size() * sizeof(glm::uvec2), clusters.ranges.data());
+        fill(INDICES, clusters.indices.size() * sizeof(GLuint), clusters.indices.data());
+    }
+
+    void bind(unsigned lightUnit, unsigned rangeUnit, unsigned indexUnit) const {
+        glState().bindTexture(lightUnit, GL_TEXTURE_BUFFER, m_Textures[LIGHTS]);
+        glState().bindTexture(rangeUnit, GL_TEXTURE_BUFFER, m_Textures[RANGES]);
+        glState().bindTexture(indexUnit, GL_TEXTURE_BUFFER, m_Textures[INDICES]);
+    }
+
+private:
+    enum { LIGHTS, RANGES, INDICES };
+
+    void fill(unsigned which, size_t bytes, const void* data) {
+        glBindBuffer(GL_TEXTURE_BUFFER, m_Buffers[which]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max(bytes, (size_t) 16), nullptr, GL_STREAM_DRAW);
+        if (bytes)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+    }
+
+    GLuint m_Buffers[3];
+    GLuint m_Textures[3];
+};
+
+}
+#endif //PROJECT_BASE_LIGHTCLUSTERS_H
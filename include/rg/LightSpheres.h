@@ -0,0 +1,105 @@
+#ifndef PROJECT_BASE_LIGHTSPHERES_H
+#define PROJECT_BASE_LIGHTSPHERES_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+#if !defined(RG_LIGHT_SPHERES_SCALAR) && \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RG_LIGHT_SPHERES_SSE 1
+#include <emmintrin.h>
+#endif
+
+namespace rg {
+
+// Light range spheres laid out as a structure of arrays, padded to a multiple of four, so
+// overlapping() tests four lights against a box per SSE instruction. Boxes are tested by
+// the squared distance from the sphere center to the closest point of the box. Without SSE2
+// the same test runs one light at a time, as it does when RG_LIGHT_SPHERES_SCALAR is defined.
+class LightSpheres {
+public:
+    void clear() {
+        m_X.clear();
+        m_Y.clear();
+        m_Z.clear();
+        m_RadiusSquared.clear();
+        m_Light.clear();
+        m_Count = 0;
+    }
+
+    // light is what overlapping() reports for this sphere
+    void add(const glm::vec3& center, float radius, unsigned light) {
+        // storage grows a group of four at a time; unused lanes have a negative squared
+        // radius, which no distance passes
+        if (m_Count % 4 == 0) {
+            m_X.resize(m_Count + 4, 0.0f);
+            m_Y.resize(m_Count + 4, 0.0f);
+            m_Z.resize(m_Count + 4, 0.0f);
+            m_RadiusSquared.resize(m_Count + 4, -1.0f);
+            m_Light.resize(m_Count + 4, 0);
+        }
+        m_X[m_Count] = center.x;
+        m_Y[m_Count] = center.y;
+        m_Z[m_Count] = center.z;
+        m_RadiusSquared[m_Count] = radius * radius;
+        m_Light[m_Count] = light;
+        ++m_Count;
+    }
+
+    unsigned size() const {
+        return m_Count;
+    }
+
+    // appends the lights whose sphere touches the box [min, max], in the order they were added
+    template<typename Index>
+    void overlapping(const glm::vec3& min, const glm::vec3& max, std::vector<Index>& out) const {
+        const unsigned padded = (unsigned) m_X.size();
+#ifdef RG_LIGHT_SPHERES_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 minX = _mm_set1_ps(min.x), minY = _mm_set1_ps(min.y), minZ = _mm_set1_ps(min.z);
+        const __m128 maxX = _mm_set1_ps(max.x), maxY = _mm_set1_ps(max.y), maxZ = _mm_set1_ps(max.z);
+        for (unsigned i = 0; i < padded; i += 4) {
+            __m128 x = _mm_loadu_ps(&m_X[i]);
+            __m128 y = _mm_loadu_ps(&m_Y[i]);
+            __m128 z = _mm_loadu_ps(&m_Z[i]);
+            // per axis distance outside the box, zero inside
+            __m128 dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)));
+            __m128 dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)));
+            __m128 dz = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)));
+            __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            int hits = _mm_movemask_ps(_mm_cmple_ps(distanceSquared, _mm_loadu_ps(&m_RadiusSquared[i])));
+            while (hits) {
+                int lane = ctz(hits);
+                out.push_back((Index) m_Light[i + lane]);
+                hits &= hits - 1;
+            }
+        }
+#else
+        for (unsigned i = 0; i < padded; ++i) {
+            glm::vec3 center(m_X[i], m_Y[i], m_Z[i]);
+            glm::vec3 d = glm::max(glm::vec3(0.0f), glm::max(min - center, center - max));
+            if (glm::dot(d, d) <= m_RadiusSquared[i])
+                out.push_back((Index) m_Light[i]);
+        }
+#endif
+    }
+
+private:
+#ifdef RG_LIGHT_SPHERES_SSE
+    // index of the lowest set bit of a 4 bit mask
+    static int ctz(int mask) {
+        return mask & 1 ? 0 : mask & 2 ? 1 : mask & 4 ? 2 : 3;
+    }
+#endif
+
+    std::vector<float> m_X;
+    std::vector<float> m_Y;
+    std::vector<float> m_Z;
+    std::vector<float> m_RadiusSquared;
+    std::vector<unsigned> m_Light;
+    unsigned m_Count = 0;
+};
+
+}
+#endif //PROJECT_BASE_LIGHTSPHERES_H
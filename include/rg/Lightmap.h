@@ -0,0 +1,859 @@
+#ifndef PROJECT_BASE_LIGHTMAP_H
+#define PROJECT_BASE_LIGHTMAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <rg/Error.h>
+#include <rg/GLStateCache.h>
+#include <rg/JobSystem.h>
+#include <rg/LightClusters.h>
+#include <rg/Scene.h>
+#include <rg/TriangleBVH.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rg {
+
+struct LightmapSettings {
+    // indirect samples per texel, taken SAMPLES_PER_PASS at a time
+    unsigned samples = 64;
+    // how far each indirect sample follows the light, 0 bakes direct light only
+    unsigned bounces = 2;
+    // the bake stops after the pass that runs past this, with fewer samples than asked for
+    float timeBudgetSeconds = 60.0f;
+};
+
+// The lights a lightmap holds: the moonlight and the scene's point lights that neither move
+// nor pulse, which keeps their index in the frame's light list; bit i of pointMask stands for
+// light i. Everything else stays dynamic.
+struct LightmapLights {
+    glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    glm::vec3 ambient = glm::vec3(0.0f);
+    glm::vec3 diffuse = glm::vec3(0.0f);
+    std::vector<PointLight> points;
+    uint32_t pointMask = 0;
+
+    // the bakeable lights of the scene, with the given moonlight
+    static LightmapLights of(const Scene& scene, const glm::vec3& direction, const glm::vec3& ambient,
+                             const glm::vec3& diffuse) {
+        LightmapLights lights;
+        lights.direction = direction;
+        lights.ambient = ambient;
+        lights.diffuse = diffuse;
+        const Scene::PointLights& scenePoints = scene.lights;
+        for (unsigned i = 0; i < scenePoints.size() && i < 32; ++i) {
+            unsigned entity = scenePoints.entity[i];
+            if (scenePoints.pulse[i] || !scene.graph.isStatic(entity))
+                continue;
+            PointLight light;
+            light.position = scene.position(entity);
+            light.ambient = scenePoints.ambient[i];
+            light.diffuse = scenePoints.diffuse[i];
+            light.specular = scenePoints.specular[i];
+            light.constant = scenePoints.constant[i];
+            light.linear = scenePoints.linear[i];
+            light.quadratic = scenePoints.quadratic[i];
+            lights.points.push_back(light);
+            lights.pointMask |= 1u << i;
+        }
+        return lights;
+    }
+
+    bool sameMoonlight(const glm::vec3& otherDirection, const glm::vec3& otherAmbient,
+                       const glm::vec3& otherDiffuse) const {
+        return direction == otherDirection && ambient == otherAmbient && diffuse == otherDiffuse;
+    }
+
+    uint64_t pointsHash() const {
+        uint64_t hash = fnv1a(&pointMask, sizeof(pointMask));
+        return points.empty() ? hash : fnv1a(points.data(), points.size() * sizeof(PointLight), hash);
+    }
+
+    static uint64_t fnv1a(const void* data, size_t bytes, uint64_t hash = 14695981039346656037ull) {
+        const unsigned char* c = (const unsigned char*) data;
+        for (size_t i = 0; i < bytes; ++i) {
+            hash ^= c[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+// Second UV set for the static lit geometry and where each object's share of the lightmap
+// lies. Every model that static lit renderables use is unwrapped once: triangles are grouped
+// into charts of connected triangles facing the same axis, each chart is projected along
+// that axis, and the charts of all the model's meshes are shelf packed with a gutter around
+// them into one [0, 1] square, stored as Vertex::LightmapCoords. Every renderable then gets
+// a rectangle of the atlas sized by its world space extent; the shader scales and offsets
+// the model's coordinates into it (scaleOffset). Splitting the charts apart duplicates the
+// vertices on their borders, so the meshes are uploaded again.
+class LightmapAtlas {
+public:
+    // texels of gutter around every chart, so filtering and dilation stay inside it
+    static const unsigned GUTTER_TEXELS = 2;
+
+    // call with the context current, after the scene's transforms are up to date; texel density
+    // is lowered until everything fits
+    void build(Scene& scene, float texelsPerUnit, unsigned size) {
+        const Scene::Renderables& renderables = scene.renderables;
+        m_Size = size;
+        m_ScaleOffset.assign(renderables.size(), glm::vec4(0.0f));
+        m_Renderables.clear();
+        // the smallest placement of every model decides its gutter in object units
+        std::map<Model*, float> minScale;
+        std::vector<float> scale(renderables.size(), 0.0f);
+        for (unsigned r = 0; r < renderables.size(); ++r) {
+            if (renderables.pass[r] != PASS_LIT || !renderables.model[r] ||
+                !scene.graph.isStatic(renderables.entity[r]))
+                continue;
+            const glm::mat4& world = scene.graph.world(renderables.entity[r]);
+            scale[r] = std::max(glm::length(glm::vec3(world[0])),
+                                std::max(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+            std::map<Model*, float>::iterator it = minScale.find(renderables.model[r]);
+            if (it == minScale.end())
+                minScale[renderables.model[r]] = scale[r];
+            else
+                it->second = std::min(it->second, scale[r]);
+            m_Renderables.push_back(r);
+        }
+
+        std::map<Model*, Unwrapped> unwrapped;
+        for (float density = texelsPerUnit;; density *= 0.8f) {
+            unwrapped.clear();
+            for (const std::pair<Model* const, float>& model : minScale)
+                unwrapped[model.first] = unwrap(*model.first, GUTTER_TEXELS / (density * model.second));
+            std::vector<glm::uvec2> rects(renderables.size(), glm::uvec2(0));
+            for (unsigned r : m_Renderables) {
+                glm::vec2 texels = unwrapped[renderables.model[r]].extent * scale[r] * density;
+                rects[r] = glm::uvec2(std::max(1.0f, std::ceil(texels.x)), std::max(1.0f, std::ceil(texels.y)));
+            }
+            if (pack(rects)) {
+                m_TexelsPerUnit = density;
+                break;
+            }
+            if (density < 1e-3f) {
+                LOG(std::cerr) << "The static geometry doesn't fit a " << size << " lightmap\n";
+                m_ScaleOffset.assign(renderables.size(), glm::vec4(0.0f));
+                m_Renderables.clear();
+                return;
+            }
+        }
+
+        for (std::pair<Model* const, Unwrapped>& model : unwrapped) {
+            std::vector<glm::vec3>& albedo = m_Albedo[model.first];
+            albedo.resize(model.first->meshes.size());
+            for (unsigned m = 0; m < model.first->meshes.size(); ++m) {
+                Mesh& mesh = model.first->meshes[m];
+                mesh.SetGeometry(std::move(model.second.vertices[m]), std::move(model.second.indices[m]));
+                albedo[m] = averageDiffuse(mesh);
+            }
+        }
+    }
+
+    unsigned size() const {
+        return m_Size;
+    }
+
+    float texelsPerUnit() const {
+        return m_TexelsPerUnit;
+    }
+
+    // the renderables that have a rectangle
+    const std::vector<unsigned>& renderables() const {
+        return m_Renderables;
+    }
+
+    // lightmap coordinates = LightmapCoords * xy + zw; zero for renderables outside the atlas
+    const glm::vec4& scaleOffset(unsigned renderable) const {
+        return m_ScaleOffset[renderable];
+    }
+
+    // mean colour of a mesh's diffuse texture, what light bouncing off it takes on
+    glm::vec3 albedo(const Model* model, unsigned mesh) const {
+        std::map<const Model*, std::vector<glm::vec3>>::const_iterator it = m_Albedo.find(model);
+        return it == m_Albedo.end() ? glm::vec3(0.5f) : it->second[mesh];
+    }
+
+    // changes whenever the rectangles do, a baked lightmap only fits the layout it was baked for
+    uint64_t layoutHash() const {
+        uint64_t hash = LightmapLights::fnv1a(&m_Size, sizeof(m_Size));
+        hash = LightmapLights::fnv1a(&m_TexelsPerUnit, sizeof(m_TexelsPerUnit), hash);
+        return m_ScaleOffset.empty() ? hash
+                                     : LightmapLights::fnv1a(m_ScaleOffset.data(), m_ScaleOffset.size() * sizeof(glm::vec4), hash);
+    }
+
+private:
+    struct Unwrapped {
+        std::vector<std::vector<Vertex>> vertices;
+        std::vector<std::vector<unsigned>> indices;
+        // object units the packed charts span before they are scaled to [0, 1]
+        glm::vec2 extent = glm::vec2(0.0f);
+    };
+
+    struct Chart {
+        unsigned mesh = 0;
+        int axis = 0;
+        glm::vec2 min = glm::vec2(FLT_MAX);
+        glm::vec2 max = glm::vec2(-FLT_MAX);
+        glm::vec2 position = glm::vec2(0.0f);
+    };
+
+    static glm::vec2 project(const glm::vec3& p, int axis) {
+        return glm::vec2(p[(axis + 1) % 3], p[(axis + 2) % 3]);
+    }
+
+    static unsigned findRoot(std::vector<unsigned>& parent, unsigned i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    static Unwrapped unwrap(const Model& model, float gutter) {
+        Unwrapped out;
+        std::vector<Chart> charts;
+        // chart of every triangle, per mesh
+        std::vector<std::vector<unsigned>> triangleCharts(model.meshes.size());
+        for (unsigned m = 0; m < model.meshes.size(); ++m) {
+            const Mesh& mesh = model.meshes[m];
+            const unsigned triangles = (unsigned) mesh.indices.size() / 3;
+            // the dominant axis and its sign, six directions
+            std::vector<unsigned char> direction(triangles);
+            for (unsigned t = 0; t < triangles; ++t) {
+                glm::vec3 a = mesh.vertices[mesh.indices[3 * t]].Position;
+                glm::vec3 n = glm::cross(mesh.vertices[mesh.indices[3 * t + 1]].Position - a,
+                                         mesh.vertices[mesh.indices[3 * t + 2]].Position - a);
+                glm::vec3 absolute = glm::abs(n);
+                int axis = absolute.x > absolute.y ? (absolute.x > absolute.z ? 0 : 2) : (absolute.y > absolute.z ? 1 : 2);
+                direction[t] = (unsigned char) (axis * 2 + (n[axis] < 0.0f ? 1 : 0));
+            }
+            // triangles sharing a vertex and a direction end up in one chart
+            std::vector<unsigned> parent(triangles);
+            for (unsigned t = 0; t < triangles; ++t)
+                parent[t] = t;
+            std::vector<int> firstTriangle(mesh.vertices.size() * 6, -1);
+            for (unsigned t = 0; t < triangles; ++t) {
+                for (unsigned corner = 0; corner < 3; ++corner) {
+                    int& first = firstTriangle[mesh.indices[3 * t + corner] * 6 + direction[t]];
+                    if (first < 0)
+                        first = (int) t;
+                    else
+                        parent[findRoot(parent, t)] = findRoot(parent, (unsigned) first);
+                }
+            }
+            std::unordered_map<unsigned, unsigned> rootCharts;
+            triangleCharts[m].resize(triangles);
+            for (unsigned t = 0; t < triangles; ++t) {
+                unsigned root = findRoot(parent, t);
+                std::unordered_map<unsigned, unsigned>::iterator it = rootCharts.find(root);
+                if (it == rootCharts.end()) {
+                    it = rootCharts.emplace(root, (unsigned) charts.size()).first;
+                    charts.emplace_back();
+                    charts.back().mesh = m;
+                    charts.back().axis = direction[t] / 2;
+                }
+                Chart& chart = charts[it->second];
+                for (unsigned corner = 0; corner < 3; ++corner) {
+                    glm::vec2 p = project(mesh.vertices[mesh.indices[3 * t + corner]].Position, chart.axis);
+                    chart.min = glm::min(chart.min, p);
+                    chart.max = glm::max(chart.max, p);
+                }
+                triangleCharts[m][t] = it->second;
+            }
+        }
+
+        // shelves of charts sorted by height, about as wide as the whole is tall
+        std::vector<unsigned> order(charts.size());
+        float area = 0.0f, widest = 0.0f;
+        for (unsigned c = 0; c < charts.size(); ++c) {
+            order[c] = c;
+            glm::vec2 padded = charts[c].max - charts[c].min + 2.0f * gutter;
+            area += padded.x * padded.y;
+            widest = std::max(widest, padded.x);
+        }
+        std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+            return charts[a].max.y - charts[a].min.y > charts[b].max.y - charts[b].min.y;
+        });
+        const float shelfWidth = std::max(widest, std::sqrt(area));
+        glm::vec2 cursor(0.0f);
+        float shelfHeight = 0.0f;
+        for (unsigned c : order) {
+            glm::vec2 padded = charts[c].max - charts[c].min + 2.0f * gutter;
+            if (cursor.x + padded.x > shelfWidth) {
+                cursor = glm::vec2(0.0f, cursor.y + shelfHeight);
+                shelfHeight = 0.0f;
+            }
+            charts[c].position = cursor + gutter;
+            cursor.x += padded.x;
+            shelfHeight = std::max(shelfHeight, padded.y);
+            out.extent.x = std::max(out.extent.x, cursor.x);
+        }
+        out.extent.y = cursor.y + shelfHeight;
+        const glm::vec2 invExtent = 1.0f / glm::max(out.extent, glm::vec2(1e-6f));
+
+        // a vertex gets one copy per chart it is in
+        out.vertices.resize(model.meshes.size());
+        out.indices.resize(model.meshes.size());
+        for (unsigned m = 0; m < model.meshes.size(); ++m) {
+            const Mesh& mesh = model.meshes[m];
+            std::unordered_map<uint64_t, unsigned> copies;
+            std::vector<Vertex>& vertices = out.vertices[m];
+            std::vector<unsigned>& indices = out.indices[m];
+            vertices.reserve(mesh.vertices.size());
+            indices.reserve(mesh.indices.size());
+            for (unsigned i = 0; i < mesh.indices.size(); ++i) {
+                unsigned vertex = mesh.indices[i];
+                unsigned c = triangleCharts[m][i / 3];
+                uint64_t key = (uint64_t) c << 32 | vertex;
+                std::unordered_map<uint64_t, unsigned>::iterator it = copies.find(key);
+                if (it == copies.end()) {
+                    const Chart& chart = charts[c];
+                    Vertex copy = mesh.vertices[vertex];
+                    copy.LightmapCoords = (project(copy.Position, chart.axis) - chart.min + chart.position) * invExtent;
+                    it = copies.emplace(key, (unsigned) vertices.size()).first;
+                    vertices.push_back(copy);
+                }
+                indices.push_back(it->second);
+            }
+        }
+        return out;
+    }
+
+    // shelf packs the non-empty rectangles into the atlas, tallest first
+    bool pack(const std::vector<glm::uvec2>& rects) {
+        std::vector<unsigned> order = m_Renderables;
+        std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) { return rects[a].y > rects[b].y; });
+        glm::uvec2 cursor(0);
+        unsigned shelfHeight = 0;
+        for (unsigned r : order) {
+            if (cursor.x + rects[r].x > m_Size) {
+                cursor = glm::uvec2(0, cursor.y + shelfHeight);
+                shelfHeight = 0;
+            }
+            if (rects[r].x > m_Size || cursor.y + rects[r].y > m_Size)
+                return false;
+            m_ScaleOffset[r] = glm::vec4(rects[r].x, rects[r].y, cursor.x, cursor.y) / (float) m_Size;
+            cursor.x += rects[r].x;
+            shelfHeight = std::max(shelfHeight, rects[r].y);
+        }
+        return true;
+    }
+
+    // the smallest mip level of the mesh's diffuse texture is its average colour
+    static glm::vec3 averageDiffuse(const Mesh& mesh) {
+        for (const Texture& texture : mesh.textures) {
+            if (texture.type != "texture_diffuse")
+                continue;
+            glState().bindTexture(0, GL_TEXTURE_2D, texture.id);
+            GLint width = 0, height = 0;
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+            int level = 0;
+            while ((std::max(width, height) >> level) > 1)
+                ++level;
+            glm::vec4 texel(0.5f);
+            glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, &texel);
+            return glm::vec3(texel);
+        }
+        return glm::vec3(0.5f);
+    }
+
+    unsigned m_Size = 0;
+    float m_TexelsPerUnit = 0.0f;
+    std::vector<unsigned> m_Renderables;
+    std::vector<glm::vec4> m_ScaleOffset;
+    std::map<const Model*, std::vector<glm::vec3>> m_Albedo;
+};
+
+// Baked irradiance, linear RGB per texel, with what it was baked from. The shader multiplies it
+// by the surface colour in place of the ambient and diffuse terms of the lights it holds.
+// On disk: the header, then the texels row by row.
+const uint32_t LIGHTMAP_FILE_MAGIC = 0x504d4c52; // "RLMP"
+const uint32_t LIGHTMAP_FILE_VERSION = 1;
+
+struct LightmapFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t samples;
+    uint32_t bounces;
+    uint32_t pointMask;
+    uint64_t layoutHash;
+    uint64_t pointsHash;
+    glm::vec3 direction;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    float bakeMs;
+};
+
+struct LightmapImage {
+    unsigned size = 0;
+    std::vector<glm::vec3> texels;
+    LightmapLights lights;
+    uint64_t layoutHash = 0;
+    // indirect samples per texel actually taken, the time budget can cut them short
+    unsigned samples = 0;
+    unsigned bounces = 0;
+    float bakeMs = 0.0f;
+
+    bool save(const std::string& path) const {
+        LightmapFileHeader header = LightmapFileHeader();
+        header.magic = LIGHTMAP_FILE_MAGIC;
+        header.version = LIGHTMAP_FILE_VERSION;
+        header.size = size;
+        header.samples = samples;
+        header.bounces = bounces;
+        header.pointMask = lights.pointMask;
+        header.layoutHash = layoutHash;
+        header.pointsHash = lights.pointsHash();
+        header.direction = lights.direction;
+        header.ambient = lights.ambient;
+        header.diffuse = lights.diffuse;
+        header.bakeMs = bakeMs;
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) texels.data(), texels.size() * sizeof(glm::vec3));
+        if (!out) {
+            LOG(std::cerr) << "Couldn't write the lightmap " << path << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    // fails on a lightmap baked for another layout or other static point lights; the moonlight
+    // may differ, the caller compares it
+    bool load(const std::string& path, uint64_t expectedLayout, const LightmapLights& expectedLights) {
+        std::ifstream in(path, std::ios::binary);
+        LightmapFileHeader header;
+        if (!in || !in.read((char*) &header, sizeof(header)))
+            return false;
+        if (header.magic != LIGHTMAP_FILE_MAGIC || header.version != LIGHTMAP_FILE_VERSION ||
+            header.layoutHash != expectedLayout || header.pointMask != expectedLights.pointMask ||
+            header.pointsHash != expectedLights.pointsHash())
+            return false;
+        texels.resize((size_t) header.size * header.size);
+        if (!in.read((char*) texels.data(), texels.size() * sizeof(glm::vec3)))
+            return false;
+        size = header.size;
+        layoutHash = header.layoutHash;
+        samples = header.samples;
+        bounces = header.bounces;
+        bakeMs = header.bakeMs;
+        lights = expectedLights;
+        lights.direction = header.direction;
+        lights.ambient = header.ambient;
+        lights.diffuse = header.diffuse;
+        return true;
+    }
+};
+
+// Offline path tracer for the lightmap. The static lit geometry goes into a TriangleBVH in
+// world space; every atlas texel a triangle covers gets a position and normal, then the
+// texels are lit on all the workers: direct light from the moonlight and the static point
+// lights with a shadow ray each, and indirect light from cosine weighted paths that pick up
+// the direct light where they land, tinted by the average colour of the surfaces they hit.
+// Indirect samples are taken in passes, so the time budget can end the bake early with a
+// noisier but complete result. Texels next to covered ones are filled in afterwards, so
+// bilinear filtering at chart borders doesn't pull in black. bake() takes seconds and is meant
+// to run as a background job; the scene and atlas it reads don't change after loading.
+class LightmapBaker {
+public:
+    static const unsigned SAMPLES_PER_PASS = 8;
+    static const unsigned DILATE_TEXELS = 2;
+
+    struct Stats {
+        unsigned triangles = 0;
+        unsigned texels = 0;
+        unsigned samples = 0;
+        uint64_t rays = 0;
+        float bakeMs = 0.0f;
+    };
+
+    explicit LightmapBaker(JobSystem& jobs) : m_Jobs(jobs) {}
+
+    const Stats& stats() const {
+        return m_Stats;
+    }
+
+    // makes a running bake and every later one return nullptr after the pass it is in, for
+    // shutting down without waiting for the time budget
+    void cancel() {
+        m_Cancelled = true;
+    }
+
+    std::shared_ptr<LightmapImage> bake(const Scene& scene, const LightmapAtlas& atlas, const LightmapLights& lights,
+                                        const LightmapSettings& settings) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        m_Stats = Stats();
+        m_Lights = &lights;
+        m_Bias = 0.1f / std::max(atlas.texelsPerUnit(), 1e-3f);
+        buildGeometry(scene, atlas);
+        rasterize(scene, atlas);
+
+        std::shared_ptr<LightmapImage> image = std::make_shared<LightmapImage>();
+        image->size = atlas.size();
+        image->texels.assign((size_t) image->size * image->size, glm::vec3(0.0f));
+        image->lights = lights;
+        image->layoutHash = atlas.layoutHash();
+        image->bounces = settings.bounces;
+
+        const unsigned count = (unsigned) m_Texels.size();
+        std::atomic<uint64_t> rays(0);
+        std::vector<glm::vec3> indirect(count, glm::vec3(0.0f));
+        m_Jobs.parallelFor(count, 256, [&](unsigned, unsigned begin, unsigned end) {
+            uint64_t chunkRays = 0;
+            for (unsigned i = begin; i < end; ++i)
+                image->texels[m_Texels[i].texel] = direct(m_Texels[i].position, m_Texels[i].normal, true, chunkRays);
+            rays += chunkRays;
+        });
+        // a local, std::min takes the member by reference and it has no definition outside the class
+        const unsigned samplesPerPass = SAMPLES_PER_PASS;
+        unsigned samples = 0;
+        while (settings.bounces > 0 && samples < settings.samples && !m_Cancelled) {
+            const unsigned passSamples = std::min(samplesPerPass, settings.samples - samples);
+            m_Jobs.parallelFor(count, 64, [&](unsigned, unsigned begin, unsigned end) {
+                uint64_t chunkRays = 0;
+                for (unsigned i = begin; i < end; ++i) {
+                    Random random(i * 9781u + samples * 6271u + 1u);
+                    for (unsigned s = 0; s < passSamples; ++s)
+                        indirect[i] += path(m_Texels[i].position, m_Texels[i].normal, settings.bounces, random, chunkRays);
+                }
+                rays += chunkRays;
+            });
+            samples += passSamples;
+            if (std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() > settings.timeBudgetSeconds)
+                break;
+        }
+        m_Lights = nullptr;
+        if (m_Cancelled)
+            return nullptr;
+        if (samples > 0) {
+            for (unsigned i = 0; i < count; ++i)
+                image->texels[m_Texels[i].texel] += indirect[i] / (float) samples;
+        }
+        dilate(*image);
+
+        image->samples = samples;
+        image->bakeMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        m_Stats.triangles = m_BVH.triangleCount();
+        m_Stats.texels = count;
+        m_Stats.samples = samples;
+        m_Stats.rays = rays;
+        m_Stats.bakeMs = image->bakeMs;
+        return image;
+    }
+
+private:
+    // a texel a triangle covers, in world space
+    struct Texel {
+        glm::vec3 position;
+        glm::vec3 normal;
+        unsigned texel;
+    };
+
+    // xorshift, one per texel and pass so the bake is the same on any thread count
+    struct Random {
+        explicit Random(uint32_t seed) : state(seed * 747796405u + 2891336453u) {
+            next();
+        }
+
+        uint32_t next() {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        float uniform() {
+            return (next() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        uint32_t state;
+    };
+
+    void buildGeometry(const Scene& scene, const LightmapAtlas& atlas) {
+        const Scene::Renderables& renderables = scene.renderables;
+        m_BVH.clear();
+        m_Normals.clear();
+        m_Albedo.clear();
+        for (unsigned r : atlas.renderables()) {
+            const Model& model = *renderables.model[r];
+            const glm::mat4& world = scene.graph.world(renderables.entity[r]);
+            for (unsigned m = renderables.firstMesh[r]; m < renderables.firstMesh[r] + renderables.meshCount[r]; ++m) {
+                const Mesh& mesh = model.meshes[m];
+                glm::vec3 albedo = atlas.albedo(&model, m);
+                for (unsigned i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                    glm::vec3 a = glm::vec3(world * glm::vec4(mesh.vertices[mesh.indices[i]].Position, 1.0f));
+                    glm::vec3 b = glm::vec3(world * glm::vec4(mesh.vertices[mesh.indices[i + 1]].Position, 1.0f));
+                    glm::vec3 c = glm::vec3(world * glm::vec4(mesh.vertices[mesh.indices[i + 2]].Position, 1.0f));
+                    glm::vec3 n = glm::cross(b - a, c - a);
+                    float length = glm::length(n);
+                    if (length <= 0.0f)
+                        continue;
+                    m_BVH.addTriangle(a, b, c);
+                    m_Normals.push_back(n / length);
+                    m_Albedo.push_back(albedo);
+                }
+            }
+        }
+        m_BVH.build();
+    }
+
+    // finds the texels every triangle covers; renderables own disjoint rectangles, so they
+    // are rasterized in parallel straight into the per texel arrays
+    void rasterize(const Scene& scene, const LightmapAtlas& atlas) {
+        const Scene::Renderables& renderables = scene.renderables;
+        const unsigned size = atlas.size();
+        std::vector<glm::vec3> positions((size_t) size * size);
+        std::vector<glm::vec3> normals((size_t) size * size);
+        // 2 inside a triangle, 1 close to one, 0 empty
+        std::vector<unsigned char> coverage((size_t) size * size, 0);
+        const std::vector<unsigned>& atlasRenderables = atlas.renderables();
+        m_Jobs.parallelFor((unsigned) atlasRenderables.size(), 1, [&](unsigned, unsigned begin, unsigned end) {
+            for (unsigned k = begin; k < end; ++k) {
+                unsigned r = atlasRenderables[k];
+                const Model& model = *renderables.model[r];
+                const glm::mat4& world = scene.graph.world(renderables.entity[r]);
+                const glm::mat3& normalMatrix = scene.graph.normalMatrix(renderables.entity[r]);
+                const glm::vec4 scaleOffset = atlas.scaleOffset(r) * (float) size;
+                const glm::ivec2 rectMin = glm::ivec2(glm::round(glm::vec2(scaleOffset.z, scaleOffset.w)));
+                const glm::ivec2 rectMax = glm::ivec2(glm::round(glm::vec2(scaleOffset.z + scaleOffset.x,
+                                                                           scaleOffset.w + scaleOffset.y))) - 1;
+                for (unsigned m = renderables.firstMesh[r]; m < renderables.firstMesh[r] + renderables.meshCount[r]; ++m) {
+                    const Mesh& mesh = model.meshes[m];
+                    for (unsigned i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                        const Vertex* v[3] = {&mesh.vertices[mesh.indices[i]], &mesh.vertices[mesh.indices[i + 1]],
+                                              &mesh.vertices[mesh.indices[i + 2]]};
+                        glm::vec2 p[3];
+                        for (int j = 0; j < 3; ++j)
+                            p[j] = v[j]->LightmapCoords * glm::vec2(scaleOffset.x, scaleOffset.y) +
+                                   glm::vec2(scaleOffset.z, scaleOffset.w);
+                        float area = cross(p[1] - p[0], p[2] - p[0]);
+                        if (std::abs(area) < 1e-12f)
+                            continue;
+                        glm::vec3 a = glm::vec3(world * glm::vec4(v[0]->Position, 1.0f));
+                        glm::vec3 b = glm::vec3(world * glm::vec4(v[1]->Position, 1.0f));
+                        glm::vec3 c = glm::vec3(world * glm::vec4(v[2]->Position, 1.0f));
+                        glm::vec3 faceNormal = glm::normalize(glm::cross(b - a, c - a));
+                        glm::ivec2 lo = glm::max(rectMin, glm::ivec2(glm::floor(glm::min(p[0], glm::min(p[1], p[2])))) - 1);
+                        glm::ivec2 hi = glm::min(rectMax, glm::ivec2(glm::floor(glm::max(p[0], glm::max(p[1], p[2])))) + 1);
+                        for (int y = lo.y; y <= hi.y; ++y) {
+                            for (int x = lo.x; x <= hi.x; ++x) {
+                                glm::vec2 center(x + 0.5f, y + 0.5f);
+                                glm::vec3 weights;
+                                unsigned char cover = covers(p, area, center, weights);
+                                size_t texel = (size_t) y * size + x;
+                                if (cover <= coverage[texel])
+                                    continue;
+                                coverage[texel] = cover;
+                                positions[texel] = weights.x * a + weights.y * b + weights.z * c;
+                                glm::vec3 n = normalMatrix * (weights.x * v[0]->Normal + weights.y * v[1]->Normal +
+                                                              weights.z * v[2]->Normal);
+                                float length = glm::length(n);
+                                normals[texel] = length > 0.0f ? n / length : faceNormal;
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        m_Texels.clear();
+        m_Coverage.swap(coverage);
+        for (size_t texel = 0; texel < m_Coverage.size(); ++texel) {
+            if (!m_Coverage[texel])
+                continue;
+            // off the surface against self intersection
+            Texel t;
+            t.normal = normals[texel];
+            t.position = positions[texel] + t.normal * m_Bias;
+            t.texel = (unsigned) texel;
+            m_Texels.push_back(t);
+        }
+    }
+
+    static float cross(const glm::vec2& a, const glm::vec2& b) {
+        return a.x * b.y - a.y * b.x;
+    }
+
+    // 2 when the texel center is inside the triangle, 1 when it is close enough to the edge that
+    // filtering would read the texel; weights are the barycentrics of the closest point
+    static unsigned char covers(const glm::vec2 p[3], float area, const glm::vec2& center, glm::vec3& weights) {
+        weights = glm::vec3(cross(p[1] - center, p[2] - center), cross(p[2] - center, p[0] - center),
+                            cross(p[0] - center, p[1] - center)) / area;
+        if (weights.x >= 0.0f && weights.y >= 0.0f && weights.z >= 0.0f)
+            return 2;
+        const float REACH = 0.75f;
+        float best = REACH * REACH;
+        bool close = false;
+        for (int e = 0; e < 3; ++e) {
+            glm::vec2 a = p[e], b = p[(e + 1) % 3];
+            glm::vec2 ab = b - a;
+            float t = glm::clamp(glm::dot(center - a, ab) / std::max(glm::dot(ab, ab), 1e-12f), 0.0f, 1.0f);
+            glm::vec2 d = a + ab * t - center;
+            float distance2 = glm::dot(d, d);
+            if (distance2 < best) {
+                best = distance2;
+                close = true;
+                weights = glm::vec3(0.0f);
+                weights[e] = 1.0f - t;
+                weights[(e + 1) % 3] = t;
+            }
+        }
+        return close ? 1 : 0;
+    }
+
+    // what the shader's ambient and diffuse terms of the baked lights add up to, without the
+    // surface colour; ambient only counts where the light is seen, not for bounces
+    glm::vec3 direct(const glm::vec3& position, const glm::vec3& normal, bool ambient, uint64_t& rays) const {
+        const LightmapLights& lights = *m_Lights;
+        glm::vec3 irradiance = ambient ? lights.ambient : glm::vec3(0.0f);
+        glm::vec3 toMoon = glm::normalize(-lights.direction);
+        float moonCos = glm::dot(normal, toMoon);
+        if (moonCos > 0.0f) {
+            ++rays;
+            if (!m_BVH.occluded(position, toMoon, FLT_MAX))
+                irradiance += lights.diffuse * moonCos;
+        }
+        for (const PointLight& light : lights.points) {
+            glm::vec3 toLight = light.position - position;
+            float distance = glm::length(toLight);
+            // the shader only sees a light within the range its cluster was given
+            if (distance <= 0.0f || distance >= lightRange(light))
+                continue;
+            float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * distance * distance);
+            if (ambient)
+                irradiance += light.ambient * attenuation;
+            toLight /= distance;
+            float lightCos = glm::dot(normal, toLight);
+            if (lightCos > 0.0f) {
+                ++rays;
+                if (!m_BVH.occluded(position, toLight, distance))
+                    irradiance += light.diffuse * lightCos * attenuation;
+            }
+        }
+        return irradiance;
+    }
+
+    // one cosine weighted path; irradiance estimates need no weights beyond the albedo
+    glm::vec3 path(glm::vec3 position, glm::vec3 normal, unsigned bounces, Random& random, uint64_t& rays) const {
+        glm::vec3 irradiance(0.0f), throughput(1.0f);
+        for (unsigned bounce = 0; bounce < bounces; ++bounce) {
+            glm::vec3 direction = cosineSample(normal, random.uniform(), random.uniform());
+            RayHit hit;
+            ++rays;
+            // the night sky adds nothing
+            if (!m_BVH.intersect(position, direction, FLT_MAX, hit))
+                break;
+            normal = m_Normals[hit.triangle];
+            if (glm::dot(normal, direction) > 0.0f)
+                normal = -normal;
+            position += direction * hit.t + normal * m_Bias;
+            throughput *= m_Albedo[hit.triangle];
+            irradiance += throughput * direct(position, normal, false, rays);
+        }
+        return irradiance;
+    }
+
+    static glm::vec3 cosineSample(const glm::vec3& n, float u1, float u2) {
+        // orthonormal basis around n (Duff et al.)
+        float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + n.z);
+        float b = n.x * n.y * a;
+        glm::vec3 tangent(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+        glm::vec3 bitangent(b, sign + n.y * n.y * a, -n.y);
+        float radius = std::sqrt(u1);
+        float phi = 6.28318531f * u2;
+        return tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) +
+               n * std::sqrt(std::max(0.0f, 1.0f - u1));
+    }
+
+    void dilate(LightmapImage& image) {
+        const int size = (int) image.size;
+        std::vector<unsigned char> filled = m_Coverage;
+        std::vector<unsigned char> next;
+        for (unsigned pass = 0; pass < DILATE_TEXELS; ++pass) {
+            next = filled;
+            for (int y = 0; y < size; ++y) {
+                for (int x = 0; x < size; ++x) {
+                    if (filled[(size_t) y * size + x])
+                        continue;
+                    glm::vec3 sum(0.0f);
+                    int count = 0;
+                    for (int dy = -1; dy <= 1; ++dy) {
+                        for (int dx = -1; dx <= 1; ++dx) {
+                            int nx = x + dx, ny = y + dy;
+                            if (nx < 0 || ny < 0 || nx >= size || ny >= size || !filled[(size_t) ny * size + nx])
+                                continue;
+                            sum += image.texels[(size_t) ny * size + nx];
+                            ++count;
+                        }
+                    }
+                    if (count) {
+                        image.texels[(size_t) y * size + x] = sum / (float) count;
+                        next[(size_t) y * size + x] = 1;
+                    }
+                }
+            }
+            filled.swap(next);
+        }
+    }
+
+    JobSystem& m_Jobs;
+    TriangleBVH m_BVH;
+    // per BVH triangle
+    std::vector<glm::vec3> m_Normals;
+    std::vector<glm::vec3> m_Albedo;
+    std::vector<Texel> m_Texels;
+    std::vector<unsigned char> m_Coverage;
+    const LightmapLights* m_Lights = nullptr;
+    float m_Bias = 0.01f;
+    Stats m_Stats;
+    std::atomic<bool> m_Cancelled{false};
+};
+
+// the lightmap on the GPU, owned by the render thread
+class LightmapTexture {
+public:
+    LightmapTexture() = default;
+    LightmapTexture(const LightmapTexture&) = delete;
+    LightmapTexture& operator=(const LightmapTexture&) = delete;
+
+    ~LightmapTexture() {
+        if (m_Texture)
+            glDeleteTextures(1, &m_Texture);
+    }
+
+    void upload(const LightmapImage& image) {
+        if (!m_Texture)
+            glGenTextures(1, &m_Texture);
+        glState().bindTexture(0, GL_TEXTURE_2D, m_Texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, image.size, image.size, 0, GL_RGB, GL_FLOAT, image.texels.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    void bind(unsigned unit) const {
+        glState().bindTexture(unit, GL_TEXTURE_2D, m_Texture);
+    }
+
+private:
+    GLuint m_Texture = 0;
+};
+
+}
+#endif //PROJECT_BASE_LIGHTMAP_H
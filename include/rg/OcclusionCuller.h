@@ -0,0 +1,148 @@
+#ifndef PROJECT_BASE_OCCLUSIONCULLER_H
+#define PROJECT_BASE_OCCLUSIONCULLER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/Bounds.h>
+#include <rg/GLStateCache.h>
+
+#include <vector>
+
+namespace rg {
+
+// Hardware occlusion culling with GL_ANY_SAMPLES_PASSED queries on bounding boxes.
+// Every frame the boxes of the frustum-visible objects are rasterized against the depth
+// buffer after the scene was drawn; the answers are read at the start of the next frame
+// without waiting, so an object that comes into view shows up one frame late at worst.
+// Answers that haven't arrived yet count as visible.
+class OcclusionCuller {
+public:
+    explicit OcclusionCuller(unsigned objectCount)
+            : m_Occluded(objectCount, false) {
+        for (unsigned slot = 0; slot < 2; ++slot) {
+            m_Queries[slot].resize(objectCount);
+            m_Pending[slot].assign(objectCount, false);
+            glGenQueries(objectCount, m_Queries[slot].data());
+        }
+        setupBox();
+    }
+
+    ~OcclusionCuller() {
+        for (unsigned slot = 0; slot < 2; ++slot)
+            glDeleteQueries(m_Queries[slot].size(), m_Queries[slot].data());
+        glDeleteVertexArrays(1, &m_VAO);
+        glDeleteBuffers(1, &m_VBO);
+        glDeleteBuffers(1, &m_EBO);
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // picks up the answers to last frame's queries; after a camera jump they describe a
+    // different view, so everything is treated as visible and tested again. Objects that
+    // weren't queried, e.g. because they were outside the frustum, have no answer and count
+    // as visible, or one occluded when it left the view would stay hidden a frame on return.
+    void beginFrame(bool cameraJumped) {
+        unsigned previous = (m_Frame & 1u) ^ 1u;
+        for (unsigned id = 0; id < m_Occluded.size(); ++id) {
+            if (!m_Pending[previous][id]) {
+                m_Occluded[id] = false;
+                continue;
+            }
+            m_Pending[previous][id] = false;
+            GLint available = 0;
+            glGetQueryObjectiv(m_Queries[previous][id], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) {
+                m_Occluded[id] = false;
+                continue;
+            }
+            GLuint anySamples = 1;
+            glGetQueryObjectuiv(m_Queries[previous][id], GL_QUERY_RESULT, &anySamples);
+            m_Occluded[id] = anySamples == 0;
+        }
+        if (cameraJumped)
+            m_Occluded.assign(m_Occluded.size(), false);
+    }
+
+    bool occluded(unsigned id) const {
+        return m_Occluded[id];
+    }
+
+    // draw state for the proxy boxes: depth test only, no colour or depth writes
+    void beginQueries(Shader& shader, const glm::mat4& projectionView) {
+        GLStateCache& state = glState();
+        shader.use();
+        shader.setMat4("projectionView", projectionView);
+        state.colorMask(false);
+        state.depthMask(false);
+        state.disable(GL_CULL_FACE);
+        state.bindVertexArray(m_VAO);
+    }
+
+    void issue(Shader& shader, unsigned id, const AABB& worldBox, const glm::vec3& eye) {
+        // the near plane would clip the box away when the camera is inside it
+        if (worldBox.inflated(0.2f).contains(eye)) {
+            m_Occluded[id] = false;
+            return;
+        }
+        unsigned slot = m_Frame & 1u;
+        shader.setVec3("boxMin", worldBox.min);
+        shader.setVec3("boxMax", worldBox.max);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, m_Queries[slot][id]);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        m_Pending[slot][id] = true;
+    }
+
+    void endQueries() {
+        glState().colorMask(true);
+        glState().depthMask(true);
+        ++m_Frame;
+    }
+
+private:
+    void setupBox() {
+        float corners[] = {
+                0.0f, 0.0f, 0.0f,
+                1.0f, 0.0f, 0.0f,
+                1.0f, 1.0f, 0.0f,
+                0.0f, 1.0f, 0.0f,
+                0.0f, 0.0f, 1.0f,
+                1.0f, 0.0f, 1.0f,
+                1.0f, 1.0f, 1.0f,
+                0.0f, 1.0f, 1.0f
+        };
+        unsigned int indices[] = {
+                0, 1, 2, 2, 3, 0,
+                4, 6, 5, 6, 4, 7,
+                0, 3, 7, 7, 4, 0,
+                1, 5, 6, 6, 2, 1,
+                0, 4, 5, 5, 1, 0,
+                3, 2, 6, 6, 7, 3
+        };
+        glGenVertexArrays(1, &m_VAO);
+        glGenBuffers(1, &m_VBO);
+        glGenBuffers(1, &m_EBO);
+        glState().bindVertexArray(m_VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glState().bindVertexArray(0);
+    }
+
+    std::vector<GLuint> m_Queries[2];
+    std::vector<bool> m_Pending[2];
+    std::vector<bool> m_Occluded;
+    unsigned m_Frame = 0;
+    unsigned m_VAO = 0;
+    unsigned m_VBO = 0;
+    unsigned m_EBO = 0;
+};
+
+}
+#endif //PROJECT_BASE_OCCLUSIONCULLER_H
@@ -0,0 +1,112 @@
+#ifndef PROJECT_BASE_POSTCHAIN_H
+#define PROJECT_BASE_POSTCHAIN_H
+
+#include <learnopengl/shader.h>
+#include <rg/Error.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// the stages of the post-processing stack, functions of the same names in the fragment shader
+enum PostStage {
+    // 3x3 neighbourhood, the only stage that reads more than the pixel's own texel
+    POST_EDGE_DETECTION,
+    POST_GRAYSCALE,
+    // adds the bloom texture, in HDR before tone mapping
+    POST_BLOOM,
+    // exposure and gamma
+    POST_TONE_MAP,
+    POST_STAGE_COUNT
+};
+
+// One fused program per chain of post-processing stages instead of a full screen pass per
+// stage, so the chain reads the scene and writes the window once whatever its length. The
+// stages are GLSL functions of the fragment shader and the chain is handed to it as two
+// macros: the stages before the neighbourhood stage run on each of its taps, the ones after
+// it once on its result. Without a neighbourhood stage every stage runs once on the pixel.
+// A chain has at most one neighbourhood stage; two would need the first one's result of the
+// neighbours, that is a pass in between. Programs are compiled the first time their chain is
+// asked for and kept, like rg::ShaderPermutations.
+class PostChain {
+public:
+    PostChain(std::string vertexPath, std::string fragmentPath, std::function<void(Shader&)> setup = nullptr)
+            : m_VertexPath(std::move(vertexPath)), m_FragmentPath(std::move(fragmentPath)),
+              m_Setup(std::move(setup)) {}
+
+    PostChain(const PostChain&) = delete;
+    PostChain& operator=(const PostChain&) = delete;
+
+    static bool isNeighbourhood(PostStage stage) {
+        return stage == POST_EDGE_DETECTION;
+    }
+
+    Shader& get(const std::vector<PostStage>& stages) {
+        unsigned chain = key(stages);
+        std::map<unsigned, std::unique_ptr<Shader>>::iterator found = m_Programs.find(chain);
+        if (found != m_Programs.end())
+            return *found->second;
+        std::unique_ptr<Shader>& program = m_Programs[chain];
+        program.reset(new Shader(m_VertexPath.c_str(), m_FragmentPath.c_str(), nullptr, defines(stages)));
+        if (m_Setup)
+            m_Setup(*program);
+        return *program;
+    }
+
+    // the #define block of a chain: NEIGHBOURHOOD with the stage it names, and PER_TAP and
+    // PER_PIXEL as the stages in order, innermost first
+    static std::string defines(const std::vector<PostStage>& stages) {
+        std::string perTap = "color", perPixel = "color";
+        std::string block;
+        bool neighbourhood = false;
+        for (PostStage stage : stages) {
+            if (isNeighbourhood(stage)) {
+                ASSERT(!neighbourhood, "A post chain fuses one neighbourhood stage at most");
+                neighbourhood = true;
+                block += std::string("#define NEIGHBOURHOOD ") + name(stage) + "\n";
+                continue;
+            }
+            std::string& applied = neighbourhood ? perPixel : perTap;
+            applied = std::string(name(stage)) + "(" + applied + ", uv)";
+        }
+        block += "#define PER_TAP(color, uv) " + perTap + "\n";
+        block += "#define PER_PIXEL(color, uv) " + perPixel + "\n";
+        return block;
+    }
+
+    static const char* name(PostStage stage) {
+        switch (stage) {
+            case POST_EDGE_DETECTION: return "edgeDetection";
+            case POST_GRAYSCALE: return "grayscale";
+            case POST_BLOOM: return "addBloom";
+            case POST_TONE_MAP: return "toneMap";
+            default: return "";
+        }
+    }
+
+    unsigned compiledCount() const {
+        return (unsigned) m_Programs.size();
+    }
+
+private:
+    // 3 bits per stage, 0 ends the chain
+    static unsigned key(const std::vector<PostStage>& stages) {
+        ASSERT(stages.size() <= 10, "Post chains are keyed on 30 bits");
+        unsigned chain = 0;
+        for (unsigned i = 0; i < stages.size(); ++i)
+            chain |= (unsigned) (stages[i] + 1) << (3 * i);
+        return chain;
+    }
+
+    std::string m_VertexPath;
+    std::string m_FragmentPath;
+    std::function<void(Shader&)> m_Setup;
+    std::map<unsigned, std::unique_ptr<Shader>> m_Programs;
+};
+
+}
+#endif //PROJECT_BASE_POSTCHAIN_H
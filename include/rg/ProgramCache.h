@@ -0,0 +1,219 @@
+#ifndef PROJECT_BASE_PROGRAMCACHE_H
+#define PROJECT_BASE_PROGRAMCACHE_H
+
+#include <glad/glad.h>
+
+#include <rg/Error.h>
+#include <rg/GLExtensions.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// Cached program layout: the header, the driver string, then the binary the driver returned.
+const uint32_t PROGRAM_CACHE_MAGIC = 0x42505252; // "RRPB"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    // FNV-1a of the complete sources, defines included, and their length
+    uint64_t sourceHash;
+    uint64_t sourceBytes;
+    uint32_t driverBytes;
+    uint32_t binaryFormat;
+    uint32_t binaryBytes;
+    // what compiling and linking from source took when the entry was written
+    float compileMs;
+};
+
+// Linked programs kept on disk with glGetProgramBinary, one file per set of sources, so a
+// launch with unchanged shaders skips compiling and linking. An entry only loads on the
+// driver that wrote it: vendor, renderer and version strings are stored with the binary and
+// compared first, and a binary the driver still rejects is deleted and rebuilt from source.
+// Program binaries are core in GL 4.1 and ARB_get_program_binary elsewhere; glad only covers
+// 3.3, so init() fetches the entry points itself and without them the cache stays disabled.
+class ProgramCache {
+public:
+    struct Stats {
+        unsigned hits = 0;
+        unsigned misses = 0;
+        // entries from another driver or that the driver refused
+        unsigned rejected = 0;
+        float loadMs = 0.0f;
+        float compileMs = 0.0f;
+        // compile time the hits cost when their entries were written, minus loading them
+        float savedMs = 0.0f;
+    };
+
+    // call with the context current; returns whether binaries are supported
+    bool init(GLADloadproc load, const std::string& directory) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Directory = directory;
+        m_Enabled = false;
+        if (!hasGL(4, 1, "GL_ARB_get_program_binary"))
+            return false;
+        m_ProgramParameteri = (ProgramParameteriProc) load("glProgramParameteri");
+        m_GetProgramBinary = (GetProgramBinaryProc) load("glGetProgramBinary");
+        m_ProgramBinary = (ProgramBinaryProc) load("glProgramBinary");
+        GLint formats = 0;
+        glGetIntegerv(NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (!m_ProgramParameteri || !m_GetProgramBinary || !m_ProgramBinary || formats <= 0)
+            return false;
+        mkdir(m_Directory.c_str(), 0755);
+        std::ostringstream driver;
+        driver << glGetString(GL_VENDOR) << '\n' << glGetString(GL_RENDERER) << '\n'
+               << glGetString(GL_VERSION) << '\n' << glGetString(GL_SHADING_LANGUAGE_VERSION);
+        m_Driver = driver.str();
+        m_Enabled = true;
+        return true;
+    }
+
+    bool enabled() const {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Enabled;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Stats;
+    }
+
+    // a linked program for these sources, or 0 when there is no usable entry
+    GLuint load(const std::string& sources) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!m_Enabled)
+            return 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint64_t hash = fnv1a(sources);
+        std::string path = entryPath(hash);
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            ++m_Stats.misses;
+            return 0;
+        }
+        ProgramCacheHeader header;
+        std::string driver;
+        std::vector<char> binary;
+        bool valid = in.read((char*) &header, sizeof(header)) &&
+                     header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION &&
+                     header.sourceHash == hash && header.sourceBytes == sources.size() &&
+                     header.driverBytes == m_Driver.size();
+        if (valid) {
+            driver.resize(header.driverBytes);
+            binary.resize(header.binaryBytes);
+            valid = in.read(&driver[0], driver.size()) && driver == m_Driver &&
+                    in.read(binary.data(), binary.size());
+        }
+        in.close();
+        GLuint program = 0;
+        if (valid) {
+            program = glCreateProgram();
+            m_ProgramBinary(program, header.binaryFormat, binary.data(), (GLsizei) binary.size());
+            GLint linked = 0;
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+            if (!linked) {
+                glDeleteProgram(program);
+                program = 0;
+            }
+        }
+        if (!program) {
+            // stale or foreign; the program is rebuilt from source and stored again
+            std::remove(path.c_str());
+            ++m_Stats.rejected;
+            ++m_Stats.misses;
+            return 0;
+        }
+        float loadMs = milliseconds(start);
+        ++m_Stats.hits;
+        m_Stats.loadMs += loadMs;
+        m_Stats.savedMs += header.compileMs - loadMs;
+        return program;
+    }
+
+    // call on a new program before linking it, so the driver keeps its binary retrievable
+    void prepare(GLuint program) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Enabled)
+            m_ProgramParameteri(program, PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // writes the entry of a program just linked from these sources
+    void store(const std::string& sources, GLuint program, float compileMs) {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stats.compileMs += compileMs;
+        GLint linked = 0, length = 0;
+        if (!m_Enabled)
+            return;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, PROGRAM_BINARY_LENGTH, &length);
+        if (!linked || length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        m_GetProgramBinary(program, length, &length, &format, binary.data());
+
+        ProgramCacheHeader header = ProgramCacheHeader();
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.sourceHash = fnv1a(sources);
+        header.sourceBytes = sources.size();
+        header.driverBytes = (uint32_t) m_Driver.size();
+        header.binaryFormat = format;
+        header.binaryBytes = (uint32_t) length;
+        header.compileMs = compileMs;
+        std::ofstream out(entryPath(header.sourceHash), std::ios::binary | std::ios::trunc);
+        out.write((const char*) &header, sizeof(header));
+        out.write(m_Driver.data(), m_Driver.size());
+        out.write(binary.data(), length);
+        if (!out)
+            LOG(std::cerr) << "Couldn't write the program cache entry " << entryPath(header.sourceHash) << '\n';
+    }
+
+    static float milliseconds(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+
+private:
+    static uint64_t fnv1a(const std::string& data) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : data) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string entryPath(uint64_t hash) const {
+        std::ostringstream path;
+        path << m_Directory << '/' << std::hex << hash << ".bin";
+        return path.str();
+    }
+
+    mutable std::mutex m_Mutex;
+    std::string m_Directory;
+    std::string m_Driver;
+    bool m_Enabled = false;
+    Stats m_Stats;
+    ProgramParameteriProc m_ProgramParameteri = nullptr;
+    GetProgramBinaryProc m_GetProgramBinary = nullptr;
+    ProgramBinaryProc m_ProgramBinary = nullptr;
+};
+
+// the cache every Shader goes through; disabled until init() is called
+inline ProgramCache& programCache() {
+    static ProgramCache cache;
+    return cache;
+}
+
+}
+#endif //PROJECT_BASE_PROGRAMCACHE_H
@@ -0,0 +1,471 @@
+#ifndef PROJECT_BASE_RENDERGRAPH_H
+#define PROJECT_BASE_RENDERGRAPH_H
+
+#include <glad/glad.h>
+
+#include <rg/Error.h>
+#include <rg/GLStateCache.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+struct RenderTargetDesc {
+    int width = 0;
+    int height = 0;
+    GLenum format = GL_RGBA16F;
+    // GL_LINEAR or GL_NEAREST, for both minification and magnification
+    GLenum filter = GL_LINEAR;
+
+    RenderTargetDesc() = default;
+    RenderTargetDesc(int width, int height, GLenum format, GLenum filter)
+            : width(width), height(height), format(format), filter(filter) {}
+
+    bool operator==(const RenderTargetDesc& other) const {
+        return width == other.width && height == other.height && format == other.format && filter == other.filter;
+    }
+
+    bool isDepth() const {
+        return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH_COMPONENT24 || format == GL_DEPTH_COMPONENT32F;
+    }
+
+    unsigned bytes() const {
+        unsigned texel = 4;
+        switch (format) {
+            case GL_RGBA16F: texel = 8; break;
+            case GL_RGB16F: texel = 6; break;
+            case GL_RGBA32F: texel = 16; break;
+        }
+        return (unsigned) (width * height) * texel;
+    }
+};
+
+// One version of a graph resource. Writing a resource gives a new version, so which pass
+// produced what a pass reads is always known.
+struct RenderGraphHandle {
+    int version = -1;
+
+    bool valid() const {
+        return version >= 0;
+    }
+};
+
+// Frame graph for the screen-sized passes. Every frame the passes are declared again, each
+// with what it samples and what it renders to, and execute() then:
+// - culls the passes whose outputs nothing alive reads, walking back from the ones with side
+//   effects (the screen pass, the occlusion queries);
+// - drops the outputs alive passes write but nothing reads, a colour attachment nobody
+//   samples gets GL_NONE as its draw buffer and no texture at all;
+// - gives every transient target a texture from a pool for the span of passes that use it, so
+//   targets of the same description whose spans don't overlap share one texture. GL 3.3 has
+//   no way to place textures of different formats in the same memory, so sharing is limited
+//   to matching descriptions;
+// - runs the alive passes in declaration order, with a framebuffer of their attachments
+//   bound and the viewport set to the render area. Passes without graph attachments bind their own.
+// Pool textures a frame didn't use are freed at its end, and so are framebuffers made of them.
+class RenderGraph {
+public:
+    struct Stats {
+        unsigned passes = 0;
+        unsigned culledPasses = 0;
+        // names of the culled passes, comma separated
+        std::string culled;
+        // transient targets the alive passes used, and the textures they got
+        unsigned targets = 0;
+        unsigned textures = 0;
+        unsigned targetBytes = 0;
+        unsigned textureBytes = 0;
+    };
+
+    // what a pass declares in its setup
+    class Builder {
+    public:
+        // sampled by the pass
+        RenderGraphHandle read(RenderGraphHandle handle) {
+            m_Graph.m_Passes[m_Pass].reads.push_back(handle.version);
+            return handle;
+        }
+
+        // rendered to from scratch: the next colour attachment for a transient target, just
+        // marked as produced for an imported texture the pass fills itself
+        RenderGraphHandle write(RenderGraphHandle handle) {
+            return output(handle, false, false);
+        }
+
+        // rendered on top of what an earlier pass left there
+        RenderGraphHandle modify(RenderGraphHandle handle) {
+            return output(handle, true, false);
+        }
+
+        // the depth attachment, kept whenever the pass runs since it does the depth test
+        RenderGraphHandle writeDepth(RenderGraphHandle handle) {
+            return output(handle, false, true);
+        }
+
+        RenderGraphHandle modifyDepth(RenderGraphHandle handle) {
+            return output(handle, true, true);
+        }
+
+        // never culled, it does something outside the graph
+        void sideEffect() {
+            m_Graph.m_Passes[m_Pass].sideEffect = true;
+        }
+
+    private:
+        friend class RenderGraph;
+
+        Builder(RenderGraph& graph, unsigned pass) : m_Graph(graph), m_Pass(pass) {}
+
+        RenderGraphHandle output(RenderGraphHandle handle, bool keepContents, bool depth) {
+            ASSERT(handle.valid(), "Writing an invalid render graph handle");
+            Pass& pass = m_Graph.m_Passes[m_Pass];
+            int resource = m_Graph.m_Versions[handle.version].resource;
+            Output out;
+            out.in = keepContents ? handle.version : -1;
+            out.out = (int) m_Graph.m_Versions.size();
+            out.required = depth;
+            if (m_Graph.m_Resources[resource].imported)
+                out.slot = NO_SLOT;
+            else if (depth)
+                out.slot = DEPTH_SLOT;
+            else
+                out.slot = pass.colorCount++;
+            pass.outputs.push_back(out);
+            Version version;
+            version.resource = resource;
+            m_Graph.m_Versions.push_back(version);
+            return RenderGraphHandle{ out.out };
+        }
+
+        RenderGraph& m_Graph;
+        unsigned m_Pass;
+    };
+
+    // what a pass can look up while it runs
+    class Resources {
+    public:
+        GLuint texture(RenderGraphHandle handle) const {
+            const Resource& resource = m_Graph.m_Resources[m_Graph.m_Versions[handle.version].resource];
+            return resource.imported ? resource.texture : m_Graph.m_Pool[resource.physical].texture;
+        }
+
+    private:
+        friend class RenderGraph;
+
+        explicit Resources(const RenderGraph& graph) : m_Graph(graph) {}
+
+        const RenderGraph& m_Graph;
+    };
+
+    RenderGraph() = default;
+
+    ~RenderGraph() {
+        for (const std::pair<const std::vector<GLuint>, GLuint>& fbo : m_Framebuffers)
+            glState().deleteFramebuffers(1, &fbo.second);
+        for (const Physical& physical : m_Pool)
+            glState().deleteTextures(1, &physical.texture);
+    }
+
+    RenderGraph(const RenderGraph&) = delete;
+    RenderGraph& operator=(const RenderGraph&) = delete;
+
+    // a target that lives from its first writer to its last reader this frame
+    RenderGraphHandle create(const char* name, const RenderTargetDesc& desc) {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        return addResource(resource);
+    }
+
+    // a texture owned outside the graph
+    RenderGraphHandle import(const char* name, GLuint texture) {
+        Resource resource;
+        resource.name = name;
+        resource.imported = true;
+        resource.texture = texture;
+        return addResource(resource);
+    }
+
+    // setup runs right away and declares what the pass uses; execute runs in execute() if the
+    // pass survives culling
+    void addPass(const char* name, const std::function<void(Builder&)>& setup,
+                 std::function<void(const Resources&)> execute) {
+        Pass pass;
+        pass.name = name;
+        pass.execute = std::move(execute);
+        m_Passes.push_back(std::move(pass));
+        Builder builder(*this, (unsigned) m_Passes.size() - 1);
+        setup(builder);
+    }
+
+    // culls, assigns textures, runs the passes and forgets them, ready for the next frame
+    void execute() {
+        cull();
+        allocate();
+        Resources resources(*this);
+        for (Pass& pass : m_Passes) {
+            if (!pass.alive)
+                continue;
+            bindAttachments(pass);
+            pass.execute(resources);
+        }
+        releaseUnused();
+        m_Passes.clear();
+        m_Versions.clear();
+        m_Resources.clear();
+    }
+
+    const Stats& stats() const {
+        return m_Stats;
+    }
+
+    // The corner of the attachments the passes draw to, for rendering below the size the
+    // targets were allocated at; the whole target when 0, the default. Passes sampling a
+    // target drawn like this have to scale their coordinates to the area themselves.
+    void setRenderArea(int width, int height) {
+        m_AreaWidth = width;
+        m_AreaHeight = height;
+    }
+
+private:
+    static const int NO_SLOT = -1;
+    static const int DEPTH_SLOT = -2;
+
+    struct Resource {
+        std::string name;
+        RenderTargetDesc desc;
+        bool imported = false;
+        GLuint texture = 0;
+        // index into m_Pool while the frame runs, -1 when nothing alive uses the target
+        int physical = -1;
+        int firstPass = -1;
+        int lastPass = -1;
+    };
+
+    struct Version {
+        int resource = -1;
+        bool needed = false;
+    };
+
+    struct Output {
+        // the version a modify renders on top of, -1 for a write
+        int in = -1;
+        int out = -1;
+        // depth attachments stay even when nothing reads them afterwards
+        bool required = false;
+        int slot = NO_SLOT;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<int> reads;
+        std::vector<Output> outputs;
+        int colorCount = 0;
+        bool sideEffect = false;
+        bool alive = false;
+        std::function<void(const Resources&)> execute;
+    };
+
+    struct Physical {
+        RenderTargetDesc desc;
+        GLuint texture = 0;
+        bool inUse = false;
+        bool usedThisFrame = false;
+    };
+
+    RenderGraphHandle addResource(const Resource& resource) {
+        m_Resources.push_back(resource);
+        Version version;
+        version.resource = (int) m_Resources.size() - 1;
+        m_Versions.push_back(version);
+        return RenderGraphHandle{ (int) m_Versions.size() - 1 };
+    }
+
+    // passes only read versions declared before them, so one walk from the last pass back
+    // settles which versions anything alive needs
+    void cull() {
+        m_Stats = Stats();
+        m_Stats.passes = (unsigned) m_Passes.size();
+        for (int p = (int) m_Passes.size() - 1; p >= 0; --p) {
+            Pass& pass = m_Passes[p];
+            pass.alive = pass.sideEffect;
+            for (const Output& out : pass.outputs)
+                pass.alive |= m_Versions[out.out].needed;
+            if (!pass.alive) {
+                ++m_Stats.culledPasses;
+                m_Stats.culled = m_Stats.culled.empty() ? pass.name : pass.name + ", " + m_Stats.culled;
+                continue;
+            }
+            for (int read : pass.reads)
+                m_Versions[read].needed = true;
+            for (const Output& out : pass.outputs) {
+                if (out.required)
+                    m_Versions[out.out].needed = true;
+                // what a kept modify renders on top of has to be there
+                if (m_Versions[out.out].needed && out.in >= 0)
+                    m_Versions[out.in].needed = true;
+            }
+        }
+        for (int p = 0; p < (int) m_Passes.size(); ++p) {
+            if (!m_Passes[p].alive)
+                continue;
+            for (int read : m_Passes[p].reads)
+                touch(m_Versions[read].resource, p);
+            for (const Output& out : m_Passes[p].outputs) {
+                if (m_Versions[out.out].needed)
+                    touch(m_Versions[out.out].resource, p);
+            }
+        }
+    }
+
+    void touch(int resource, int pass) {
+        Resource& used = m_Resources[resource];
+        if (used.firstPass < 0)
+            used.firstPass = pass;
+        used.lastPass = pass;
+    }
+
+    // pool textures go to targets as their spans start and back to the pool after their last pass
+    void allocate() {
+        for (Physical& physical : m_Pool)
+            physical.inUse = physical.usedThisFrame = false;
+        for (int p = 0; p < (int) m_Passes.size(); ++p) {
+            for (Resource& resource : m_Resources) {
+                if (resource.imported || resource.firstPass != p)
+                    continue;
+                resource.physical = acquire(resource.desc);
+                ++m_Stats.targets;
+                m_Stats.targetBytes += resource.desc.bytes();
+            }
+            for (Resource& resource : m_Resources) {
+                if (!resource.imported && resource.lastPass == p)
+                    m_Pool[resource.physical].inUse = false;
+            }
+        }
+        for (const Physical& physical : m_Pool) {
+            if (physical.usedThisFrame) {
+                ++m_Stats.textures;
+                m_Stats.textureBytes += physical.desc.bytes();
+            }
+        }
+    }
+
+    int acquire(const RenderTargetDesc& desc) {
+        for (unsigned i = 0; i < m_Pool.size(); ++i) {
+            if (!m_Pool[i].inUse && m_Pool[i].desc == desc) {
+                m_Pool[i].inUse = m_Pool[i].usedThisFrame = true;
+                return (int) i;
+            }
+        }
+        Physical physical;
+        physical.desc = desc;
+        physical.inUse = physical.usedThisFrame = true;
+        glGenTextures(1, &physical.texture);
+        glState().bindTexture(0, GL_TEXTURE_2D, physical.texture);
+        if (desc.format == GL_DEPTH24_STENCIL8)
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, GL_DEPTH_STENCIL,
+                         GL_UNSIGNED_INT_24_8, nullptr);
+        else if (desc.isDepth())
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        m_Pool.push_back(physical);
+        return (int) m_Pool.size() - 1;
+    }
+
+    void bindAttachments(const Pass& pass) {
+        // colour textures by slot, 0 for dropped outputs, then the depth texture
+        std::vector<GLuint> key(pass.colorCount + 1, 0);
+        const RenderTargetDesc* size = nullptr;
+        for (const Output& out : pass.outputs) {
+            if (out.slot == NO_SLOT || !m_Versions[out.out].needed)
+                continue;
+            const Resource& resource = m_Resources[m_Versions[out.out].resource];
+            key[out.slot == DEPTH_SLOT ? pass.colorCount : out.slot] = m_Pool[resource.physical].texture;
+            ASSERT(!size || (size->width == resource.desc.width && size->height == resource.desc.height),
+                   "Render graph attachments of one pass differ in size");
+            size = &resource.desc;
+        }
+        if (!size)
+            return;
+        std::map<std::vector<GLuint>, GLuint>::iterator found = m_Framebuffers.find(key);
+        GLuint fbo = found != m_Framebuffers.end() ? found->second : createFramebuffer(key, pass.name);
+        GLStateCache& gl = glState();
+        gl.bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        gl.viewport(0, 0, m_AreaWidth > 0 ? std::min(m_AreaWidth, size->width) : size->width,
+                    m_AreaHeight > 0 ? std::min(m_AreaHeight, size->height) : size->height);
+    }
+
+    GLuint createFramebuffer(const std::vector<GLuint>& key, const std::string& name) {
+        GLuint fbo;
+        glGenFramebuffers(1, &fbo);
+        glState().bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        std::vector<GLenum> drawBuffers;
+        for (unsigned slot = 0; slot + 1 < key.size(); ++slot) {
+            if (key[slot])
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + slot, GL_TEXTURE_2D, key[slot], 0);
+            drawBuffers.push_back(key[slot] ? GL_COLOR_ATTACHMENT0 + slot : GL_NONE);
+        }
+        if (key.back()) {
+            GLenum attachment = GL_DEPTH_ATTACHMENT;
+            for (const Physical& physical : m_Pool) {
+                if (physical.texture == key.back() && physical.desc.format == GL_DEPTH24_STENCIL8)
+                    attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+            }
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, key.back(), 0);
+        }
+        if (drawBuffers.empty())
+            glDrawBuffer(GL_NONE);
+        else
+            glDrawBuffers((GLsizei) drawBuffers.size(), drawBuffers.data());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            LOG(std::cerr) << "The framebuffer of the " << name << " pass is not complete\n";
+        m_Framebuffers[key] = fbo;
+        return fbo;
+    }
+
+    // targets change size or format with the settings, what this frame didn't use goes
+    void releaseUnused() {
+        std::vector<Physical> kept;
+        for (const Physical& physical : m_Pool) {
+            if (physical.usedThisFrame) {
+                kept.push_back(physical);
+                continue;
+            }
+            for (std::map<std::vector<GLuint>, GLuint>::iterator fbo = m_Framebuffers.begin(); fbo != m_Framebuffers.end();) {
+                bool uses = false;
+                for (GLuint texture : fbo->first)
+                    uses |= texture == physical.texture;
+                if (uses) {
+                    glState().deleteFramebuffers(1, &fbo->second);
+                    fbo = m_Framebuffers.erase(fbo);
+                } else {
+                    ++fbo;
+                }
+            }
+            glState().deleteTextures(1, &physical.texture);
+        }
+        m_Pool.swap(kept);
+    }
+
+    std::vector<Pass> m_Passes;
+    std::vector<Version> m_Versions;
+    std::vector<Resource> m_Resources;
+    std::vector<Physical> m_Pool;
+    // framebuffers by attachments, see bindAttachments()
+    std::map<std::vector<GLuint>, GLuint> m_Framebuffers;
+    int m_AreaWidth = 0;
+    int m_AreaHeight = 0;
+    Stats m_Stats;
+};
+
+}
+#endif //PROJECT_BASE_RENDERGRAPH_H
@@ -0,0 +1,133 @@
+#ifndef PROJECT_BASE_RENDERLIST_H
+#define PROJECT_BASE_RENDERLIST_H
+
+#include <glm/glm.hpp>
+
+#include <rg/BVH.h>
+#include <rg/Bounds.h>
+#include <rg/JobSystem.h>
+#include <rg/Scene.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rg {
+
+// One draw for the GL thread. The key orders the list by pass, then cull state, then
+// front to back so early depth testing rejects as much as it can.
+struct RenderItem {
+    uint64_t key;
+    unsigned renderable;
+    unsigned entity;
+};
+
+struct RenderList {
+    std::vector<RenderItem> items;
+    // per entity, before occlusion and screen size were considered; the occlusion
+    // queries are issued for these
+    std::vector<unsigned char> frustumVisible;
+    unsigned occluded = 0;
+    unsigned tooSmall = 0;
+};
+
+// what the culling jobs need to know about the camera
+struct FrameView {
+    Frustum frustum = Frustum::infinite();
+    glm::vec3 eye = glm::vec3(0.0f);
+    // pixels per unit of size at distance 1: viewport height / (2 * tan(fovy / 2))
+    float projectionScale = 1.0f;
+    // renderables whose bounds cover less than this many pixels in radius are skipped
+    float minPixelRadius = 0.0f;
+};
+
+// The job phase of a frame: everything between moving the scene and submitting draws that
+// only reads shared data, split into chunks on the job system. Frustum culling walks
+// disjoint BVH subtrees in parallel; screen size selection, occlusion rejection and key
+// generation run over chunks of the renderable table. The chunk results are concatenated
+// and sorted, the GL thread only walks the finished list.
+class RenderListBuilder {
+public:
+    static const unsigned RENDERABLES_PER_CHUNK = 64;
+
+    explicit RenderListBuilder(JobSystem& jobs) : m_Jobs(jobs) {}
+
+    // occluded holds one flag per entity, the latest answers the occlusion queries gave
+    void build(const Scene& scene, const DynamicBVH& bvh, const std::vector<unsigned char>& occluded,
+               const FrameView& view, RenderList& list) {
+        // frustum culling, each job fills the flags of the entities under its subtrees
+        list.frustumVisible.assign(scene.entityCount(), 0);
+        bvh.splitRoots(4 * (m_Jobs.workerCount() + 1), m_Roots);
+        m_Jobs.parallelFor((unsigned) m_Roots.size(), 1, [&](unsigned, unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; ++i)
+                bvh.query(m_Roots[i], view.frustum, [&](unsigned id) { list.frustumVisible[id] = 1; });
+        });
+
+        // selection and keys, each chunk writes its own slot
+        const Scene::Renderables& renderables = scene.renderables;
+        unsigned chunks = (renderables.size() + RENDERABLES_PER_CHUNK - 1) / RENDERABLES_PER_CHUNK;
+        m_Chunks.resize(std::max(m_Chunks.size(), (size_t) chunks));
+        m_Jobs.parallelFor(renderables.size(), RENDERABLES_PER_CHUNK, [&](unsigned chunk, unsigned begin, unsigned end) {
+            Chunk& out = m_Chunks[chunk];
+            out.items.clear();
+            out.occluded = 0;
+            out.tooSmall = 0;
+            for (unsigned r = begin; r < end; ++r) {
+                unsigned entity = renderables.entity[r];
+                if (!list.frustumVisible[entity])
+                    continue;
+                if (occluded[entity]) {
+                    ++out.occluded;
+                    continue;
+                }
+                const AABB& box = scene.worldBounds[entity];
+                float distance = glm::length(box.center() - view.eye);
+                float radius = glm::length(box.extents());
+                if (distance > radius && radius / distance * view.projectionScale < view.minPixelRadius) {
+                    ++out.tooSmall;
+                    continue;
+                }
+                out.items.push_back({sortKey(renderables.pass[r], renderables.flags[r], distance, r), r, entity});
+            }
+        });
+
+        list.items.clear();
+        list.occluded = 0;
+        list.tooSmall = 0;
+        for (unsigned chunk = 0; chunk < chunks; ++chunk) {
+            const Chunk& in = m_Chunks[chunk];
+            list.items.insert(list.items.end(), in.items.begin(), in.items.end());
+            list.occluded += in.occluded;
+            list.tooSmall += in.tooSmall;
+        }
+        std::sort(list.items.begin(), list.items.end(), [](const RenderItem& a, const RenderItem& b) {
+            return a.key < b.key;
+        });
+    }
+
+private:
+    struct Chunk {
+        std::vector<RenderItem> items;
+        unsigned occluded = 0;
+        unsigned tooSmall = 0;
+    };
+
+    // pass (8 bits) | cull state (1) | distance (31) | renderable (24); the bits of a
+    // non-negative float compare like the float itself
+    static uint64_t sortKey(unsigned pass, unsigned flags, float distance, unsigned renderable) {
+        uint32_t distanceBits;
+        std::memcpy(&distanceBits, &distance, sizeof(distanceBits));
+        return (uint64_t) pass << 56 |
+               (uint64_t) ((flags & RENDER_CULL_BACK_FACES) != 0) << 55 |
+               (uint64_t) (distanceBits & 0x7fffffffu) << 24 |
+               (renderable & 0xffffffu);
+    }
+
+    JobSystem& m_Jobs;
+    std::vector<int> m_Roots;
+    std::vector<Chunk> m_Chunks;
+};
+
+}
+#endif //PROJECT_BASE_RENDERLIST_H
@@ -0,0 +1,212 @@
+#ifndef PROJECT_BASE_SCENE_H
+#define PROJECT_BASE_SCENE_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <rg/Bounds.h>
+#include <rg/Error.h>
+#include <rg/SceneGraph.h>
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+enum RenderPass : unsigned char {
+    // lit by model_lighting, drawn from a Model
+    PASS_LIT,
+    // alpha-tested textured quads, like the grass
+    PASS_ALPHA_TESTED
+};
+
+enum RenderFlags : unsigned char {
+    RENDER_CULL_BACK_FACES = 1 << 0,
+    // submit an occlusion query for the bounds; not worth it for big occluders that are always seen
+    RENDER_OCCLUSION_TEST = 1 << 1
+};
+
+// Entity store with one table per component, each kept as a structure of arrays so the
+// systems walking them only touch the columns they need. An entity is an index into the
+// per-entity columns (transform node, bounds, name); renderables and lights are separate
+// tables that point back at their entity. Entity ids double as scene graph node ids,
+// transform buffer slots and BVH user data.
+class Scene {
+public:
+    static const int NONE = -1;
+
+    struct Renderables {
+        std::vector<unsigned> entity;
+        // null for the alpha-tested quads, which all share one VAO
+        std::vector<Model*> model;
+        std::vector<unsigned> firstMesh;
+        std::vector<unsigned> meshCount;
+        // GL texture of the alpha-tested quads, models bind their own
+        std::vector<unsigned> texture;
+        std::vector<unsigned char> pass;
+        std::vector<unsigned char> flags;
+
+        unsigned size() const {
+            return (unsigned) entity.size();
+        }
+    };
+
+    struct PointLights {
+        std::vector<unsigned> entity;
+        std::vector<glm::vec3> ambient;
+        std::vector<glm::vec3> diffuse;
+        std::vector<glm::vec3> specular;
+        std::vector<float> constant;
+        std::vector<float> linear;
+        std::vector<float> quadratic;
+        // ambient and diffuse follow cos and sin of the time
+        std::vector<unsigned char> pulse;
+
+        unsigned size() const {
+            return (unsigned) entity.size();
+        }
+    };
+
+    // position = center + cosAxis * cos(speed * t) + sinAxis * sin(speed * t)
+    struct Orbits {
+        std::vector<unsigned> entity;
+        std::vector<glm::vec3> center;
+        std::vector<glm::vec3> cosAxis;
+        std::vector<glm::vec3> sinAxis;
+        std::vector<float> speed;
+    };
+
+    // rotation angle = speed * t around the axis the entity was created with
+    struct Spins {
+        std::vector<unsigned> entity;
+        std::vector<float> speed;
+    };
+
+    unsigned createEntity(const std::string& name, const glm::vec3& position, float angle, const glm::vec3& axis,
+                          const glm::vec3& scale, bool isStatic, int parent = SceneGraph::NO_PARENT) {
+        unsigned id = graph.createNode(position, angle, axis, scale, isStatic, parent);
+        names.push_back(name);
+        localBounds.emplace_back();
+        worldBounds.emplace_back();
+        // through a copy, push_back would take the member by reference
+        const int noRenderable = NONE;
+        renderableOf.push_back(noRenderable);
+        return id;
+    }
+
+    // draws meshes [firstMesh, firstMesh + meshCount) of the model, bounds are taken from the meshes
+    unsigned addRenderable(unsigned entity, Model& model, unsigned firstMesh, unsigned meshCount,
+                           RenderPass pass, unsigned char flags) {
+        localBounds[entity].expand(model.Bounds(firstMesh, meshCount));
+        return pushRenderable(entity, &model, firstMesh, meshCount, 0, pass, flags);
+    }
+
+    unsigned addRenderable(unsigned entity, Model& model, RenderPass pass, unsigned char flags) {
+        return addRenderable(entity, model, 0, (unsigned) model.meshes.size(), pass, flags);
+    }
+
+    // geometry not owned by a Model, the object space bounds have to be given
+    unsigned addRenderable(unsigned entity, const AABB& bounds, unsigned texture, RenderPass pass,
+                           unsigned char flags) {
+        localBounds[entity].expand(bounds);
+        return pushRenderable(entity, nullptr, 0, 0, texture, pass, flags);
+    }
+
+    unsigned addPointLight(unsigned entity, const glm::vec3& ambient, const glm::vec3& diffuse,
+                           const glm::vec3& specular, float constant, float linear, float quadratic,
+                           bool pulse = false) {
+        // light sources are picked up by the BVH queries through a small box around them
+        if (localBounds[entity].empty())
+            localBounds[entity] = AABB(glm::vec3(-0.5f), glm::vec3(0.5f));
+        lights.entity.push_back(entity);
+        lights.ambient.push_back(ambient);
+        lights.diffuse.push_back(diffuse);
+        lights.specular.push_back(specular);
+        lights.constant.push_back(constant);
+        lights.linear.push_back(linear);
+        lights.quadratic.push_back(quadratic);
+        lights.pulse.push_back(pulse);
+        return lights.size() - 1;
+    }
+
+    void addOrbit(unsigned entity, const glm::vec3& center, const glm::vec3& cosAxis, const glm::vec3& sinAxis,
+                  float speed) {
+        ASSERT(!graph.isStatic(entity), "Animated entities can't be static");
+        orbits.entity.push_back(entity);
+        orbits.center.push_back(center);
+        orbits.cosAxis.push_back(cosAxis);
+        orbits.sinAxis.push_back(sinAxis);
+        orbits.speed.push_back(speed);
+    }
+
+    void addSpin(unsigned entity, float speed) {
+        ASSERT(!graph.isStatic(entity), "Animated entities can't be static");
+        spins.entity.push_back(entity);
+        spins.speed.push_back(speed);
+    }
+
+    void animate(float time) {
+        for (unsigned i = 0; i < spins.entity.size(); ++i)
+            graph.setRotation(spins.entity[i], spins.speed[i] * time);
+        for (unsigned i = 0; i < orbits.entity.size(); ++i) {
+            float angle = orbits.speed[i] * time;
+            graph.setPosition(orbits.entity[i], orbits.center[i] + orbits.cosAxis[i] * std::cos(angle) +
+                                                orbits.sinAxis[i] * std::sin(angle));
+        }
+    }
+
+    // new world matrices and world bounds for the entities that moved, listed in changedEntities()
+    void updateTransforms() {
+        graph.update();
+        for (unsigned id : graph.changedNodes())
+            worldBounds[id] = localBounds[id].transformed(graph.world(id));
+    }
+
+    const std::vector<unsigned>& changedEntities() const {
+        return graph.changedNodes();
+    }
+
+    glm::vec3 position(unsigned entity) const {
+        return glm::vec3(graph.world(entity)[3]);
+    }
+
+    unsigned entityCount() const {
+        return graph.size();
+    }
+
+    const char* name(int entity) const {
+        return entity == NONE ? "nothing" : names[entity].c_str();
+    }
+
+    // transform component
+    SceneGraph graph;
+    // per-entity columns
+    std::vector<std::string> names;
+    std::vector<AABB> localBounds;
+    std::vector<AABB> worldBounds;
+    std::vector<int> renderableOf;
+    // component tables
+    Renderables renderables;
+    PointLights lights;
+    Orbits orbits;
+    Spins spins;
+
+private:
+    unsigned pushRenderable(unsigned entity, Model* model, unsigned firstMesh, unsigned meshCount,
+                            unsigned texture, RenderPass pass, unsigned char flags) {
+        ASSERT(renderableOf[entity] == NONE, "An entity has at most one renderable");
+        renderableOf[entity] = (int) renderables.size();
+        renderables.entity.push_back(entity);
+        renderables.model.push_back(model);
+        renderables.firstMesh.push_back(firstMesh);
+        renderables.meshCount.push_back(meshCount);
+        renderables.texture.push_back(texture);
+        renderables.pass.push_back(pass);
+        renderables.flags.push_back(flags);
+        return renderables.size() - 1;
+    }
+};
+
+}
+#endif //PROJECT_BASE_SCENE_H
@@ -0,0 +1,508 @@
+#ifndef PROJECT_BASE_SCENEFILE_H
+#define PROJECT_BASE_SCENEFILE_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/model.h>
+#include <rg/Error.h>
+#include <rg/Image.h>
+#include <rg/JobSystem.h>
+#include <rg/Scene.h>
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// Compiled scene layout: the header, then the model, texture, instance and light records,
+// then a blob of zero-terminated strings the records point into by offset. Everything is
+// plain data, so loading is a single read followed by pointer arithmetic.
+const uint32_t SCENE_FILE_MAGIC = 0x4e435352; // "RSCN"
+const uint32_t SCENE_FILE_VERSION = 1;
+const uint32_t SCENE_FILE_NONE = ~0u;
+
+struct SceneFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t modelCount;
+    uint32_t textureCount;
+    uint32_t instanceCount;
+    uint32_t lightCount;
+    uint32_t stringBytes;
+    // right, left, top, bottom, front, back
+    uint32_t skyboxFaces[6];
+    // post-processing and directional light start values
+    uint32_t hdr;
+    uint32_t bloom;
+    int32_t kernelEffect;
+    float exposure;
+    float gamma;
+    glm::vec3 dirLightDirection;
+    glm::vec3 dirLightAmbient;
+    glm::vec3 dirLightDiffuse;
+    glm::vec3 dirLightSpecular;
+};
+
+struct SceneModelRecord {
+    uint32_t name;
+    uint32_t path;
+};
+
+struct SceneTextureRecord {
+    uint32_t name;
+    uint32_t path;
+    uint32_t srgb;
+};
+
+struct SceneInstanceRecord {
+    uint32_t name;
+    // a model index for lit instances, a texture index for alpha-tested quads
+    uint32_t model;
+    uint32_t texture;
+    glm::vec3 position;
+    float angle;
+    glm::vec3 axis;
+    glm::vec3 scale;
+    uint32_t isStatic;
+    uint32_t pass;
+    uint32_t flags;
+    float spin;
+};
+
+struct SceneLightRecord {
+    uint32_t name;
+    // the orbit center for orbiting lights
+    glm::vec3 position;
+    glm::vec3 ambient;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+    uint32_t pulse;
+    glm::vec3 orbitCosAxis;
+    glm::vec3 orbitSinAxis;
+    float orbitSpeed;
+};
+
+// A scene description written by hand as text and loaded in its compiled binary form.
+// The text has one statement per line, '#' starts a comment, angles are in degrees:
+//
+//   skybox <directory with right/left/top/bottom/front/back.png>
+//   post hdr|bloom|effect <int>
+//   post exposure|gamma <float>
+//   dirlight direction|ambient|diffuse|specular <x y z>
+//   model <name> <path>
+//   texture <name> <path> [srgb]
+//   instance <name> <model> <position> <angle> <axis> <scale> static|dynamic [options]
+//   quad <name> <texture> <position> <angle> <axis> <scale> static|dynamic [options]
+//   light <name> <position> <ambient> <diffuse> <specular> <constant linear quadratic> [pulse]
+//         [orbit <cos axis> <sin axis> <speed>]
+//
+// Instance options are cull_back_faces, occlusion_test and spin <radians per second>.
+class SceneFile {
+public:
+    // loads the compiled file next to the text one, compiling it first when it is missing,
+    // older than the text, from another version of the format or damaged
+    bool load(const std::string& textPath) {
+        std::string binaryPath = textPath + ".bin";
+        struct stat text, binary;
+        bool haveText = stat(textPath.c_str(), &text) == 0;
+        bool haveBinary = stat(binaryPath.c_str(), &binary) == 0;
+        bool stale = !haveBinary || (haveText && binary.st_mtime < text.st_mtime);
+        if (!stale && read(binaryPath))
+            return true;
+        if (!haveText) {
+            LOG(std::cerr) << "Scene file " << textPath << " doesn't exist\n";
+            return false;
+        }
+        return compile(textPath, binaryPath) && read(binaryPath);
+    }
+
+    static bool compile(const std::string& textPath, const std::string& binaryPath) {
+        std::ifstream in(textPath);
+        if (!in) {
+            LOG(std::cerr) << "Can't open scene file " << textPath << '\n';
+            return false;
+        }
+        Compiler compiler;
+        std::string line;
+        for (unsigned lineNumber = 1; std::getline(in, line); ++lineNumber) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream statement(line);
+            std::string keyword;
+            if (!(statement >> keyword))
+                continue;
+            std::string error = compiler.statement(keyword, statement);
+            if (!error.empty()) {
+                LOG(std::cerr) << textPath << ':' << lineNumber << ": " << error << '\n';
+                return false;
+            }
+        }
+        if (compiler.header.skyboxFaces[0] == SCENE_FILE_NONE) {
+            LOG(std::cerr) << textPath << ": the scene has no skybox\n";
+            return false;
+        }
+        return compiler.write(binaryPath);
+    }
+
+    const SceneFileHeader& header() const {
+        return *reinterpret_cast<const SceneFileHeader*>(m_Data.data());
+    }
+
+    const SceneModelRecord* models() const {
+        return reinterpret_cast<const SceneModelRecord*>(&header() + 1);
+    }
+
+    const SceneTextureRecord* textures() const {
+        return reinterpret_cast<const SceneTextureRecord*>(models() + header().modelCount);
+    }
+
+    const SceneInstanceRecord* instances() const {
+        return reinterpret_cast<const SceneInstanceRecord*>(textures() + header().textureCount);
+    }
+
+    const SceneLightRecord* lights() const {
+        return reinterpret_cast<const SceneLightRecord*>(instances() + header().instanceCount);
+    }
+
+    const char* string(uint32_t offset) const {
+        return reinterpret_cast<const char*>(lights() + header().lightCount) + offset;
+    }
+
+    // creates the entities; models and textures are indexed like the records that name them
+    void instantiate(Scene& scene, const std::vector<Model*>& models, const std::vector<unsigned>& textures) const {
+        // the quad vertices the alpha-tested pass draws
+        const AABB quadBounds(glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(1.0f, 0.5f, 0.0f));
+        for (unsigned i = 0; i < header().instanceCount; ++i) {
+            const SceneInstanceRecord& r = instances()[i];
+            unsigned entity = scene.createEntity(string(r.name), r.position, r.angle, r.axis, r.scale, r.isStatic);
+            if (r.pass == PASS_LIT)
+                scene.addRenderable(entity, *models[r.model], PASS_LIT, r.flags);
+            else
+                scene.addRenderable(entity, quadBounds, textures[r.texture], (RenderPass) r.pass, r.flags);
+            if (r.spin != 0.0f)
+                scene.addSpin(entity, r.spin);
+        }
+        const glm::vec3 yAxis(0.0f, 1.0f, 0.0f);
+        for (unsigned i = 0; i < header().lightCount; ++i) {
+            const SceneLightRecord& l = lights()[i];
+            bool orbits = l.orbitSpeed != 0.0f;
+            unsigned entity = scene.createEntity(string(l.name), orbits ? l.position + l.orbitCosAxis : l.position,
+                                                 0.0f, yAxis, glm::vec3(1.0f), !orbits);
+            scene.addPointLight(entity, l.ambient, l.diffuse, l.specular, l.constant, l.linear, l.quadratic, l.pulse);
+            if (orbits)
+                scene.addOrbit(entity, l.position, l.orbitCosAxis, l.orbitSinAxis, l.orbitSpeed);
+        }
+    }
+
+private:
+    struct Compiler {
+        SceneFileHeader header;
+        std::vector<SceneModelRecord> models;
+        std::vector<SceneTextureRecord> textures;
+        std::vector<SceneInstanceRecord> instances;
+        std::vector<SceneLightRecord> lights;
+        std::string strings;
+        std::map<std::string, uint32_t> modelIndex;
+        std::map<std::string, uint32_t> textureIndex;
+
+        Compiler() {
+            header = SceneFileHeader();
+            header.magic = SCENE_FILE_MAGIC;
+            header.version = SCENE_FILE_VERSION;
+            for (uint32_t& face : header.skyboxFaces)
+                face = SCENE_FILE_NONE;
+            header.kernelEffect = 3;
+            header.exposure = 0.197f;
+            header.gamma = 2.2f;
+        }
+
+        uint32_t addString(const std::string& s) {
+            uint32_t offset = (uint32_t) strings.size();
+            strings += s;
+            strings += '\0';
+            return offset;
+        }
+
+        // returns an error message, empty on success
+        std::string statement(const std::string& keyword, std::istringstream& in) {
+            if (keyword == "skybox") {
+                std::string directory;
+                if (!(in >> directory))
+                    return "expected a skybox directory";
+                const char* faces[] = { "right", "left", "top", "bottom", "front", "back" };
+                for (int i = 0; i < 6; ++i)
+                    header.skyboxFaces[i] = addString(directory + '/' + faces[i] + ".png");
+            } else if (keyword == "post") {
+                std::string setting;
+                in >> setting;
+                if (setting == "hdr")
+                    in >> header.hdr;
+                else if (setting == "bloom")
+                    in >> header.bloom;
+                else if (setting == "effect")
+                    in >> header.kernelEffect;
+                else if (setting == "exposure")
+                    in >> header.exposure;
+                else if (setting == "gamma")
+                    in >> header.gamma;
+                else
+                    return "unknown post-processing setting '" + setting + "'";
+            } else if (keyword == "dirlight") {
+                std::string setting;
+                glm::vec3 value;
+                in >> setting >> value.x >> value.y >> value.z;
+                if (setting == "direction")
+                    header.dirLightDirection = value;
+                else if (setting == "ambient")
+                    header.dirLightAmbient = value;
+                else if (setting == "diffuse")
+                    header.dirLightDiffuse = value;
+                else if (setting == "specular")
+                    header.dirLightSpecular = value;
+                else
+                    return "unknown directional light setting '" + setting + "'";
+            } else if (keyword == "model") {
+                std::string name, path;
+                if (!(in >> name >> path))
+                    return "expected a model name and path";
+                if (modelIndex.count(name))
+                    return "model '" + name + "' is defined twice";
+                modelIndex[name] = (uint32_t) models.size();
+                models.push_back({addString(name), addString(path)});
+            } else if (keyword == "texture") {
+                std::string name, path, option;
+                if (!(in >> name >> path))
+                    return "expected a texture name and path";
+                if (textureIndex.count(name))
+                    return "texture '" + name + "' is defined twice";
+                in >> option;
+                textureIndex[name] = (uint32_t) textures.size();
+                textures.push_back({addString(name), addString(path), option == "srgb"});
+                return "";
+            } else if (keyword == "instance" || keyword == "quad") {
+                return instance(keyword == "quad", in);
+            } else if (keyword == "light") {
+                return light(in);
+            } else {
+                return "unknown statement '" + keyword + "'";
+            }
+            if (in.fail())
+                return "malformed '" + keyword + "' statement";
+            return "";
+        }
+
+        std::string instance(bool quad, std::istringstream& in) {
+            SceneInstanceRecord r = SceneInstanceRecord();
+            std::string name, source, mobility, option;
+            in >> name >> source >> r.position.x >> r.position.y >> r.position.z >> r.angle
+               >> r.axis.x >> r.axis.y >> r.axis.z >> r.scale.x >> r.scale.y >> r.scale.z >> mobility;
+            if (in.fail() || (mobility != "static" && mobility != "dynamic"))
+                return "malformed instance '" + name + "'";
+            const std::map<std::string, uint32_t>& index = quad ? textureIndex : modelIndex;
+            auto found = index.find(source);
+            if (found == index.end())
+                return (quad ? "unknown texture '" : "unknown model '") + source + "'";
+            r.name = addString(name);
+            r.model = quad ? SCENE_FILE_NONE : found->second;
+            r.texture = quad ? found->second : SCENE_FILE_NONE;
+            r.angle = glm::radians(r.angle);
+            r.isStatic = mobility == "static";
+            r.pass = quad ? PASS_ALPHA_TESTED : PASS_LIT;
+            while (in >> option) {
+                if (option == "cull_back_faces")
+                    r.flags |= RENDER_CULL_BACK_FACES;
+                else if (option == "occlusion_test")
+                    r.flags |= RENDER_OCCLUSION_TEST;
+                else if (option != "spin")
+                    return "unknown instance option '" + option + "'";
+                else if (!(in >> r.spin))
+                    return "expected the spin speed of instance '" + name + "'";
+                else if (r.isStatic)
+                    return "spinning instance '" + name + "' has to be dynamic";
+            }
+            instances.push_back(r);
+            return "";
+        }
+
+        std::string light(std::istringstream& in) {
+            SceneLightRecord l = SceneLightRecord();
+            std::string name, option;
+            in >> name >> l.position.x >> l.position.y >> l.position.z
+               >> l.ambient.x >> l.ambient.y >> l.ambient.z
+               >> l.diffuse.x >> l.diffuse.y >> l.diffuse.z
+               >> l.specular.x >> l.specular.y >> l.specular.z
+               >> l.constant >> l.linear >> l.quadratic;
+            if (in.fail())
+                return "malformed light '" + name + "'";
+            l.name = addString(name);
+            while (in >> option) {
+                if (option == "pulse") {
+                    l.pulse = 1;
+                } else if (option == "orbit") {
+                    in >> l.orbitCosAxis.x >> l.orbitCosAxis.y >> l.orbitCosAxis.z
+                       >> l.orbitSinAxis.x >> l.orbitSinAxis.y >> l.orbitSinAxis.z >> l.orbitSpeed;
+                    if (in.fail())
+                        return "malformed orbit of light '" + name + "'";
+                } else {
+                    return "unknown light option '" + option + "'";
+                }
+            }
+            lights.push_back(l);
+            return "";
+        }
+
+        bool write(const std::string& binaryPath) {
+            header.modelCount = (uint32_t) models.size();
+            header.textureCount = (uint32_t) textures.size();
+            header.instanceCount = (uint32_t) instances.size();
+            header.lightCount = (uint32_t) lights.size();
+            header.stringBytes = (uint32_t) strings.size();
+            std::ofstream out(binaryPath, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(models.data()), models.size() * sizeof(SceneModelRecord));
+            out.write(reinterpret_cast<const char*>(textures.data()), textures.size() * sizeof(SceneTextureRecord));
+            out.write(reinterpret_cast<const char*>(instances.data()), instances.size() * sizeof(SceneInstanceRecord));
+            out.write(reinterpret_cast<const char*>(lights.data()), lights.size() * sizeof(SceneLightRecord));
+            out.write(strings.data(), strings.size());
+            if (!out) {
+                LOG(std::cerr) << "Can't write compiled scene " << binaryPath << '\n';
+                return false;
+            }
+            return true;
+        }
+    };
+
+    bool read(const std::string& binaryPath) {
+        std::ifstream in(binaryPath, std::ios::binary | std::ios::ate);
+        if (!in)
+            return false;
+        m_Data.resize((size_t) in.tellg());
+        in.seekg(0);
+        if (m_Data.size() < sizeof(SceneFileHeader) || !in.read(m_Data.data(), m_Data.size()))
+            return false;
+        const SceneFileHeader& h = header();
+        if (h.magic != SCENE_FILE_MAGIC || h.version != SCENE_FILE_VERSION)
+            return false;
+        size_t expected = sizeof(SceneFileHeader) + h.modelCount * sizeof(SceneModelRecord) +
+                          h.textureCount * sizeof(SceneTextureRecord) +
+                          h.instanceCount * sizeof(SceneInstanceRecord) +
+                          h.lightCount * sizeof(SceneLightRecord) + h.stringBytes;
+        if (m_Data.size() != expected)
+            return false;
+        if (!valid()) {
+            LOG(std::cerr) << "Compiled scene " << binaryPath << " is corrupt\n";
+            return false;
+        }
+        return true;
+    }
+
+    // every index and string offset the records hold points into the file, so a damaged one
+    // gets compiled again instead of being read out of bounds
+    bool valid() const {
+        const SceneFileHeader& h = header();
+        if (h.stringBytes == 0 || string(0)[h.stringBytes - 1] != '\0')
+            return false;
+        for (uint32_t face : h.skyboxFaces)
+            if (face >= h.stringBytes)
+                return false;
+        for (unsigned i = 0; i < h.modelCount; ++i)
+            if (models()[i].name >= h.stringBytes || models()[i].path >= h.stringBytes)
+                return false;
+        for (unsigned i = 0; i < h.textureCount; ++i)
+            if (textures()[i].name >= h.stringBytes || textures()[i].path >= h.stringBytes)
+                return false;
+        for (unsigned i = 0; i < h.instanceCount; ++i) {
+            const SceneInstanceRecord& r = instances()[i];
+            if (r.name >= h.stringBytes)
+                return false;
+            if (r.pass == PASS_LIT ? r.model >= h.modelCount
+                                   : r.pass != PASS_ALPHA_TESTED || r.texture >= h.textureCount)
+                return false;
+        }
+        for (unsigned i = 0; i < h.lightCount; ++i)
+            if (lights()[i].name >= h.stringBytes)
+                return false;
+        return true;
+    }
+
+    std::vector<char> m_Data;
+};
+
+// Schedules a decode job for every model and texture a scene file references the moment it
+// is created, so file reads and decompression overlap each other and whatever the main thread
+// does meanwhile. Creating the GL objects is left to the thread that owns the context; it can
+// schedule those as main thread jobs that depend on the decode jobs exposed here.
+class SceneAssets {
+public:
+    SceneAssets(const SceneFile& file, JobSystem& jobs)
+            : m_Models(file.header().modelCount), m_Textures(file.header().textureCount), m_Skybox(6) {
+        const SceneFileHeader& header = file.header();
+        for (unsigned i = 0; i < header.modelCount; ++i) {
+            std::string path = file.string(file.models()[i].path);
+            m_ModelJobs.push_back(jobs.schedule([this, i, path]() { m_Models[i] = Model::Import(path); }));
+        }
+        // quads and the skybox were always loaded with stb's vertical flip on, unlike the models
+        for (unsigned i = 0; i < header.textureCount; ++i) {
+            std::string path = file.string(file.textures()[i].path);
+            m_TextureJobs.push_back(jobs.schedule([this, i, path]() { m_Textures[i] = Image::decode(path, true); }));
+        }
+        for (unsigned i = 0; i < 6; ++i) {
+            std::string path = file.string(header.skyboxFaces[i]);
+            m_SkyboxJobs.push_back(jobs.schedule([this, i, path]() { m_Skybox[i] = Image::decode(path, true); }));
+        }
+    }
+
+    SceneAssets(const SceneAssets&) = delete;
+    SceneAssets& operator=(const SceneAssets&) = delete;
+
+    const JobHandle& modelJob(unsigned index) const {
+        return m_ModelJobs[index];
+    }
+
+    const JobHandle& textureJob(unsigned index) const {
+        return m_TextureJobs[index];
+    }
+
+    const std::vector<JobHandle>& skyboxJobs() const {
+        return m_SkyboxJobs;
+    }
+
+    // the results, valid once the matching jobs have finished
+    ModelImport& model(unsigned index) {
+        return m_Models[index];
+    }
+
+    const Image& texture(unsigned index) const {
+        return m_Textures[index];
+    }
+
+    const std::vector<Image>& skybox() const {
+        return m_Skybox;
+    }
+
+    // frees the decoded data once everything was uploaded
+    void release() {
+        m_Models.clear();
+        m_Textures.clear();
+        m_Skybox.clear();
+    }
+
+private:
+    std::vector<ModelImport> m_Models;
+    std::vector<Image> m_Textures;
+    std::vector<Image> m_Skybox;
+    std::vector<JobHandle> m_ModelJobs;
+    std::vector<JobHandle> m_TextureJobs;
+    std::vector<JobHandle> m_SkyboxJobs;
+};
+
+}
+#endif //PROJECT_BASE_SCENEFILE_H
@@ -0,0 +1,169 @@
+#ifndef PROJECT_BASE_SCENEGRAPH_H
+#define PROJECT_BASE_SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <rg/Error.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace rg {
+
+// Hierarchy of transforms stored in flat arrays indexed by node id. A node's local
+// transform is translate * rotate(angle, axis) * scale, the same order the scene was
+// written in by hand. Setters only mark the node dirty; update() recomputes the world
+// and normal matrices of dirty nodes and their descendants and nothing else, so static
+// nodes are computed once and then cost nothing. Parents must be created before their
+// children, which lets update() handle ancestors first by visiting dirty ids in order.
+class SceneGraph {
+public:
+    static const int NO_PARENT = -1;
+
+    unsigned createNode(const glm::vec3& position, float angle, const glm::vec3& axis, const glm::vec3& scale,
+                        bool isStatic, int parent = NO_PARENT) {
+        ASSERT(parent < (int) size(), "Scene graph parents have to be created before their children");
+        unsigned id = size();
+        Local local;
+        local.position = position;
+        local.angle = angle;
+        local.axis = axis;
+        local.scale = scale;
+        m_Local.push_back(local);
+        m_Parent.push_back(parent);
+        // push_back takes a reference, which the member would need a definition outside the class for
+        const int noChild = NO_PARENT;
+        m_FirstChild.push_back(noChild);
+        m_NextSibling.push_back(noChild);
+        m_World.push_back(glm::mat4(1.0f));
+        m_Normal.push_back(glm::mat3(1.0f));
+        m_Static.push_back(isStatic);
+        m_Dirty.push_back(false);
+        if (parent != NO_PARENT) {
+            m_NextSibling[id] = m_FirstChild[parent];
+            m_FirstChild[parent] = (int) id;
+        }
+        if (!isStatic)
+            m_DynamicNodes.push_back(id);
+        markDirty(id);
+        return id;
+    }
+
+    void setPosition(unsigned node, const glm::vec3& position) {
+        if (m_Local[node].position == position)
+            return;
+        m_Local[node].position = position;
+        markDirty(node);
+    }
+
+    void setRotation(unsigned node, float angle) {
+        if (m_Local[node].angle == angle)
+            return;
+        m_Local[node].angle = angle;
+        markDirty(node);
+    }
+
+    void setScale(unsigned node, const glm::vec3& scale) {
+        if (m_Local[node].scale == scale)
+            return;
+        m_Local[node].scale = scale;
+        markDirty(node);
+    }
+
+    // recomputes the dirty subtrees, the ids that got new matrices are listed in changedNodes()
+    void update() {
+        m_Changed.clear();
+        if (m_DirtyList.empty())
+            return;
+        std::sort(m_DirtyList.begin(), m_DirtyList.end());
+        for (unsigned node : m_DirtyList) {
+            // already recomputed as part of a dirty ancestor
+            if (!m_Dirty[node])
+                continue;
+            updateSubtree(node);
+        }
+        m_DirtyList.clear();
+    }
+
+    const glm::mat4& world(unsigned node) const {
+        return m_World[node];
+    }
+
+    const glm::mat3& normalMatrix(unsigned node) const {
+        return m_Normal[node];
+    }
+
+    const std::vector<unsigned>& changedNodes() const {
+        return m_Changed;
+    }
+
+    const std::vector<unsigned>& dynamicNodes() const {
+        return m_DynamicNodes;
+    }
+
+    bool isStatic(unsigned node) const {
+        return m_Static[node];
+    }
+
+    unsigned size() const {
+        return (unsigned) m_Local.size();
+    }
+
+private:
+    struct Local {
+        glm::vec3 position;
+        float angle;
+        glm::vec3 axis;
+        glm::vec3 scale;
+    };
+
+    void markDirty(unsigned node) {
+        if (m_Dirty[node])
+            return;
+        m_Dirty[node] = true;
+        m_DirtyList.push_back(node);
+    }
+
+    glm::mat4 localMatrix(unsigned node) const {
+        const Local& local = m_Local[node];
+        glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, local.position);
+        if (local.angle != 0.0f)
+            model = glm::rotate(model, local.angle, local.axis);
+        model = glm::scale(model, local.scale);
+        return model;
+    }
+
+    void updateSubtree(unsigned root) {
+        m_Stack.clear();
+        m_Stack.push_back(root);
+        while (!m_Stack.empty()) {
+            unsigned node = m_Stack.back();
+            m_Stack.pop_back();
+            int parent = m_Parent[node];
+            m_World[node] = parent == NO_PARENT ? localMatrix(node) : m_World[parent] * localMatrix(node);
+            m_Normal[node] = glm::transpose(glm::inverse(glm::mat3(m_World[node])));
+            m_Dirty[node] = false;
+            m_Changed.push_back(node);
+            for (int child = m_FirstChild[node]; child != NO_PARENT; child = m_NextSibling[child])
+                m_Stack.push_back((unsigned) child);
+        }
+    }
+
+    std::vector<Local> m_Local;
+    std::vector<int> m_Parent;
+    std::vector<int> m_FirstChild;
+    std::vector<int> m_NextSibling;
+    std::vector<glm::mat4> m_World;
+    std::vector<glm::mat3> m_Normal;
+    std::vector<bool> m_Static;
+    std::vector<bool> m_Dirty;
+    std::vector<unsigned> m_DirtyList;
+    std::vector<unsigned> m_Changed;
+    std::vector<unsigned> m_DynamicNodes;
+    std::vector<unsigned> m_Stack;
+};
+
+}
+#endif //PROJECT_BASE_SCENEGRAPH_H
@@ -0,0 +1,66 @@
+#ifndef PROJECT_BASE_SHADERPERMUTATIONS_H
+#define PROJECT_BASE_SHADERPERMUTATIONS_H
+
+#include <learnopengl/shader.h>
+#include <rg/Error.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rg {
+
+// Variants of one vertex/fragment pair, compiled with a #define per enabled feature instead
+// of branching on uniforms, so a disabled feature costs nothing on the GPU. A variant is
+// keyed by a bit mask over the feature names given at construction (bit i enables
+// features[i]), compiled the first time it is asked for and kept for the rest of the run.
+// setup runs once on every new program, for the uniforms that never change, like sampler units.
+class ShaderPermutations {
+public:
+    ShaderPermutations(std::string vertexPath, std::string fragmentPath, std::vector<std::string> features,
+                       std::function<void(Shader&)> setup = nullptr)
+            : m_VertexPath(std::move(vertexPath)), m_FragmentPath(std::move(fragmentPath)),
+              m_Features(std::move(features)), m_Setup(std::move(setup)) {
+        ASSERT(m_Features.size() <= 32, "Feature masks are 32 bits");
+    }
+
+    ShaderPermutations(const ShaderPermutations&) = delete;
+    ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+    Shader& get(unsigned features) {
+        std::map<unsigned, std::unique_ptr<Shader>>::iterator found = m_Programs.find(features);
+        if (found != m_Programs.end())
+            return *found->second;
+        std::unique_ptr<Shader>& program = m_Programs[features];
+        program.reset(new Shader(m_VertexPath.c_str(), m_FragmentPath.c_str(), nullptr, defines(features)));
+        if (m_Setup)
+            m_Setup(*program);
+        return *program;
+    }
+
+    // the #define block of a variant
+    std::string defines(unsigned features) const {
+        std::string block;
+        for (unsigned i = 0; i < m_Features.size(); ++i) {
+            if (features & (1u << i))
+                block += "#define " + m_Features[i] + "\n";
+        }
+        return block;
+    }
+
+    unsigned compiledCount() const {
+        return (unsigned) m_Programs.size();
+    }
+
+private:
+    std::string m_VertexPath;
+    std::string m_FragmentPath;
+    std::vector<std::string> m_Features;
+    std::function<void(Shader&)> m_Setup;
+    std::map<unsigned, std::unique_ptr<Shader>> m_Programs;
+};
+
+}
+#endif //PROJECT_BASE_SHADERPERMUTATIONS_H
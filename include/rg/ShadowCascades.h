@@ -0,0 +1,322 @@
+#ifndef PROJECT_BASE_SHADOWCASCADES_H
+#define PROJECT_BASE_SHADOWCASCADES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <rg/Bounds.h>
+#include <rg/GLStateCache.h>
+#include <rg/Scene.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace rg {
+
+// One slice of the view frustum with its own orthographic shadow map. Casters are renderables.
+struct ShadowCascade {
+    glm::mat4 lightSpace = glm::mat4(1.0f);
+    // view depth where the slice ends
+    float splitDepth = 0.0f;
+    // world units covered by a texel, the shaders offset lookups along the normal by about that
+    float texelSize = 0.0f;
+    // the static layer is stale and gets redrawn from staticCasters this frame
+    bool staticDirty = false;
+    std::vector<unsigned> staticCasters;
+    std::vector<unsigned> dynamicCasters;
+};
+
+struct ShadowFrame {
+    static const unsigned CASCADES = 3;
+
+    bool enabled = false;
+    ShadowCascade cascades[CASCADES];
+};
+
+// Fits the cascades for the moonlight and picks their casters. Static casters are drawn into a
+// cached layer of each cascade, which stays valid as long as the light and the cascade window
+// don't move. A window covers a sphere around the camera that holds the cascade's slice of the
+// view frustum whichever way the camera looks, so turning never invalidates it; it is oversized
+// by WINDOW_MARGIN and stays put until walking takes the sphere out of it. Fixed windows also
+// keep the shadow edges from shimmering.
+class ShadowCascadeBuilder {
+public:
+    static constexpr float WINDOW_MARGIN = 1.5f;
+    // weight of the logarithmic split distribution against the uniform one
+    static constexpr float SPLIT_LAMBDA = 0.75f;
+
+    explicit ShadowCascadeBuilder(unsigned mapSize) : m_MapSize(mapSize) {
+        invalidate();
+    }
+
+    // every cascade redraws its static layer on the next build
+    void invalidate() {
+        for (Window& window : m_Windows)
+            window.valid = false;
+    }
+
+    // view is the camera's; casting is what the shadow pass draws: lit renderables, the
+    // alpha-tested quads have no depth-only path
+    void build(const Scene& scene, const glm::vec3& lightDirection, const glm::mat4& view, float fovy, float aspect,
+               float near, float shadowDistance, ShadowFrame& out) {
+        out.enabled = glm::length(lightDirection) > 1e-4f;
+        if (!out.enabled)
+            return;
+        glm::vec3 direction = glm::normalize(lightDirection);
+        if (direction != m_Direction) {
+            m_Direction = direction;
+            glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            m_LightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+            fitDepthRange(scene);
+            invalidate();
+        }
+        if (m_StaticRenderables.empty() && m_DynamicRenderables.empty())
+            splitRenderables(scene);
+
+        glm::vec3 eye(glm::inverse(view)[3]);
+        // distance of the frustum corners from the eye per unit of depth
+        float cornerScale = std::sqrt(1.0f + std::pow(std::tan(fovy * 0.5f), 2.0f) * (1.0f + aspect * aspect));
+        for (unsigned c = 0; c < ShadowFrame::CASCADES; ++c) {
+            float split = splitDepth(c + 1, near, shadowDistance);
+            float radius = split * cornerScale;
+
+            ShadowCascade& cascade = out.cascades[c];
+            cascade.splitDepth = split;
+            Window& window = m_Windows[c];
+            glm::vec2 lightCenter(m_LightView * glm::vec4(eye, 1.0f));
+            glm::vec2 offset = glm::abs(lightCenter - window.center);
+            // refit when the slice leaves the window or the window got far too big for it, after a zoom
+            bool refit = !window.valid || radius > window.halfSize ||
+                         std::max(offset.x, offset.y) > window.halfSize - radius ||
+                         radius * WINDOW_MARGIN * 2.0f < window.halfSize;
+            if (refit) {
+                window.valid = true;
+                window.halfSize = radius * WINDOW_MARGIN;
+                // snapped to texels, a refit then doesn't shift the shadow edges by a fraction of one
+                float texel = 2.0f * window.halfSize / m_MapSize;
+                window.center = glm::floor(lightCenter / texel) * texel;
+                glm::mat4 projection = glm::ortho(window.center.x - window.halfSize, window.center.x + window.halfSize,
+                                                  window.center.y - window.halfSize, window.center.y + window.halfSize,
+                                                  m_Near, m_Far);
+                window.lightSpace = projection * m_LightView;
+                window.texelSize = texel;
+            }
+            cascade.lightSpace = window.lightSpace;
+            cascade.texelSize = window.texelSize;
+            cascade.staticDirty = refit;
+
+            // casters between the light and the near plane still cast, depth clamping flattens
+            // them onto it; the far plane is past everything
+            Frustum frustum(cascade.lightSpace);
+            frustum.planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            if (refit) {
+                cascade.staticCasters.clear();
+                for (unsigned r : m_StaticRenderables) {
+                    if (frustum.intersects(scene.worldBounds[scene.renderables.entity[r]]))
+                        cascade.staticCasters.push_back(r);
+                }
+            }
+            cascade.dynamicCasters.clear();
+            for (unsigned r : m_DynamicRenderables) {
+                if (frustum.intersects(scene.worldBounds[scene.renderables.entity[r]]))
+                    cascade.dynamicCasters.push_back(r);
+            }
+        }
+    }
+
+private:
+    struct Window {
+        bool valid = false;
+        glm::vec2 center = glm::vec2(0.0f);
+        float halfSize = 0.0f;
+        float texelSize = 0.0f;
+        glm::mat4 lightSpace = glm::mat4(1.0f);
+    };
+
+    // which renderables can cast; the static flag of an entity never changes after loading
+    void splitRenderables(const Scene& scene) {
+        const Scene::Renderables& renderables = scene.renderables;
+        for (unsigned r = 0; r < renderables.size(); ++r) {
+            if (renderables.pass[r] != PASS_LIT)
+                continue;
+            if (scene.graph.isStatic(renderables.entity[r]))
+                m_StaticRenderables.push_back(r);
+            else
+                m_DynamicRenderables.push_back(r);
+        }
+    }
+
+    // the light space depth range of the whole scene, with some room for what moves around in it
+    void fitDepthRange(const Scene& scene) {
+        AABB sceneBounds;
+        for (const AABB& box : scene.worldBounds)
+            sceneBounds.expand(box);
+        float minZ = FLT_MAX, maxZ = -FLT_MAX;
+        for (int i = 0; i < 8; ++i) {
+            glm::vec3 corner(i & 1 ? sceneBounds.max.x : sceneBounds.min.x,
+                             i & 2 ? sceneBounds.max.y : sceneBounds.min.y,
+                             i & 4 ? sceneBounds.max.z : sceneBounds.min.z);
+            float z = (m_LightView * glm::vec4(corner, 1.0f)).z;
+            minZ = std::min(minZ, z);
+            maxZ = std::max(maxZ, z);
+        }
+        float margin = 0.1f * (maxZ - minZ) + 1.0f;
+        // the light looks down -z
+        m_Near = -maxZ - margin;
+        m_Far = -minZ + margin;
+    }
+
+    // practical split scheme, a blend of logarithmic and uniform splits
+    static float splitDepth(unsigned i, float near, float far) {
+        float t = (float) i / ShadowFrame::CASCADES;
+        float logarithmic = near * std::pow(far / near, t);
+        float uniform = near + (far - near) * t;
+        return SPLIT_LAMBDA * logarithmic + (1.0f - SPLIT_LAMBDA) * uniform;
+    }
+
+    unsigned m_MapSize;
+    glm::vec3 m_Direction = glm::vec3(0.0f);
+    glm::mat4 m_LightView = glm::mat4(1.0f);
+    float m_Near = 0.0f;
+    float m_Far = 1.0f;
+    Window m_Windows[ShadowFrame::CASCADES];
+    std::vector<unsigned> m_StaticRenderables;
+    std::vector<unsigned> m_DynamicRenderables;
+};
+
+// The GL side: a static and a combined depth layer per cascade in two texture arrays. The
+// static layer is only redrawn when its cascade says so. The combined layer, the one the
+// lighting samples with hardware depth comparison, is the static layer blitted over with the
+// dynamic casters drawn on top, and is left alone while neither changed, so a cascade without
+// moving casters costs nothing from frame to frame.
+class ShadowMaps {
+public:
+    explicit ShadowMaps(unsigned size) : m_Size(size) {
+        m_Static = createLayers(false);
+        m_Combined = createLayers(true);
+        glGenFramebuffers(1, &m_StaticFBO);
+        glGenFramebuffers(1, &m_CombinedFBO);
+        for (GLuint fbo : { m_StaticFBO, m_CombinedFBO }) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glState().invalidate();
+        for (unsigned c = 0; c < ShadowFrame::CASCADES; ++c)
+            m_CombinedStale[c] = true;
+    }
+
+    ~ShadowMaps() {
+        glDeleteFramebuffers(1, &m_StaticFBO);
+        glDeleteFramebuffers(1, &m_CombinedFBO);
+        glDeleteTextures(1, &m_Static);
+        glDeleteTextures(1, &m_Combined);
+    }
+
+    ShadowMaps(const ShadowMaps&) = delete;
+    ShadowMaps& operator=(const ShadowMaps&) = delete;
+
+    unsigned size() const {
+        return m_Size;
+    }
+
+    // state for the shadow passes; end() restores what the scene passes expect
+    void begin() {
+        GLStateCache& gl = glState();
+        gl.viewport(0, 0, m_Size, m_Size);
+        gl.enable(GL_DEPTH_TEST);
+        gl.enable(GL_DEPTH_CLAMP);
+        gl.enable(GL_POLYGON_OFFSET_FILL);
+        gl.disable(GL_CULL_FACE);
+        gl.depthFunc(GL_LESS);
+        gl.depthMask(true);
+        glPolygonOffset(2.0f, 4.0f);
+        m_StaticRedraws = 0;
+        m_Composites = 0;
+    }
+
+    void end() {
+        GLStateCache& gl = glState();
+        gl.disable(GL_DEPTH_CLAMP);
+        gl.disable(GL_POLYGON_OFFSET_FILL);
+    }
+
+    // true when the static casters of the cascade have to be drawn now, its layer is bound and cleared
+    bool beginStatic(unsigned cascade, bool dirty) {
+        if (!dirty)
+            return false;
+        attach(m_StaticFBO, m_Static, cascade);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        m_CombinedStale[cascade] = true;
+        ++m_StaticRedraws;
+        return true;
+    }
+
+    // true when the dynamic casters of the cascade have to be drawn now, on top of the static
+    // layer copied into the bound combined one
+    bool beginDynamic(unsigned cascade, bool hasDynamic) {
+        if (!hasDynamic && !m_CombinedStale[cascade])
+            return false;
+        attach(m_StaticFBO, m_Static, cascade);
+        attach(m_CombinedFBO, m_Combined, cascade);
+        glState().bindFramebuffer(GL_READ_FRAMEBUFFER, m_StaticFBO);
+        glBlitFramebuffer(0, 0, m_Size, m_Size, 0, 0, m_Size, m_Size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glState().bindFramebuffer(GL_FRAMEBUFFER, m_CombinedFBO);
+        // with no dynamic casters this copy is all the layer needs until something changes again
+        m_CombinedStale[cascade] = hasDynamic;
+        ++m_Composites;
+        return hasDynamic;
+    }
+
+    void bind(unsigned unit) {
+        glState().bindTexture(unit, GL_TEXTURE_2D_ARRAY, m_Combined);
+    }
+
+    // what the last begin() ... end() did
+    unsigned staticRedraws() const {
+        return m_StaticRedraws;
+    }
+
+    unsigned composites() const {
+        return m_Composites;
+    }
+
+private:
+    GLuint createLayers(bool compare) {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, m_Size, m_Size, ShadowFrame::CASCADES, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, compare ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (compare) {
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return texture;
+    }
+
+    void attach(GLuint fbo, GLuint texture, unsigned layer) {
+        glState().bindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+    }
+
+    unsigned m_Size;
+    GLuint m_Static = 0;
+    GLuint m_Combined = 0;
+    GLuint m_StaticFBO = 0;
+    GLuint m_CombinedFBO = 0;
+    bool m_CombinedStale[ShadowFrame::CASCADES];
+    unsigned m_StaticRedraws = 0;
+    unsigned m_Composites = 0;
+};
+
+}
+#endif //PROJECT_BASE_SHADOWCASCADES_H
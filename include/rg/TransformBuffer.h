@@ -0,0 +1,111 @@
+#ifndef PROJECT_BASE_TRANSFORMBUFFER_H
+#define PROJECT_BASE_TRANSFORMBUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <rg/GLStateCache.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace rg {
+
+// Per-object model and normal matrices, kept on the CPU and mirrored into a texture buffer.
+// The normal matrix (inverse transpose of the upper 3x3) is computed here once per change
+// instead of once per vertex. Each object takes 7 RGBA32F texels: 4 columns of the model
+// matrix followed by 3 columns of the normal matrix, shaders read them with texelFetch.
+class TransformBuffer {
+public:
+    static const unsigned TEXELS_PER_OBJECT = 7;
+
+    explicit TransformBuffer(unsigned capacity)
+            : m_Models(capacity, glm::mat4(1.0f)), m_Texels(capacity * TEXELS_PER_OBJECT) {
+        for (unsigned i = 0; i < capacity; ++i)
+            writeTexels(i, glm::mat3(1.0f));
+        glGenBuffers(1, &m_Buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, m_Buffer);
+        glBufferData(GL_TEXTURE_BUFFER, m_Texels.size() * sizeof(glm::vec4), &m_Texels[0], GL_DYNAMIC_DRAW);
+        glGenTextures(1, &m_Texture);
+        glBindTexture(GL_TEXTURE_BUFFER, m_Texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_Buffer);
+    }
+
+    ~TransformBuffer() {
+        glDeleteTextures(1, &m_Texture);
+        glDeleteBuffers(1, &m_Buffer);
+    }
+
+    TransformBuffer(const TransformBuffer&) = delete;
+    TransformBuffer& operator=(const TransformBuffer&) = delete;
+
+    unsigned capacity() const {
+        return (unsigned) m_Models.size();
+    }
+
+    // unchanged matrices cost a compare, changed ones are queued for the next upload()
+    void set(unsigned index, const glm::mat4& model) {
+        if (m_Models[index] == model)
+            return;
+        set(index, model, glm::transpose(glm::inverse(glm::mat3(model))));
+    }
+
+    // for callers that already keep the normal matrix, like the scene graph
+    void set(unsigned index, const glm::mat4& model, const glm::mat3& normalMatrix) {
+        write(index, model, normalMatrix);
+        markDirty(index);
+    }
+
+    // packs the texels without queueing them, so several threads can fill distinct indices;
+    // markDirty has to follow on one thread before the next upload()
+    void write(unsigned index, const glm::mat4& model, const glm::mat3& normalMatrix) {
+        m_Models[index] = model;
+        writeTexels(index, normalMatrix);
+    }
+
+    void markDirty(unsigned index) {
+        m_DirtyBegin = std::min(m_DirtyBegin, index);
+        m_DirtyEnd = std::max(m_DirtyEnd, index + 1);
+    }
+
+    const glm::mat4& model(unsigned index) const {
+        return m_Models[index];
+    }
+
+    // sends the range of objects changed since the last upload
+    void upload() {
+        if (m_DirtyBegin >= m_DirtyEnd)
+            return;
+        glBindBuffer(GL_TEXTURE_BUFFER, m_Buffer);
+        glBufferSubData(GL_TEXTURE_BUFFER,
+                        m_DirtyBegin * TEXELS_PER_OBJECT * sizeof(glm::vec4),
+                        (m_DirtyEnd - m_DirtyBegin) * TEXELS_PER_OBJECT * sizeof(glm::vec4),
+                        &m_Texels[m_DirtyBegin * TEXELS_PER_OBJECT]);
+        m_DirtyBegin = ~0u;
+        m_DirtyEnd = 0;
+    }
+
+    void bind(unsigned unit) const {
+        glState().bindTexture(unit, GL_TEXTURE_BUFFER, m_Texture);
+    }
+
+private:
+    void writeTexels(unsigned index, const glm::mat3& normalMatrix) {
+        const glm::mat4& model = m_Models[index];
+        glm::vec4* texels = &m_Texels[index * TEXELS_PER_OBJECT];
+        for (int c = 0; c < 4; ++c)
+            texels[c] = model[c];
+        for (int c = 0; c < 3; ++c)
+            texels[4 + c] = glm::vec4(normalMatrix[c], 0.0f);
+    }
+
+    std::vector<glm::mat4> m_Models;
+    std::vector<glm::vec4> m_Texels;
+    unsigned m_DirtyBegin = ~0u;
+    unsigned m_DirtyEnd = 0;
+    GLuint m_Buffer = 0;
+    GLuint m_Texture = 0;
+};
+
+}
+#endif //PROJECT_BASE_TRANSFORMBUFFER_H
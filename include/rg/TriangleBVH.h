@@ -0,0 +1,294 @@
+#ifndef PROJECT_BASE_TRIANGLEBVH_H
+#define PROJECT_BASE_TRIANGLEBVH_H
+
+#include <glm/glm.hpp>
+#include <rg/Bounds.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+namespace rg {
+
+struct RayHit {
+    float t = FLT_MAX;
+    // index of the triangle as it was added
+    unsigned triangle = 0;
+};
+
+// Static bounding volume hierarchy over triangles for ray queries, built once top-down with
+// the binned surface area heuristic. Unlike DynamicBVH it never changes after build(): the
+// triangles are reordered so every leaf is a contiguous range, and nodes are laid out depth
+// first so the left child of a node is the next one. Queries are read only and can run on
+// any number of threads at once.
+class TriangleBVH {
+public:
+    void clear() {
+        m_V0.clear();
+        m_Edge1.clear();
+        m_Edge2.clear();
+        m_Original.clear();
+        m_Nodes.clear();
+    }
+
+    void addTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        m_V0.push_back(a);
+        m_Edge1.push_back(b - a);
+        m_Edge2.push_back(c - a);
+        m_Original.push_back((unsigned) m_Original.size());
+    }
+
+    unsigned triangleCount() const {
+        return (unsigned) m_Original.size();
+    }
+
+    unsigned nodeCount() const {
+        return (unsigned) m_Nodes.size();
+    }
+
+    void build() {
+        m_Nodes.clear();
+        const unsigned count = triangleCount();
+        if (count == 0)
+            return;
+        std::vector<AABB> boxes(count);
+        std::vector<glm::vec3> centroids(count);
+        for (unsigned i = 0; i < count; ++i) {
+            boxes[i].expand(m_V0[i]);
+            boxes[i].expand(m_V0[i] + m_Edge1[i]);
+            boxes[i].expand(m_V0[i] + m_Edge2[i]);
+            centroids[i] = boxes[i].center();
+        }
+        std::vector<unsigned> order(count);
+        for (unsigned i = 0; i < count; ++i)
+            order[i] = i;
+        m_Nodes.reserve(2 * count / LEAF_SIZE + 1);
+        buildNode(boxes, centroids, order, 0, count, 0);
+
+        // triangles in leaf order
+        std::vector<glm::vec3> v0(count), edge1(count), edge2(count);
+        std::vector<unsigned> original(count);
+        for (unsigned i = 0; i < count; ++i) {
+            v0[i] = m_V0[order[i]];
+            edge1[i] = m_Edge1[order[i]];
+            edge2[i] = m_Edge2[order[i]];
+            original[i] = m_Original[order[i]];
+        }
+        m_V0.swap(v0);
+        m_Edge1.swap(edge1);
+        m_Edge2.swap(edge2);
+        m_Original.swap(original);
+    }
+
+    // closest triangle along the ray within (0, maxT)
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float maxT, RayHit& hit) const {
+        hit.t = maxT;
+        bool found = false;
+        traverse(origin, direction, hit.t, [&](unsigned triangle, float t) {
+            hit.t = t;
+            hit.triangle = m_Original[triangle];
+            found = true;
+            return false;
+        });
+        return found;
+    }
+
+    // any triangle along the ray within (0, maxT), for shadow rays
+    bool occluded(const glm::vec3& origin, const glm::vec3& direction, float maxT) const {
+        bool found = false;
+        traverse(origin, direction, maxT, [&](unsigned, float) {
+            found = true;
+            return true;
+        });
+        return found;
+    }
+
+private:
+    static const unsigned LEAF_SIZE = 4;
+    static const unsigned BINS = 12;
+    // the traversal stack holds at most one node per level
+    static const unsigned MAX_DEPTH = 64;
+    static const unsigned BALANCED_DEPTH = 40;
+    // leaves the heuristic would keep whole are split anyway above this size
+    static const unsigned MAX_LEAF_SIZE = 16;
+
+    struct Node {
+        AABB box;
+        // leaves: the first triangle and count > 0; inner nodes: the right child and count 0
+        unsigned first = 0;
+        unsigned count = 0;
+    };
+
+    unsigned buildNode(const std::vector<AABB>& boxes, const std::vector<glm::vec3>& centroids,
+                       std::vector<unsigned>& order, unsigned begin, unsigned end, unsigned depth) {
+        unsigned index = (unsigned) m_Nodes.size();
+        m_Nodes.emplace_back();
+        AABB box, centroidBox;
+        for (unsigned i = begin; i < end; ++i) {
+            box.expand(boxes[order[i]]);
+            centroidBox.expand(centroids[order[i]]);
+        }
+        m_Nodes[index].box = box;
+
+        unsigned middle = end;
+        if (end - begin > LEAF_SIZE && depth + 1 < MAX_DEPTH) {
+            // lopsided splits could nest deeper than the traversal stack, from some depth on
+            // they are halved instead
+            if (depth < BALANCED_DEPTH)
+                middle = split(boxes, centroids, centroidBox, box.surfaceArea(), order, begin, end);
+            else
+                middle = halve(centroids, centroidBox, order, begin, end);
+        }
+        if (middle == end) {
+            m_Nodes[index].first = begin;
+            m_Nodes[index].count = end - begin;
+            return index;
+        }
+        buildNode(boxes, centroids, order, begin, middle, depth + 1);
+        unsigned right = buildNode(boxes, centroids, order, middle, end, depth + 1);
+        m_Nodes[index].first = right;
+        return index;
+    }
+
+    // partitions [begin, end) at the cheapest bin boundary of the widest centroid axis; returns
+    // end when keeping a leaf is cheaper
+    unsigned split(const std::vector<AABB>& boxes, const std::vector<glm::vec3>& centroids, const AABB& centroidBox,
+                   float parentArea, std::vector<unsigned>& order, unsigned begin, unsigned end) const {
+        glm::vec3 extent = centroidBox.max - centroidBox.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        if (extent[axis] <= 0.0f) {
+            // every centroid in one spot, any split is as good as another
+            return end - begin > MAX_LEAF_SIZE ? begin + (end - begin) / 2 : end;
+        }
+        const float scale = BINS / extent[axis];
+        auto binOf = [&](unsigned triangle) {
+            return std::min(BINS - 1, (unsigned) ((centroids[triangle][axis] - centroidBox.min[axis]) * scale));
+        };
+        AABB binBoxes[BINS];
+        unsigned binCounts[BINS] = {};
+        for (unsigned i = begin; i < end; ++i) {
+            unsigned bin = binOf(order[i]);
+            binBoxes[bin].expand(boxes[order[i]]);
+            ++binCounts[bin];
+        }
+        // left to right and right to left sweeps give both sides of every boundary
+        float rightCost[BINS] = {};
+        AABB right;
+        unsigned rightCount = 0;
+        for (unsigned bin = BINS - 1; bin > 0; --bin) {
+            right.expand(binBoxes[bin]);
+            rightCount += binCounts[bin];
+            rightCost[bin] = rightCount ? right.surfaceArea() * rightCount : 0.0f;
+        }
+        float bestCost = FLT_MAX;
+        unsigned bestBin = 0;
+        AABB left;
+        unsigned leftCount = 0;
+        for (unsigned bin = 1; bin < BINS; ++bin) {
+            left.expand(binBoxes[bin - 1]);
+            leftCount += binCounts[bin - 1];
+            if (leftCount == 0 || leftCount == end - begin)
+                continue;
+            float cost = left.surfaceArea() * leftCount + rightCost[bin];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestBin = bin;
+            }
+        }
+        // traversal step and intersection cost taken as equal
+        float leafCost = parentArea * (end - begin);
+        if (bestBin == 0 || (bestCost + parentArea >= leafCost && end - begin <= MAX_LEAF_SIZE))
+            return end;
+        unsigned* middle = std::partition(order.data() + begin, order.data() + end,
+                                          [&](unsigned triangle) { return binOf(triangle) < bestBin; });
+        return (unsigned) (middle - order.data());
+    }
+
+    // median split along the widest centroid axis
+    unsigned halve(const std::vector<glm::vec3>& centroids, const AABB& centroidBox, std::vector<unsigned>& order,
+                   unsigned begin, unsigned end) const {
+        glm::vec3 extent = centroidBox.max - centroidBox.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        unsigned middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                         [&](unsigned a, unsigned b) { return centroids[a][axis] < centroids[b][axis]; });
+        return middle;
+    }
+
+    // hit(triangle, t) is called for every triangle hit closer than the current maxT, which it
+    // may have lowered; returning true ends the walk
+    template<typename Hit>
+    void traverse(const glm::vec3& origin, const glm::vec3& direction, float& maxT, Hit&& hit) const {
+        if (m_Nodes.empty())
+            return;
+        glm::vec3 invDir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        unsigned stack[MAX_DEPTH];
+        unsigned size = 0;
+        unsigned index = 0;
+        float tEnter;
+        if (!m_Nodes[0].box.intersectRay(origin, invDir, maxT, tEnter))
+            return;
+        while (true) {
+            const Node& node = m_Nodes[index];
+            if (node.count > 0) {
+                for (unsigned i = node.first; i < node.first + node.count; ++i) {
+                    float t;
+                    if (intersectTriangle(i, origin, direction, maxT, t)) {
+                        if (hit(i, t))
+                            return;
+                        maxT = t;
+                    }
+                }
+            } else {
+                // nearer child first, the farther one waits on the stack
+                unsigned left = index + 1, right = node.first;
+                float tLeft, tRight;
+                bool hitLeft = m_Nodes[left].box.intersectRay(origin, invDir, maxT, tLeft);
+                bool hitRight = m_Nodes[right].box.intersectRay(origin, invDir, maxT, tRight);
+                if (hitLeft && hitRight) {
+                    if (tRight < tLeft)
+                        std::swap(left, right);
+                    stack[size++] = right;
+                    index = left;
+                    continue;
+                }
+                if (hitLeft || hitRight) {
+                    index = hitLeft ? left : right;
+                    continue;
+                }
+            }
+            if (size == 0)
+                return;
+            index = stack[--size];
+        }
+    }
+
+    // Moller-Trumbore, both sides
+    bool intersectTriangle(unsigned i, const glm::vec3& origin, const glm::vec3& direction, float maxT, float& t) const {
+        const float EPSILON = 1e-9f;
+        glm::vec3 p = glm::cross(direction, m_Edge2[i]);
+        float det = glm::dot(m_Edge1[i], p);
+        if (std::abs(det) < EPSILON)
+            return false;
+        float invDet = 1.0f / det;
+        glm::vec3 s = origin - m_V0[i];
+        float u = glm::dot(s, p) * invDet;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, m_Edge1[i]);
+        float v = glm::dot(direction, q) * invDet;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(m_Edge2[i], q) * invDet;
+        return t > 0.0f && t < maxT;
+    }
+
+    std::vector<glm::vec3> m_V0;
+    std::vector<glm::vec3> m_Edge1;
+    std::vector<glm::vec3> m_Edge2;
+    std::vector<unsigned> m_Original;
+    std::vector<Node> m_Nodes;
+};
+
+}
+#endif //PROJECT_BASE_TRIANGLEBVH_H
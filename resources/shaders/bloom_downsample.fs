@@ -0,0 +1,46 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the level above, twice the size of the target
+uniform sampler2D source;
+// the part of source to read, below 1 when the scene rendered to part of the bright pass only
+uniform vec2 uvScale;
+
+vec2 uv;
+vec2 texel;
+
+// taps past the read part get its edge, like clamp to edge does at the texture's
+vec3 tap(vec2 offset)
+{
+    return texture(source, min(uv + texel * offset, uvScale - 0.5 * texel)).rgb;
+}
+
+// 13 bilinear taps: the 4x4 texels under the target pixel weighted 0.5 and four overlapping
+// 4x4 boxes around it 0.125 each, so a bright pixel doesn't flicker as it crosses texels of
+// the smaller grid
+void main()
+{
+    uv = TexCoords * uvScale;
+    texel = 1.0 / vec2(textureSize(source, 0));
+    vec3 a = tap(vec2(-2.0,  2.0));
+    vec3 b = tap(vec2( 0.0,  2.0));
+    vec3 c = tap(vec2( 2.0,  2.0));
+    vec3 d = tap(vec2(-2.0,  0.0));
+    vec3 e = tap(vec2( 0.0,  0.0));
+    vec3 f = tap(vec2( 2.0,  0.0));
+    vec3 g = tap(vec2(-2.0, -2.0));
+    vec3 h = tap(vec2( 0.0, -2.0));
+    vec3 i = tap(vec2( 2.0, -2.0));
+    vec3 j = tap(vec2(-1.0,  1.0));
+    vec3 k = tap(vec2( 1.0,  1.0));
+    vec3 l = tap(vec2(-1.0, -1.0));
+    vec3 m = tap(vec2( 1.0, -1.0));
+
+    vec3 result = e * 0.125;
+    result += (a + c + g + i) * 0.03125;
+    result += (b + d + f + h) * 0.0625;
+    result += (j + k + l + m) * 0.125;
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// the level below, half the size of the target and already holding everything below it
+uniform sampler2D source;
+
+// 3x3 tent over the smaller level; blending mixes it into the target's own downsampled image
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(source, 0));
+    vec3 result = texture(source, TexCoords).rgb * 4.0;
+    result += texture(source, TexCoords + texel * vec2( 0.0,  1.0)).rgb * 2.0;
+    result += texture(source, TexCoords + texel * vec2( 0.0, -1.0)).rgb * 2.0;
+    result += texture(source, TexCoords + texel * vec2( 1.0,  0.0)).rgb * 2.0;
+    result += texture(source, TexCoords + texel * vec2(-1.0,  0.0)).rgb * 2.0;
+    result += texture(source, TexCoords + texel * vec2( 1.0,  1.0)).rgb;
+    result += texture(source, TexCoords + texel * vec2(-1.0,  1.0)).rgb;
+    result += texture(source, TexCoords + texel * vec2( 1.0, -1.0)).rgb;
+    result += texture(source, TexCoords + texel * vec2(-1.0, -1.0)).rgb;
+    FragColor = vec4(result * (1.0 / 16.0), 1.0);
+}
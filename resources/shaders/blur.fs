@@ -3,24 +3,26 @@ out vec4 FragColor;
 
 in vec2 TexCoords;
 
+// one side of the kernel, see rg::BlurEngine: taps[0] is the centre, every other tap is a
+// bilinear fetch between two texels standing in for both, mirrored to the other side
 uniform sampler2D image;
-uniform bool horizontal;
-uniform float weight[5] = float[] (0.2270270270, 0.1945945946, 0.1216216216, 0.0540540541, 0.0162162162);
+uniform int taps;
+uniform float weights[MAX_TAPS];
+uniform float offsets[MAX_TAPS];
+// one texel along the blur
+uniform vec2 direction;
+// the part of image that was rendered to, see rg::DynamicResolution
+uniform vec2 uvScale;
 
 void main()
 {
-     vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel
-     vec3 result = texture(image, TexCoords).rgb * weight[0];
-     if(horizontal) {
-        for(int i = 1; i < 5; ++i) {
-            result += texture(image, TexCoords + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-            result += texture(image, TexCoords - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-        }
-     } else {
-        for(int i = 1; i < 5; ++i) {
-             result += texture(image, TexCoords + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-             result += texture(image, TexCoords - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-        }
-     }
-     FragColor = vec4(result, 1.0);
+    vec2 uv = TexCoords * uvScale;
+    // taps past the rendered part read its edge, like clamp to edge does at the texture's
+    vec2 uvMax = uvScale - 0.5 / vec2(textureSize(image, 0));
+    vec3 result = texture(image, uv).rgb * weights[0];
+    for (int i = 1; i < taps; ++i) {
+        vec2 offset = direction * offsets[i];
+        result += (texture(image, min(uv + offset, uvMax)).rgb + texture(image, uv - offset).rgb) * weights[i];
+    }
+    FragColor = vec4(result, 1.0);
 }
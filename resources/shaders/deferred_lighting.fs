@@ -0,0 +1,257 @@
+#version 330 core
+
+// lighting pass of the deferred path: shades the G-buffer written by gbuffer.fs into the
+// HDR colour and bright-pass targets, with the same lights as model_lighting.fs
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+struct PointLight {
+    vec3 position;
+
+    vec3 specular;
+    vec3 diffuse;
+    vec3 ambient;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+// the part of the G-buffer the scene was drawn to, see rg::DynamicResolution
+uniform vec2 uvScale;
+
+uniform mat4 inverseProjection;
+uniform mat4 inverseView;
+
+// compile time features: BLINN, SPOTLIGHT, SHADOWS
+uniform float shininess;
+
+// clustered point lights, see rg::LightClusterBuilder
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+
+// 4 texels per light: position and range, ambient and constant, diffuse and linear, specular and quadratic
+uniform samplerBuffer clusterLights;
+// offset into clusterIndices and light count, per cluster
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+// tiles per pixel, and slice = log(view depth) * x + y
+uniform vec2 clusterTileScale;
+uniform vec2 clusterSliceScaleBias;
+
+uniform DirLight dirLight;
+uniform SpotLight spotLight;
+
+uniform vec3 viewPosition;
+
+#ifdef SHADOWS
+// the moonlight's cascaded shadow maps, see rg::ShadowCascadeBuilder
+#define SHADOW_CASCADES 3
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeLightSpace[SHADOW_CASCADES];
+// view depth where each cascade ends
+uniform float cascadeSplits[SHADOW_CASCADES];
+// world units per shadow map texel
+uniform float cascadeTexelSizes[SHADOW_CASCADES];
+#endif
+
+// what the forward shader reads from the material textures
+vec3 albedo;
+float specularMask;
+
+PointLight FetchPointLight(int index);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow);
+#ifdef SHADOWS
+float DirShadow(vec3 fragPos, vec3 normal, float viewDepth);
+#endif
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+
+void main()
+{
+    vec2 uv = TexCoords * uvScale;
+    float depth = texture(gDepth, uv).r;
+    // the skybox fills what no geometry covered
+    if (depth == 1.0)
+        discard;
+    vec4 viewPos = inverseProjection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    viewPos /= viewPos.w;
+    vec3 fragPos = vec3(inverseView * viewPos);
+    vec4 albedoSpec = texture(gAlbedoSpec, uv);
+    albedo = albedoSpec.rgb;
+    specularMask = albedoSpec.a;
+
+    vec3 normal = texture(gNormal, uv).xyz;
+    vec3 viewDir = normalize(viewPosition - fragPos);
+    float shadow = 1.0;
+#ifdef SHADOWS
+    shadow = DirShadow(fragPos, normal, -viewPos.z);
+#endif
+    vec3 result = CalcDirLight(dirLight, normal, viewDir, shadow);
+
+    ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterTileScale), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    int slice = clamp(int(log(-viewPos.z) * clusterSliceScaleBias.x + clusterSliceScaleBias.y), 0, CLUSTER_SLICES - 1);
+    uvec2 range = texelFetch(clusterRanges, (slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x).xy;
+    for (uint i = 0u; i < range.y; ++i) {
+        int light = int(texelFetch(clusterIndices, int(range.x + i)).r);
+        result += CalcPointLight(FetchPointLight(light), normal, fragPos, viewDir);
+    }
+#ifdef SPOTLIGHT
+    result += CalcSpotLight(spotLight, normal, fragPos, viewDir);
+#endif
+
+    float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
+    if(brightness > 1.0)
+        BrightColor = vec4(result, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+
+    FragColor = vec4(result, 1.0);
+}
+
+PointLight FetchPointLight(int index)
+{
+    int base = index * 4;
+    vec4 positionRange = texelFetch(clusterLights, base);
+    vec4 ambientConstant = texelFetch(clusterLights, base + 1);
+    vec4 diffuseLinear = texelFetch(clusterLights, base + 2);
+    vec4 specularQuadratic = texelFetch(clusterLights, base + 3);
+    PointLight light;
+    light.position = positionRange.xyz;
+    light.ambient = ambientConstant.rgb;
+    light.constant = ambientConstant.a;
+    light.diffuse = diffuseLinear.rgb;
+    light.linear = diffuseLinear.a;
+    light.specular = specularQuadratic.rgb;
+    light.quadratic = specularQuadratic.a;
+    return light;
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+#ifdef BLINN
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+#else
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+#endif
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * vec3(specularMask);
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+#ifdef BLINN
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+#else
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+#endif
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * vec3(specularMask);
+    // ambient isn't blocked
+    return (ambient + shadow * (diffuse + specular));
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+#ifdef BLINN
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+#else
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+#endif
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * vec3(specularMask);
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+    return (ambient + diffuse + specular);
+}
+
+#ifdef SHADOWS
+// how much of the moonlight reaches the fragment, 2x2 taps of hardware filtered comparisons
+float DirShadow(vec3 fragPos, vec3 normal, float viewDepth)
+{
+    if (viewDepth > cascadeSplits[SHADOW_CASCADES - 1])
+        return 1.0;
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADES - 1 && viewDepth > cascadeSplits[cascade])
+        ++cascade;
+    // looked up a bit off the surface against acne where the light grazes it
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec3 coords = vec3(cascadeLightSpace[cascade] * vec4(offsetPos, 1.0)) * 0.5 + 0.5;
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    lit += texture(shadowMap, vec4(coords.xy + vec2(-0.5, -0.5) * texel, float(cascade), coords.z));
+    lit += texture(shadowMap, vec4(coords.xy + vec2( 0.5, -0.5) * texel, float(cascade), coords.z));
+    lit += texture(shadowMap, vec4(coords.xy + vec2(-0.5,  0.5) * texel, float(cascade), coords.z));
+    lit += texture(shadowMap, vec4(coords.xy + vec2( 0.5,  0.5) * texel, float(cascade), coords.z));
+    return lit * 0.25;
+}
+#endif
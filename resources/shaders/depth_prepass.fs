@@ -0,0 +1,6 @@
+#version 330 core
+
+// depth only, colour writes are masked off
+void main()
+{
+}
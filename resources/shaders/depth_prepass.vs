@@ -0,0 +1,21 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform samplerBuffer transforms;
+uniform int objectIndex;
+uniform mat4 view;
+uniform mat4 projection;
+
+// must produce bit-identical depth to model_lighting.vs, the lighting pass tests with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+    int base = objectIndex * 7;
+    mat4 model = mat4(texelFetch(transforms, base),
+                      texelFetch(transforms, base + 1),
+                      texelFetch(transforms, base + 2),
+                      texelFetch(transforms, base + 3));
+    vec3 fragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(fragPos, 1.0);
+}
@@ -5,12 +5,18 @@ layout (location = 1) in vec2 aTexCoords;
 
 out vec2 TexCoords;
 
-uniform mat4 model;
+uniform samplerBuffer transforms;
+uniform int objectIndex;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main ()
 {
+    int base = objectIndex * 7;
+    mat4 model = mat4(texelFetch(transforms, base),
+                      texelFetch(transforms, base + 1),
+                      texelFetch(transforms, base + 2),
+                      texelFetch(transforms, base + 3));
     TexCoords = aTexCoords;
     gl_Position = projection * view * model * vec4(aPos, 1.0f);
-}
\ No newline at end of file
+}
@@ -5,73 +5,55 @@ in vec2 TexCoords;
 
 uniform sampler2D scene;
 uniform sampler2D bloomBlur;
+// the part of scene that was rendered to, stretched over the window; bloom covers all of its texture
+uniform vec2 uvScale;
 
-uniform int effect;
 uniform float gamma;
-uniform bool hdr;
-uniform bool bloom;
 uniform float exposure;
 
-const float offset = 1.0 / 300.0;
-vec3 col = vec3(0.0);
-vec3 sampleTex[9];
-
-vec2 offsets[9] = vec2[](
-    vec2(-offset,  offset), // top-left
-    vec2( 0.0f,    offset), // top-center
-    vec2( offset,  offset), // top-right
-    vec2(-offset,  0.0f),   // center-left
-    vec2( 0.0f,    0.0f),   // center-center
-    vec2( offset,  0.0f),   // center-right
-    vec2(-offset, -offset), // bottom-left
-    vec2( 0.0f,   -offset), // bottom-center
-    vec2( offset, -offset)  // bottom-right
-);
+// The stages of the post chain; rg::PostChain defines PER_TAP and PER_PIXEL as calls of the
+// pointwise ones in the chain's order, and NEIGHBOURHOOD as the weights of the 3x3 stage if
+// the chain has one. uv is the position on the window, from 0 to 1.
+vec3 grayscale(vec3 color, vec2 uv)
+{
+    return vec3(dot(color, vec3(0.2126, 0.7152, 0.0722)));
+}
 
-float blurKernel[9] = float[](
-    1.0 / 16, 2.0 / 16, 1.0 / 16,
-    2.0 / 16, 4.0 / 16, 2.0 / 16,
-    1.0 / 16, 2.0 / 16, 1.0 / 16
-);
+vec3 addBloom(vec3 color, vec2 uv)
+{
+    return color + texture(bloomBlur, uv).rgb;
+}
 
-float edgeDetectionKernel[9] = float[](
-    1.0, 1.0, 1.0,
-    1.0, -8.0, 1.0,
-    1.0, 1.0, 1.0
-);
+vec3 toneMap(vec3 color, vec2 uv)
+{
+    // edge detection before it leaves negative values, which pow() would turn into NaN
+    vec3 mapped = vec3(1.0) - exp(-max(color, 0.0) * exposure);
+    return pow(mapped, vec3(1.0 / gamma));
+}
 
-void main ()
+float edgeDetection(int x, int y)
 {
-//     const float gamma = 2.2;
-    vec3 bloomColor = texture(bloomBlur, TexCoords).rgb;
-    vec3 hdrColor = texture(scene, TexCoords).rgb;
+    return x == 0 && y == 0 ? -8.0 : 1.0;
+}
 
-    if (effect == 0) {
-        for(int i = 0; i < 9; i++)
-            sampleTex[i] = vec3(texture(scene, TexCoords.st + offsets[i]));
-            col = vec3(0.0);
-                for(int i = 0; i < 9; i++)
-                    col += sampleTex[i] * blurKernel[i];
-        FragColor = vec4(col, 1.0);
-    } else if (effect == 1) {
-        FragColor = texture(scene, TexCoords);
-        float average = 0.2126 * FragColor.r + 0.7152 * FragColor.g + 0.0722 * FragColor.b;
-        FragColor = vec4(average, average, average, 1.0);
-    } else if (effect == 2) {
-        for(int i = 0; i < 9; i++)
-            sampleTex[i] = vec3(texture(scene, TexCoords.st + offsets[i]));
-            col = vec3(0.0);
-                for(int i = 0; i < 9; i++)
-                    col += sampleTex[i] * edgeDetectionKernel[i];
-        FragColor = vec4(col, 1.0);
-    } else if (effect == 3) {
-        if (hdr) {
-            if (bloom)
-                hdrColor += bloomColor;
-            vec3 result = vec3(1.0) - exp(-hdrColor * exposure);
-            FragColor = vec4(pow(result, vec3(1.0 / gamma)), 1.0);
-        } else {
-            FragColor = vec4(hdrColor, 1.0);
+void main()
+{
+    vec2 uv = TexCoords * uvScale;
+#ifdef NEIGHBOURHOOD
+    // each texel of the 3x3 block is fetched once, the stages before the kernel run on it there
+    vec2 texel = 1.0 / vec2(textureSize(scene, 0));
+    // taps past the rendered part read its edge, like clamp to edge does at the texture's
+    vec2 uvMax = uvScale - 0.5 * texel;
+    vec3 color = vec3(0.0);
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            vec2 offset = vec2(x, y) * texel;
+            vec3 tap = texture(scene, min(uv + offset, uvMax)).rgb;
+            color += PER_TAP(tap, TexCoords + offset / uvScale) * NEIGHBOURHOOD(x, y);
         }
     }
-}
\ No newline at end of file
+#else
+    vec3 color = PER_TAP(texture(scene, uv).rgb, TexCoords);
+#endif
+    FragColor = vec4(PER_PIXEL(color, TexCoords), 1.0);
+}
@@ -48,30 +48,133 @@ struct Material {
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
+in float ViewDepth;
 
-uniform bool blinn;
+// compile time features: BLINN, SPOTLIGHT, SHADOWS, OBJECT_LIGHT_LISTS, LIGHTMAP
 
-#define NR_POINT_LIGHTS 6
+// clustered point lights, see rg::LightClusterBuilder
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+
+// 4 texels per light: position and range, ambient and constant, diffuse and linear, specular and quadratic
+uniform samplerBuffer clusterLights;
+// offset into clusterIndices and light count, per cluster, then per object
+uniform usamplerBuffer clusterRanges;
+uniform usamplerBuffer clusterIndices;
+// tiles per pixel, and slice = log(ViewDepth) * x + y
+uniform vec2 clusterTileScale;
+uniform vec2 clusterSliceScaleBias;
+// with OBJECT_LIGHT_LISTS, one light list for the whole object instead of the fragment's cluster
+uniform int objectIndex;
 
 uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform SpotLight spotLight;
 uniform Material material;
 
 uniform vec3 viewPosition;
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+#ifdef SHADOWS
+// the moonlight's cascaded shadow maps, see rg::ShadowCascadeBuilder
+#define SHADOW_CASCADES 3
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeLightSpace[SHADOW_CASCADES];
+// view depth where each cascade ends
+uniform float cascadeSplits[SHADOW_CASCADES];
+// world units per shadow map texel
+uniform float cascadeTexelSizes[SHADOW_CASCADES];
+#endif
+
+#ifdef LIGHTMAP
+// baked ambient and diffuse light of the moonlight and the static point lights, see rg::LightmapBaker
+in vec2 LightmapCoords;
+uniform sampler2D lightmap;
+uniform vec4 lightmapScaleOffset;
+// bit i set: the lightmap holds point light i
+uniform uint bakedPointLights;
+#endif
+
+// Everything the lights need from the fragment, with the material sampled once up front:
+// the light functions below only add what reaches the surface, and the albedo and specular
+// map are applied to the sums after the loop.
+struct Surface {
+    vec3 position;
+    vec3 normal;
+    vec3 viewDir;
+    vec3 albedo;
+    vec3 specular;
+};
+
+// light reaching the surface, before the material; the albedo scales diffuse (ambient
+// included) and the specular map scales specular. Point lights take their specular from the
+// map's red channel alone, as the deferred path stores it, so they sum apart.
+struct LightSum {
+    vec3 diffuse;
+    vec3 specular;
+    vec3 pointSpecular;
+};
+
+PointLight FetchPointLight(int index);
+float SpecularFactor(Surface surface, vec3 lightDir);
+// diffuseWeight scales the ambient and diffuse terms, 0 where the lightmap has them already
+void AddPointLight(PointLight light, Surface surface, float diffuseWeight, inout LightSum sum);
+void AddDirLight(DirLight light, Surface surface, float shadow, float diffuseWeight, inout LightSum sum);
+#ifdef SHADOWS
+float DirShadow(vec3 fragPos, vec3 normal, float viewDepth);
+#endif
+void AddSpotLight(SpotLight light, Surface surface, inout LightSum sum);
 
 void main()
 {
-    vec3 normal = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
-    vec3 result = CalcDirLight(dirLight, normal, viewDir);
-    for (int i = 0; i < NR_POINT_LIGHTS; ++i)
-        result += CalcPointLight(pointLights[i], normal, FragPos, viewDir);
-    result += CalcSpotLight(spotLight, normal, FragPos, viewDir);
+    Surface surface;
+    surface.position = FragPos;
+    surface.normal = normalize(Normal);
+    surface.viewDir = normalize(viewPosition - FragPos);
+    surface.albedo = texture(material.texture_diffuse1, TexCoords).rgb;
+    surface.specular = texture(material.texture_specular1, TexCoords).rgb;
+    LightSum sum = LightSum(vec3(0.0), vec3(0.0), vec3(0.0));
+
+    float shadow = 1.0;
+#ifdef SHADOWS
+    shadow = DirShadow(surface.position, surface.normal, ViewDepth);
+#endif
+    // objects outside the lightmap are lit like without it; the baked lights keep their specular
+    bool lightmapped = false;
+#ifdef LIGHTMAP
+    lightmapped = lightmapScaleOffset.x > 0.0;
+    if (lightmapped)
+        sum.diffuse += texture(lightmap, LightmapCoords).rgb;
+#endif
+    AddDirLight(dirLight, surface, shadow, lightmapped ? 0.0 : 1.0, sum);
+
+#ifdef OBJECT_LIGHT_LISTS
+    int list = CLUSTER_COUNT + objectIndex;
+#else
+    ivec2 tile = min(ivec2(gl_FragCoord.xy * clusterTileScale), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+    int slice = clamp(int(log(ViewDepth) * clusterSliceScaleBias.x + clusterSliceScaleBias.y), 0, CLUSTER_SLICES - 1);
+    int list = (slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x;
+#endif
+    uvec2 range = texelFetch(clusterRanges, list).xy;
+#ifdef LIGHTMAP
+    // lights the lightmap holds for this fragment, with the bit of a light tested in the loop
+    uint baked = lightmapped ? bakedPointLights : 0u;
+#endif
+    for (uint i = range.x; i < range.x + range.y; ++i) {
+        int light = int(texelFetch(clusterIndices, int(i)).r);
+        float diffuseWeight = 1.0;
+#ifdef LIGHTMAP
+        if (light < 32 && (baked & (1u << uint(light))) != 0u)
+            diffuseWeight = 0.0;
+#endif
+        AddPointLight(FetchPointLight(light), surface, diffuseWeight, sum);
+    }
+#ifdef SPOTLIGHT
+    AddSpotLight(spotLight, surface, sum);
+#endif
+
+    vec3 result = sum.diffuse * surface.albedo + sum.specular * surface.specular +
+                  sum.pointSpecular * surface.specular.r;
 
     float brightness = dot(result, vec3(0.2126, 0.7152, 0.0722));
     if(brightness > 1.0)
@@ -82,82 +185,94 @@ void main()
     FragColor = vec4(result, 1.0);
 }
 
-// calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+PointLight FetchPointLight(int index)
 {
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = 0.0;
-    if (blinn) {
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    } else {
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
-    // attenuation
-    float distance = length(light.position - fragPos);
+    int base = index * 4;
+    vec4 positionRange = texelFetch(clusterLights, base);
+    vec4 ambientConstant = texelFetch(clusterLights, base + 1);
+    vec4 diffuseLinear = texelFetch(clusterLights, base + 2);
+    vec4 specularQuadratic = texelFetch(clusterLights, base + 3);
+    PointLight light;
+    light.position = positionRange.xyz;
+    light.ambient = ambientConstant.rgb;
+    light.constant = ambientConstant.a;
+    light.diffuse = diffuseLinear.rgb;
+    light.linear = diffuseLinear.a;
+    light.specular = specularQuadratic.rgb;
+    light.quadratic = specularQuadratic.a;
+    return light;
+}
+
+// the specular highlight of a light from lightDir, before its color
+float SpecularFactor(Surface surface, vec3 lightDir)
+{
+#ifdef BLINN
+    vec3 halfwayDir = normalize(lightDir + surface.viewDir);
+    return pow(max(dot(surface.normal, halfwayDir), 0.0), material.shininess);
+#else
+    vec3 reflectDir = reflect(-lightDir, surface.normal);
+    return pow(max(dot(surface.viewDir, reflectDir), 0.0), material.shininess);
+#endif
+}
+
+void AddPointLight(PointLight light, Surface surface, float diffuseWeight, inout LightSum sum)
+{
+    // one length for both the direction and the attenuation
+    vec3 toLight = light.position - surface.position;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = SpecularFactor(surface, lightDir);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
+    sum.diffuse += (attenuation * diffuseWeight) * (light.ambient + diff * light.diffuse);
+    sum.pointSpecular += (attenuation * spec) * light.specular;
 }
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+void AddDirLight(DirLight light, Surface surface, float shadow, float diffuseWeight, inout LightSum sum)
 {
     vec3 lightDir = normalize(-light.direction);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = 0.0;
-    if (blinn) {
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    } else {
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    return (ambient + diffuse + specular);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = SpecularFactor(surface, lightDir);
+    // ambient isn't blocked
+    sum.diffuse += diffuseWeight * (light.ambient + (shadow * diff) * light.diffuse);
+    sum.specular += (shadow * spec) * light.specular;
 }
 
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+void AddSpotLight(SpotLight light, Surface surface, inout LightSum sum)
 {
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = 0.0;
-    if (blinn) {
-        vec3 halfwayDir = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    } else {
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
-    // attenuation
-    float distance = length(light.position - fragPos);
+    vec3 toLight = light.position - surface.position;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = SpecularFactor(surface, lightDir);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
     // spotlight intensity
     float theta = dot(lightDir, normalize(-light.direction));
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords));
-    ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
+    float scale = attenuation * intensity;
+    sum.diffuse += scale * (light.ambient + diff * light.diffuse);
+    sum.specular += (scale * spec) * light.specular;
+}
+
+#ifdef SHADOWS
+// how much of the moonlight reaches the fragment, 2x2 taps of hardware filtered comparisons
+float DirShadow(vec3 fragPos, vec3 normal, float viewDepth)
+{
+    if (viewDepth > cascadeSplits[SHADOW_CASCADES - 1])
+        return 1.0;
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADES - 1 && viewDepth > cascadeSplits[cascade])
+        ++cascade;
+    // looked up a bit off the surface against acne where the light grazes it
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec3 coords = vec3(cascadeLightSpace[cascade] * vec4(offsetPos, 1.0)) * 0.5 + 0.5;
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    lit += texture(shadowMap, vec4(coords.xy + vec2(-0.5, -0.5) * texel, float(cascade), coords.z));
+    lit += texture(shadowMap, vec4(coords.xy + vec2( 0.5, -0.5) * texel, float(cascade), coords.z));
+    lit += texture(shadowMap, vec4(coords.xy + vec2(-0.5,  0.5) * texel, float(cascade), coords.z));
+    lit += texture(shadowMap, vec4(coords.xy + vec2( 0.5,  0.5) * texel, float(cascade), coords.z));
+    return lit * 0.25;
 }
+#endif
@@ -2,19 +2,47 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef LIGHTMAP
+layout (location = 5) in vec2 aLightmapCoords;
+#endif
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+// positive distance along the view direction, picks the light cluster
+out float ViewDepth;
+#ifdef LIGHTMAP
+out vec2 LightmapCoords;
 
-uniform mat4 model;
+// the object's rectangle of the lightmap, see rg::LightmapAtlas; zero scale outside it
+uniform vec4 lightmapScaleOffset;
+#endif
+
+// per-object model matrix (4 texels) and precomputed normal matrix (3 texels), see rg::TransformBuffer
+uniform samplerBuffer transforms;
+uniform int objectIndex;
 uniform mat4 view;
 uniform mat4 projection;
 
+// the depth pre-pass computes the same position, both have to agree exactly
+invariant gl_Position;
+
 void main()
 {
+    int base = objectIndex * 7;
+    mat4 model = mat4(texelFetch(transforms, base),
+                      texelFetch(transforms, base + 1),
+                      texelFetch(transforms, base + 2),
+                      texelFetch(transforms, base + 3));
+    mat3 normalMatrix = mat3(texelFetch(transforms, base + 4).xyz,
+                             texelFetch(transforms, base + 5).xyz,
+                             texelFetch(transforms, base + 6).xyz);
     FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    ViewDepth = -(view * vec4(FragPos, 1.0)).z;
+    Normal = normalMatrix * aNormal;
     TexCoords = aTexCoords;    
+#ifdef LIGHTMAP
+    LightmapCoords = aLightmapCoords * lightmapScaleOffset.xy + lightmapScaleOffset.zw;
+#endif
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,6 @@
+#version 330 core
+
+// colour writes are masked off, the query only counts samples that pass the depth test
+void main()
+{
+}
@@ -0,0 +1,12 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 projectionView;
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+
+void main()
+{
+    // unit cube corners stretched over the world space bounding box
+    gl_Position = projectionView * vec4(mix(boxMin, boxMax, aPos), 1.0);
+}
@@ -14,7 +14,33 @@
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
 
+#include <rg/BloomPyramid.h>
+#include <rg/BlurEngine.h>
+#include <rg/Bounds.h>
+#include <rg/DynamicResolution.h>
+#include <rg/BVH.h>
+#include <rg/FrameQueue.h>
+#include <rg/GLStateCache.h>
+#include <rg/GpuTimer.h>
+#include <rg/JobSystem.h>
+#include <rg/LightClusters.h>
+#include <rg/Lightmap.h>
+#include <rg/OcclusionCuller.h>
+#include <rg/PostChain.h>
+#include <rg/ProgramCache.h>
+#include <rg/RenderGraph.h>
+#include <rg/RenderList.h>
+#include <rg/Scene.h>
+#include <rg/SceneFile.h>
+#include <rg/ShadowCascades.h>
+#include <rg/ShaderPermutations.h>
+#include <rg/TransformBuffer.h>
+
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
@@ -23,12 +49,34 @@ void processInput(GLFWwindow *window);
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
-unsigned int loadCubemap(vector<std::string> faces);
-unsigned int loadTexture(const char* path, bool gammaCorrection);
+unsigned int loadCubemap(const std::vector<rg::Image>& faces);
+unsigned int loadTexture(const rg::Image& image, bool gammaCorrection);
 
 // settings
 const unsigned int SCR_WIDTH = 1000;
 const unsigned int SCR_HEIGHT = 650;
+// above the units Mesh::Draw uses for material textures
+const unsigned int TRANSFORM_BUFFER_UNIT = 8;
+const unsigned int CLUSTER_LIGHTS_UNIT = 9;
+const unsigned int CLUSTER_RANGES_UNIT = 10;
+const unsigned int CLUSTER_INDICES_UNIT = 11;
+const unsigned int SHADOW_MAP_UNIT = 12;
+const unsigned int LIGHTMAP_UNIT = 13;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+// the moonlight casts shadows up to this far from the camera
+const float SHADOW_DISTANCE = 60.0f;
+const unsigned int SHADOW_MAP_SIZE = 2048;
+// baked lighting of the static geometry, the density drops if the scene doesn't fit the atlas
+const unsigned int LIGHTMAP_SIZE = 1024;
+const float LIGHTMAP_TEXELS_PER_UNIT = 4.0f;
+const char* const LIGHTMAP_PATH = "resources/scenes/temple.lightmap";
+// shader feature bits, in the order the permutation sets list them
+const unsigned int BLINN_FEATURE = 1u << 0;
+const unsigned int SPOTLIGHT_FEATURE = 1u << 1;
+const unsigned int SHADOWS_FEATURE = 1u << 2;
+const unsigned int OBJECT_LIGHT_LISTS_FEATURE = 1u << 3;
+const unsigned int LIGHTMAP_FEATURE = 1u << 4;
 
 // camera
 
@@ -36,6 +84,10 @@ float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
+// size of the default framebuffer, kept by the callback on the main thread and passed on in the frame packets
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
@@ -57,10 +109,73 @@ struct ProgramState {
     bool CameraMouseMovementUpdateEnabled = true;
     bool hdr = false;
     bool bloom = false;
+    // how much of the wider bloom levels each level mixes in, see rg::BloomPyramid
+    float bloomScatter = 0.7f;
+    float bloomPassMs = 0.0f;
     float exposure = 0.197f;
     float gamma = 2.2f;
     int kernelEffects = 3;
+    // grayscale and edge detection run on the tone mapped image instead of the HDR one
+    bool effectAfterToneMap = false;
+    // the blur effect, see rg::BlurEngine
+    int blurRadius = 4;
+    bool computeBlur = false;
+    bool blurComputeSupported = false;
+    // set by the UI, the render thread runs it with the next packet
+    bool blurBenchmark = false;
+    std::vector<rg::BlurTiming> blurTimings;
     DirLight dirLight;
+    bool frustumCulling = true;
+    rg::CullStats meshCulling;
+    rg::CullStats objectCulling;
+    int pickedObject = -1;
+    bool occlusionCulling = true;
+    unsigned occludedObjects = 0;
+    float objectPassMs = 0.0f;
+    // object pass time measured while occlusion culling was off, the baseline for the savings estimate
+    float objectPassMsWithoutOcclusion = 0.0f;
+    bool depthPrepass = false;
+    float depthPassMs = 0.0f;
+    bool deferredShading = false;
+    float minPixelRadius = 1.0f;
+    unsigned tooSmallObjects = 0;
+    float frameJobsMs = 0.0f;
+    // packets in flight between the main and the render thread, see rg::FrameQueue
+    int frameQueueDepth = 2;
+    float renderThreadMs = 0.0f;
+    // the scene renders at renderScale of the window, picked by rg::DynamicResolution to keep
+    // the GPU frame time at gpuBudgetMs when dynamicResolution is on
+    bool dynamicResolution = false;
+    float gpuBudgetMs = 16.6f;
+    float renderScale = 1.0f;
+    float gpuFrameMs = 0.0f;
+    rg::GLStateCache::FrameStats glStats;
+    rg::RenderGraph::Stats renderGraph;
+    bool lightBenchmark = false;
+    int benchmarkLights = 256;
+    unsigned pointLightCount = 0;
+    unsigned maxLightsPerCluster = 0;
+    float lightClustersMs = 0.0f;
+    bool objectLightLists = false;
+    unsigned maxLightsPerObject = 0;
+    float objectLightListsMs = 0.0f;
+    bool shadows = true;
+    // keep the static casters in cached shadow layers; off redraws everything every frame
+    bool shadowCaching = true;
+    float shadowPassMs = 0.0f;
+    unsigned shadowStaticRedraws = 0;
+    // baked moonlight and static point lights on the static geometry
+    bool lightmap = true;
+    rg::LightmapSettings lightmapSettings;
+    // set by the UI, the main loop starts a background bake unless one is running
+    bool bakeLightmap = false;
+    bool lightmapBaking = false;
+    // the moonlight was changed after the bake, the lightmap is ignored until the next one
+    bool lightmapStale = false;
+    unsigned lightmapSamples = 0;
+    float lightmapBakeMs = 0.0f;
+    // rays traced per second by the last bake of this run, 0 when the lightmap came from disk
+    float lightmapRaysPerSecond = 0.0f;
     ProgramState()
             : camera(glm::vec3(-10.36f, -2.63f, 36.34f)) {}
 
@@ -113,11 +228,143 @@ void ProgramState::LoadFromFile(std::string filename) {
 
 ProgramState *programState;
 
-void DrawImGui(ProgramState *programState);
-void setNightLights(Shader& shader, float currentFrame);
+// an entity that moved: its matrices for the transform buffer and the box its occlusion query draws
+struct EntityTransform {
+    unsigned int entity;
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+    rg::AABB bounds;
+};
+
+// ImGui's draw data points into its context, which the next ImGui::NewFrame() rewrites, so the
+// render thread gets its own copy of the command lists. The copies are made and freed on the
+// main thread, capture() drops the ones of the recycled packet it is called on.
+struct UiDrawData {
+    ImDrawData data;
+    std::vector<ImDrawList*> lists;
+
+    UiDrawData() = default;
+    UiDrawData(const UiDrawData&) = delete;
+    UiDrawData& operator=(const UiDrawData&) = delete;
+
+    ~UiDrawData() {
+        clear();
+    }
+
+    void capture(const ImDrawData* source) {
+        clear();
+        if (!source || !source->Valid)
+            return;
+        data = *source;
+        for (int i = 0; i < source->CmdListsCount; ++i)
+            lists.push_back(source->CmdLists[i]->CloneOutput());
+        data.CmdLists = lists.data();
+    }
+
+    void clear() {
+        for (ImDrawList* list : lists)
+            IM_DELETE(list);
+        lists.clear();
+        data.Clear();
+    }
+};
+
+// One frame as the main thread simulated it, everything the render thread needs to submit it.
+// It isn't touched by the main thread again until the render thread recycles it. The scene's
+// renderable table and the models it points to don't change after loading and are read directly.
+struct FramePacket {
+    unsigned int frame = 0;
+    int framebufferWidth = 0;
+    int framebufferHeight = 0;
+    // the corner of the screen-sized targets the scene renders to, see rg::DynamicResolution
+    int renderWidth = 0;
+    int renderHeight = 0;
+    // camera
+    glm::mat4 view = glm::mat4(1.0f);
+    glm::mat4 projection = glm::mat4(1.0f);
+    rg::Frustum frustum = rg::Frustum::infinite();
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    glm::vec3 cameraFront = glm::vec3(0.0f);
+    bool cameraJumped = false;
+    // entities that moved since the previous packet, all of them in the first one
+    std::vector<EntityTransform> transforms;
+    rg::RenderList renderList;
+    // lights
+    DirLight dirLight;
+    std::vector<rg::PointLight> pointLights;
+    rg::LightClusters lightClusters;
+    // forward shading takes the lights from per-object lists instead of the clusters
+    bool objectLightLists = false;
+    bool spotlight = true;
+    bool blinn = true;
+    rg::ShadowFrame shadows;
+    // null when the frame is lit without the lightmap; a new bake comes as a new image
+    std::shared_ptr<const rg::LightmapImage> lightmap;
+    // render and post settings
+    bool depthPrepass = false;
+    bool deferredShading = false;
+    bool occlusionCulling = true;
+    float bloomScatter = 0.0f;
+    float exposure = 0.0f;
+    float gamma = 0.0f;
+    int kernelEffects = 0;
+    // what the screen pass does to the scene, in order, see rg::PostChain
+    std::vector<rg::PostStage> postStages;
+    int blurRadius = 0;
+    bool computeBlur = false;
+    bool blurBenchmark = false;
+    UiDrawData ui;
+};
+
+// what the render thread measured, picked up by the main thread at the start of its next frame
+struct RenderFeedback {
+    std::mutex mutex;
+    // the packet the occlusion answers below were read for
+    unsigned int frame = 0;
+    std::vector<unsigned char> occluded;
+    rg::GLStateCache::FrameStats gl;
+    rg::CullStats meshCulling;
+    float depthPassMs = 0.0f;
+    float objectPassMs = 0.0f;
+    float objectPassMsWithoutOcclusion = 0.0f;
+    float shadowPassMs = 0.0f;
+    float bloomPassMs = 0.0f;
+    // everything the GPU did for the packet, smoothed for display
+    float gpuFrameMs = 0.0f;
+    // the newest unsmoothed reading and the packet it measured, for rg::DynamicResolution
+    float gpuFrameSampleMs = 0.0f;
+    unsigned int gpuFrameSampleOf = 0;
+    bool blurComputeSupported = false;
+    // the last blur benchmark, empty until one ran
+    std::vector<rg::BlurTiming> blurTimings;
+    rg::RenderGraph::Stats renderGraph;
+    // static shadow layers drawn since the start
+    unsigned int shadowStaticRedraws = 0;
+    float submitMs = 0.0f;
+};
+
+void DrawImGui(ProgramState *programState, const rg::Scene& scene);
+void setNightLights(Shader& shader, const FramePacket& frame);
+void buildPostChain(const ProgramState& state, std::vector<rg::PostStage>& stages);
+void addBenchmarkLights(std::vector<rg::PointLight>& lights, unsigned int count, float time);
+void printBlurTimings(const std::vector<rg::BlurTiming>& timings);
+rg::JobHandle scheduleLightmapBake(rg::JobSystem& jobs, rg::LightmapBaker& baker, const rg::Scene& scene,
+                                   const rg::LightmapAtlas& atlas, const DirLight& dirLight,
+                                   std::shared_ptr<const rg::LightmapImage>& result);
+void reportLightmapBake(const rg::LightmapBaker& baker);
 void renderQuad();
 
 int main() {
+    // the scene file is plain data, its models and textures start decoding before there is a window
+    rg::JobSystem jobs;
+    rg::SceneFile sceneFile;
+    if (!sceneFile.load("resources/scenes/temple.scene")) {
+        std::cout << "Failed to load the scene" << std::endl;
+        return -1;
+    }
+    rg::SceneAssets sceneAssets(sceneFile, jobs);
+    const rg::SceneFileHeader& sceneSettings = sceneFile.header();
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
@@ -139,6 +386,7 @@ int main() {
         return -1;
     }
     glfwMakeContextCurrent(window);
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
@@ -157,6 +405,11 @@ int main() {
 //    stbi_set_flip_vertically_on_load(true);
 
     programState = new ProgramState;
+    programState->hdr = sceneSettings.hdr;
+    programState->bloom = sceneSettings.bloom;
+    programState->exposure = sceneSettings.exposure;
+    programState->gamma = sceneSettings.gamma;
+    programState->kernelEffects = sceneSettings.kernelEffect;
     programState->LoadFromFile("resources/program_state.txt");
     if (programState->ImGuiEnabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
@@ -169,32 +422,92 @@ int main() {
 
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330 core");
+    // the backend would create its objects in the first ImGui_ImplOpenGL3_NewFrame(), but frames
+    // are built on this thread and drawn on the render thread; the font atlas needs its texture
+    // id before the first frame is built
+    ImGui_ImplOpenGL3_CreateDeviceObjects();
 
     // configure global opengl state
     // -----------------------------
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_MULTISAMPLE);
+    rg::glState().enable(GL_DEPTH_TEST);
+    rg::glState().enable(GL_MULTISAMPLE);
 
     // build and compile shaders
     // -------------------------
-    Shader objectShader("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs");
+    // linked programs are kept on disk between runs when the driver supports program binaries
+    if (!rg::programCache().init((GLADloadproc) glfwGetProcAddress, "resources/shaders/cache"))
+        std::cout << "Program binaries aren't supported, shaders are compiled from source" << std::endl;
+    // the lit shaders are compiled per combination of settings, see the *_FEATURE bits, and the
+    // screen pass per post chain; a variant is built the first time a frame asks for it
+    rg::ShaderPermutations objectShaders("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs",
+                                         {"BLINN", "SPOTLIGHT", "SHADOWS", "OBJECT_LIGHT_LISTS", "LIGHTMAP"}, [](Shader& shader) {
+        shader.use();
+        shader.setInt("texture_diffuse1", 0);
+        shader.setInt("texture_specular1", 1);
+        shader.setInt("transforms", TRANSFORM_BUFFER_UNIT);
+        shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+        shader.setInt("clusterRanges", CLUSTER_RANGES_UNIT);
+        shader.setInt("clusterIndices", CLUSTER_INDICES_UNIT);
+        shader.setInt("shadowMap", SHADOW_MAP_UNIT);
+        shader.setInt("lightmap", LIGHTMAP_UNIT);
+    });
     Shader skyboxShader("resources/shaders/skybox_shader.vs", "resources/shaders/skybox_shader.fs");
     Shader discardShader("resources/shaders/discard_shader.vs", "resources/shaders/discard_shader.fs");
-    Shader screenShader("resources/shaders/framebuffers.vs", "resources/shaders/framebuffers.fs");
-    Shader blurShader("resources/shaders/blur.vs", "resources/shaders/blur.fs");
+    rg::PostChain screenShaders("resources/shaders/framebuffers.vs", "resources/shaders/framebuffers.fs", [](Shader& shader) {
+        shader.use();
+        shader.setInt("scene", 0);
+        shader.setInt("bloomBlur", 1);
+    });
+    Shader bloomDownsampleShader("resources/shaders/framebuffers.vs", "resources/shaders/bloom_downsample.fs");
+    Shader bloomUpsampleShader("resources/shaders/framebuffers.vs", "resources/shaders/bloom_upsample.fs");
+    Shader depthShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs");
+    Shader gBufferShader("resources/shaders/model_lighting.vs", "resources/shaders/gbuffer.fs");
+    rg::ShaderPermutations deferredShaders("resources/shaders/framebuffers.vs", "resources/shaders/deferred_lighting.fs",
+                                           {"BLINN", "SPOTLIGHT", "SHADOWS"}, [](Shader& shader) {
+        shader.use();
+        shader.setInt("gAlbedoSpec", 0);
+        shader.setInt("gNormal", 1);
+        shader.setInt("gDepth", 2);
+        shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+        shader.setInt("clusterRanges", CLUSTER_RANGES_UNIT);
+        shader.setInt("clusterIndices", CLUSTER_INDICES_UNIT);
+        shader.setInt("shadowMap", SHADOW_MAP_UNIT);
+    });
+    Shader occlusionShader("resources/shaders/occlusion_box.vs", "resources/shaders/occlusion_box.fs");
+    if (rg::programCache().enabled()) {
+        rg::ProgramCache::Stats shaderStats = rg::programCache().stats();
+        std::cout << "Program cache: " << shaderStats.hits << " loaded in " << shaderStats.loadMs << " ms, saving "
+                  << shaderStats.savedMs << " ms of compiling; " << shaderStats.misses << " compiled in "
+                  << shaderStats.compileMs << " ms" << std::endl;
+    }
 
     // load models
     // -----------
-    Model temple("resources/objects/temple/temple.obj");
-    temple.SetShaderTextureNamePrefix("material.");
-    Model terrain("resources/objects/terrain/terrain.obj");
-    terrain.SetShaderTextureNamePrefix("material.");
-    Model moon("resources/objects/moon/moon.obj");
-    moon.SetShaderTextureNamePrefix("material.");
-    Model totem("resources/objects/totem/totem.obj");
-    totem.SetShaderTextureNamePrefix("material.");
-    Model tree("resources/objects/tree/CoconutPalm.obj");
-    tree.SetShaderTextureNamePrefix("material.");
+    // decoded on the workers meanwhile; each GL upload is queued for this thread as soon as its
+    // decode is done, so the uploads overlap the decodes that are still running
+    std::vector<std::unique_ptr<Model>> models(sceneSettings.modelCount);
+    std::vector<unsigned int> sceneTextures(sceneSettings.textureCount);
+    unsigned int skyboxTexture = 0;
+    std::vector<rg::JobHandle> uploads;
+    for (unsigned int i = 0; i < sceneSettings.modelCount; ++i) {
+        uploads.push_back(jobs.scheduleOnMainThread([&, i]() {
+            models[i].reset(new Model(sceneAssets.model(i)));
+            models[i]->SetShaderTextureNamePrefix("material.");
+        }, {sceneAssets.modelJob(i)}));
+    }
+    for (unsigned int i = 0; i < sceneSettings.textureCount; ++i) {
+        uploads.push_back(jobs.scheduleOnMainThread([&, i]() {
+            sceneTextures[i] = loadTexture(sceneAssets.texture(i), sceneFile.textures()[i].srgb);
+        }, {sceneAssets.textureJob(i)}));
+    }
+    uploads.push_back(jobs.scheduleOnMainThread([&]() {
+        skyboxTexture = loadCubemap(sceneAssets.skybox());
+    }, sceneAssets.skyboxJobs()));
+    jobs.wait(uploads);
+    sceneAssets.release();
+    std::vector<Model*> sceneModels;
+    for (const std::unique_ptr<Model>& model : models)
+        sceneModels.push_back(model.get());
 
     float skyboxVertices[] = {
             // positions
@@ -252,26 +565,6 @@ int main() {
             1.0f, -0.5f,  0.0f,  1.0f,  0.0f
     };
 
-    std::vector<glm::vec3> vegetation = {
-            glm::vec3(-20.7f, -6.73f, 10.4f),
-            glm::vec3(-24.5f, -6.73f, 9.8f),
-            glm::vec3(-28.3f, -6.73f, 10.4f),
-            glm::vec3(-32.1f, -6.73, 9.8f),
-            glm::vec3(-5.0f, -6.87f, 10.4f),
-            glm::vec3(-1.8f, -6.87f, 9.8f),
-            glm::vec3(2.0f, -6.87, 10.4f),
-            glm::vec3(5.8f, -6.87, 9.8f)
-    };
-
-    std::vector<std::string> faces_night = {
-            "resources/textures/skybox/night/right.png",
-            "resources/textures/skybox/night/left.png",
-            "resources/textures/skybox/night/top.png",
-            "resources/textures/skybox/night/bottom.png",
-            "resources/textures/skybox/night/front.png",
-            "resources/textures/skybox/night/back.png"
-    };
-
     // -------- Skybox --------
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
@@ -295,79 +588,486 @@ int main() {
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 
-    // -------- Framebuffers setup --------
-    unsigned int hdrFBO;
-    glGenFramebuffers(1, &hdrFBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-
-    unsigned int colorBuffers[2];
-    glGenTextures(2, colorBuffers);
-    for (unsigned int i = 0; i < 2; ++i) {
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorBuffers[i], 0);
-    }
-
-    unsigned int rboDepth;
-    glGenRenderbuffers(1, &rboDepth);
-    glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, SCR_WIDTH, SCR_HEIGHT);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
-
-    unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-    glDrawBuffers(2, attachments);
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cerr << "Framebuffer is not complete!" << "\n";
-
-    // ping-pong framebuffer for blurring
-    unsigned int pingpongFBO[2];
-    unsigned int pingpongColorbuffers[2];
-    glGenFramebuffers(2, pingpongFBO);
-    glGenTextures(2, pingpongColorbuffers);
-    for (unsigned int i = 0; i < 2; ++i) {
-        glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[i]);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[i]);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE); // we clamp to the edge as the blur filter would otherwise sample repeated texture values!
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pingpongColorbuffers[i], 0);
-        // also check if framebuffers are complete (no need for depth buffer)
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-            std::cout << "ERROR::FRAMEBUFFER:: Pingpong Framebuffer not complete!" << std::endl;
-    }
-
     // ------ Shader configuration ------
     skyboxShader.use();
-    unsigned int skyboxTexture = loadCubemap(faces_night);
     skyboxShader.setInt("skybox", 0);
 
-    unsigned int grassTexture = loadTexture(FileSystem::getPath("resources/textures/grass.png").c_str(), true);
     discardShader.use();
     discardShader.setInt("texture0", 0);
+    discardShader.setInt("transforms", TRANSFORM_BUFFER_UNIT);
+    depthShader.use();
+    depthShader.setInt("transforms", TRANSFORM_BUFFER_UNIT);
 
-    objectShader.use();
-    objectShader.setInt("texture_diffuse1", 0);
-    objectShader.setInt("texture_specular1", 1);
-    blurShader.use();
-    blurShader.setInt("image", 0);
+    gBufferShader.use();
+    gBufferShader.setInt("transforms", TRANSFORM_BUFFER_UNIT);
+    bloomDownsampleShader.use();
+    bloomDownsampleShader.setInt("source", 0);
+    bloomUpsampleShader.use();
+    bloomUpsampleShader.setInt("source", 0);
 
     // start values for directional light
-    programState->dirLight.direction = glm::vec3(-0.965f, 0.876f, -0.654f);
-    programState->dirLight.ambient = glm::vec3(-0.3f, 0.2f, 0.3f);
-    programState->dirLight.diffuse = glm::vec3(0.3f, 0.2f, 0.3f);
-    programState->dirLight.specular = glm::vec3(0.2f, 0.1f, 0.3f);
+    programState->dirLight.direction = sceneSettings.dirLightDirection;
+    programState->dirLight.ambient = sceneSettings.dirLightAmbient;
+    programState->dirLight.diffuse = sceneSettings.dirLightDiffuse;
+    programState->dirLight.specular = sceneSettings.dirLightSpecular;
 
     // draw in wireframe
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    // render loop
-    // -----------
+    // -------- Scene --------
+    rg::Scene scene;
+    sceneFile.instantiate(scene, sceneModels, sceneTextures);
+    scene.updateTransforms();
+    const unsigned int entityCount = scene.entityCount();
+    rg::DynamicBVH sceneBVH(0.5f);
+    std::vector<int> entityProxies(entityCount);
+    std::vector<unsigned int> allEntities(entityCount);
+    for (unsigned int id = 0; id < entityCount; ++id) {
+        entityProxies[id] = sceneBVH.createProxy(scene.worldBounds[id], id);
+        allEntities[id] = id;
+    }
+
+    // the static geometry gets its second UV set now, while this thread has the context; the
+    // lightmap is baked once and kept on disk until the layout or the static lights change.
+    // Bakes run as a background job, the frames are lit dynamically until the first one is done.
+    rg::LightmapAtlas lightmapAtlas;
+    lightmapAtlas.build(scene, LIGHTMAP_TEXELS_PER_UNIT, LIGHTMAP_SIZE);
+    rg::LightmapBaker lightmapBaker(jobs);
+    std::shared_ptr<const rg::LightmapImage> lightmap;
+    rg::JobHandle lightmapBake;
+    // what the running bake leaves behind, null if it was cancelled
+    std::shared_ptr<const rg::LightmapImage> bakedLightmap;
+    if (!lightmapAtlas.renderables().empty()) {
+        const DirLight& moonlight = programState->dirLight;
+        std::shared_ptr<rg::LightmapImage> stored = std::make_shared<rg::LightmapImage>();
+        if (stored->load(LIGHTMAP_PATH, lightmapAtlas.layoutHash(),
+                         rg::LightmapLights::of(scene, moonlight.direction, moonlight.ambient, moonlight.diffuse))) {
+            lightmap = stored;
+            programState->lightmapSamples = stored->samples;
+            programState->lightmapBakeMs = stored->bakeMs;
+        } else {
+            lightmapBake = scheduleLightmapBake(jobs, lightmapBaker, scene, lightmapAtlas, moonlight, bakedLightmap);
+        }
+    }
+
+    rg::RenderListBuilder renderListBuilder(jobs);
+    rg::LightClusterBuilder lightClusterBuilder(jobs);
+    rg::ShadowCascadeBuilder shadowCascadeBuilder(SHADOW_MAP_SIZE);
+    std::vector<unsigned char> occluded(entityCount, 0);
+    glm::vec3 lastCameraPosition = programState->camera.Position;
+    glm::vec3 lastCameraFront = programState->camera.Front;
+
+    // -------- Render thread --------
+    // it owns the context from here on and draws the packets this thread produces, so input and
+    // simulation of the next frame overlap the submission of the current one
+    rg::FrameQueue<FramePacket> frameQueue(programState->frameQueueDepth);
+    RenderFeedback feedback;
+    feedback.occluded.assign(entityCount, 0);
+    glfwMakeContextCurrent(NULL);
+    // the resize callback writes the globals on this thread, the render thread sizes its first
+    // targets from this copy and later ones from the packets
+    const int startWidth = framebufferWidth;
+    const int startHeight = framebufferHeight;
+
+    std::thread renderThread([&]() {
+        glfwMakeContextCurrent(window);
+        // releases the context when the thread ends; declared first, it is destroyed last, after
+        // the GL objects only this thread uses below have deleted their names
+        struct ContextRelease {
+            ~ContextRelease() {
+                glfwMakeContextCurrent(NULL);
+            }
+        } contextRelease;
+        rg::TransformBuffer transformBuffer(entityCount);
+        rg::OcclusionCuller occlusionCuller(entityCount);
+        rg::GpuTimer objectPassTimer;
+        rg::GpuTimer depthPassTimer;
+        rg::LightClusterBuffers lightClusterBuffers;
+        rg::ShadowMaps shadowMaps(SHADOW_MAP_SIZE);
+        rg::GpuTimer shadowPassTimer;
+        rg::BloomPyramid bloomPyramid(startWidth, startHeight);
+        glm::ivec2 bloomSize(startWidth, startHeight);
+        rg::GpuTimer bloomPassTimer;
+        rg::BlurEngine blurEngine((GLADloadproc) glfwGetProcAddress);
+        rg::RenderGraph renderGraph;
+        rg::GpuFrameTimer frameTimer;
+        unsigned int shadowStaticRedraws = 0;
+        rg::LightmapTexture lightmapTexture;
+        // held on to so a later image can't take its address
+        std::shared_ptr<const rg::LightmapImage> uploadedLightmap;
+        // world boxes for the occlusion queries, kept up to date from the packets
+        std::vector<rg::AABB> entityBounds(entityCount);
+        int viewportWidth = startWidth;
+        int viewportHeight = startHeight;
+        float objectPassMsWithoutOcclusion = 0.0f;
+
+        // loading talked to GL directly, start the render loop from a clean cache
+        rg::GLStateCache& glState = rg::glState();
+        glState.invalidate();
+
+        while (std::unique_ptr<FramePacket> packet = frameQueue.pop()) {
+            FramePacket& frame = *packet;
+            double submitStart = glfwGetTime();
+            glState.beginFrame();
+            frameTimer.begin(frame.frame);
+            glState.clearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            // the screen pass covers the window; note that width and height will be
+            // significantly larger than specified on retina displays
+            viewportWidth = frame.framebufferWidth;
+            viewportHeight = frame.framebufferHeight;
+            // screen-sized targets are as big as the window, the scene draws to the corner of
+            // them the resolution scale leaves and the screen pass stretches that over the window
+            const int targetWidth = std::max(viewportWidth, 1);
+            const int targetHeight = std::max(viewportHeight, 1);
+            const int renderWidth = std::min(frame.renderWidth, targetWidth);
+            const int renderHeight = std::min(frame.renderHeight, targetHeight);
+            const glm::vec2 uvScale((float) renderWidth / targetWidth, (float) renderHeight / targetHeight);
+            if (bloomSize != glm::ivec2(targetWidth, targetHeight)) {
+                bloomSize = glm::ivec2(targetWidth, targetHeight);
+                bloomPyramid.resize(targetWidth, targetHeight);
+            }
+
+            for (const EntityTransform& moved : frame.transforms) {
+                transformBuffer.set(moved.entity, moved.model, moved.normalMatrix);
+                entityBounds[moved.entity] = moved.bounds;
+            }
+            transformBuffer.upload();
+            transformBuffer.bind(TRANSFORM_BUFFER_UNIT);
+
+            // moonlight shadows; the cascades only redraw what changed, usually nothing but the moving casters
+            const rg::Scene::Renderables& renderables = scene.renderables;
+            float shadowPassMs = 0.0f;
+            if (frame.shadows.enabled) {
+                shadowPassTimer.begin();
+                shadowMaps.begin();
+                depthShader.use();
+                depthShader.setMat4("view", glm::mat4(1.0f));
+                // the casters were picked per cascade already
+                auto drawShadowCasters = [&](const std::vector<unsigned int>& casters) {
+                    for (unsigned int r : casters) {
+                        unsigned int entity = renderables.entity[r];
+                        depthShader.setInt("objectIndex", entity);
+                        renderables.model[r]->DrawDepth(renderables.firstMesh[r], renderables.meshCount[r],
+                                                        transformBuffer.model(entity), rg::Frustum::infinite());
+                    }
+                };
+                for (unsigned int c = 0; c < rg::ShadowFrame::CASCADES; ++c) {
+                    const rg::ShadowCascade& cascade = frame.shadows.cascades[c];
+                    depthShader.setMat4("projection", cascade.lightSpace);
+                    if (shadowMaps.beginStatic(c, cascade.staticDirty))
+                        drawShadowCasters(cascade.staticCasters);
+                    if (shadowMaps.beginDynamic(c, !cascade.dynamicCasters.empty()))
+                        drawShadowCasters(cascade.dynamicCasters);
+                }
+                shadowMaps.end();
+                shadowPassTimer.end();
+                shadowPassMs = shadowPassTimer.milliseconds();
+                shadowStaticRedraws += shadowMaps.staticRedraws();
+            }
+            shadowMaps.bind(SHADOW_MAP_UNIT);
+            if (frame.lightmap && frame.lightmap != uploadedLightmap) {
+                lightmapTexture.upload(*frame.lightmap);
+                uploadedLightmap = frame.lightmap;
+            }
+            if (frame.lightmap)
+                lightmapTexture.bind(LIGHTMAP_UNIT);
+
+            // occlusion answers from the previous packet; a fast camera makes them stale, so they
+            // are dropped and retested
+            occlusionCuller.beginFrame(frame.cameraJumped || !frame.occlusionCulling);
+
+            // render
+            // ------
+            lightClusterBuffers.upload(frame.lightClusters);
+            lightClusterBuffers.bind(CLUSTER_LIGHTS_UNIT, CLUSTER_RANGES_UNIT, CLUSTER_INDICES_UNIT);
+
+            // the benchmark blurs into targets of its own, before the graph binds anything
+            std::vector<rg::BlurTiming> blurTimings;
+            if (frame.blurBenchmark) {
+                blurTimings = blurEngine.benchmark({ glm::ivec2(960, 540), glm::ivec2(1920, 1080), glm::ivec2(3840, 2160) },
+                                                   { 2, 4, 8, 16, 32 }, 10, renderQuad);
+                printBlurTimings(blurTimings);
+            }
+
+            // view/projection transformations
+            const glm::mat4& projection = frame.projection;
+            const glm::mat4& view = frame.view;
+            const rg::Frustum& frustum = frame.frustum;
+            rg::CullStats meshCulling;
+
+            // the render list is sorted by pass first, lit ones come first, so the passes below switch programs once
+            const rg::RenderList& renderList = frame.renderList;
+            std::vector<rg::RenderItem>::const_iterator litEnd =
+                    std::find_if(renderList.items.begin(), renderList.items.end(), [&](const rg::RenderItem& item) {
+                        return renderables.pass[item.renderable] != rg::PASS_LIT;
+                    });
+            unsigned int lightingFeatures = (frame.blinn ? BLINN_FEATURE : 0) | (frame.spotlight ? SPOTLIGHT_FEATURE : 0) |
+                                            (frame.shadows.enabled ? SHADOWS_FEATURE : 0);
+            const bool screenBloom = std::find(frame.postStages.begin(), frame.postStages.end(), rg::POST_BLOOM) !=
+                                     frame.postStages.end();
+
+            // every pass is declared each frame with what it reads and writes; the graph skips the
+            // ones nothing on screen depends on, the bloom chain when the screen pass doesn't add
+            // bloom and with it the bright-pass output of the lighting, and lends a texture to
+            // each target only for the passes between its first write and its last read
+            renderGraph.setRenderArea(renderWidth, renderHeight);
+            const rg::RenderTargetDesc hdrDesc(targetWidth, targetHeight, GL_RGBA16F, GL_LINEAR);
+            rg::RenderGraphHandle hdrColor = renderGraph.create("HDR colour", hdrDesc);
+            rg::RenderGraphHandle brightColor = renderGraph.create("bright pass", hdrDesc);
+            // a texture rather than a renderbuffer, the deferred lighting pass reads it back
+            rg::RenderGraphHandle depth = renderGraph.create("depth", rg::RenderTargetDesc(targetWidth, targetHeight,
+                                                                                           GL_DEPTH24_STENCIL8, GL_NEAREST));
+            auto drawLit = [&](Shader& litShader) {
+                for (std::vector<rg::RenderItem>::const_iterator item = renderList.items.begin(); item != litEnd; ++item) {
+                    unsigned int r = item->renderable;
+                    unsigned int entity = item->entity;
+                    glState.setEnabled(GL_CULL_FACE, renderables.flags[r] & rg::RENDER_CULL_BACK_FACES);
+                    litShader.setInt("objectIndex", entity);
+                    if (frame.lightmap)
+                        litShader.setVec4("lightmapScaleOffset", lightmapAtlas.scaleOffset(r));
+                    renderables.model[r]->Draw(litShader, renderables.firstMesh[r], renderables.meshCount[r],
+                                               transformBuffer.model(entity), frustum, meshCulling);
+                }
+            };
+
+            float depthPassMs = 0.0f;
+            if (!frame.deferredShading) {
+                renderGraph.addPass("Forward", [&](rg::RenderGraph::Builder& pass) {
+                    hdrColor = pass.write(hdrColor);
+                    brightColor = pass.write(brightColor);
+                    depth = pass.writeDepth(depth);
+                }, [&](const rg::RenderGraph::Resources&) {
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    glState.cullFace(GL_BACK);
+                    // depth pre-pass: lay down depth with a trivial program so the lighting shader runs once per pixel
+                    if (frame.depthPrepass) {
+                        depthPassTimer.begin();
+                        depthShader.use();
+                        depthShader.setMat4("projection", projection);
+                        depthShader.setMat4("view", view);
+                        glState.colorMask(false);
+                        for (std::vector<rg::RenderItem>::const_iterator item = renderList.items.begin(); item != litEnd; ++item) {
+                            unsigned int r = item->renderable;
+                            unsigned int entity = item->entity;
+                            glState.setEnabled(GL_CULL_FACE, renderables.flags[r] & rg::RENDER_CULL_BACK_FACES);
+                            depthShader.setInt("objectIndex", entity);
+                            renderables.model[r]->DrawDepth(renderables.firstMesh[r], renderables.meshCount[r],
+                                                            transformBuffer.model(entity), frustum);
+                        }
+                        glState.colorMask(true);
+                        depthPassTimer.end();
+                        depthPassMs = depthPassTimer.milliseconds();
+
+                        glState.depthFunc(GL_EQUAL);
+                        glState.depthMask(false);
+                    }
+
+                    objectPassTimer.begin();
+                    Shader& objectShader = objectShaders.get(lightingFeatures |
+                                                             (frame.objectLightLists ? OBJECT_LIGHT_LISTS_FEATURE : 0) |
+                                                             (frame.lightmap ? LIGHTMAP_FEATURE : 0));
+                    objectShader.use();
+                    objectShader.setMat4("projection", projection);
+                    objectShader.setMat4("view", view);
+                    setNightLights(objectShader, frame);
+                    drawLit(objectShader);
+                });
+            } else {
+                // G-buffer: albedo with the specular mask in alpha, world space normal, and the
+                // depth the forward passes after the lighting test against
+                rg::RenderGraphHandle gAlbedo = renderGraph.create("G-buffer albedo", rg::RenderTargetDesc(
+                        targetWidth, targetHeight, GL_RGBA8, GL_NEAREST));
+                rg::RenderGraphHandle gNormal = renderGraph.create("G-buffer normal", rg::RenderTargetDesc(
+                        targetWidth, targetHeight, GL_RGBA16F, GL_NEAREST));
+                renderGraph.addPass("G-buffer", [&](rg::RenderGraph::Builder& pass) {
+                    gAlbedo = pass.write(gAlbedo);
+                    gNormal = pass.write(gNormal);
+                    depth = pass.writeDepth(depth);
+                }, [&](const rg::RenderGraph::Resources&) {
+                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                    glState.cullFace(GL_BACK);
+                    objectPassTimer.begin();
+                    gBufferShader.use();
+                    gBufferShader.setMat4("projection", projection);
+                    gBufferShader.setMat4("view", view);
+                    drawLit(gBufferShader);
+                });
+                // deferred lighting: one full screen pass into the HDR colour and bright-pass targets
+                renderGraph.addPass("Deferred lighting", [&](rg::RenderGraph::Builder& pass) {
+                    pass.read(gAlbedo);
+                    pass.read(gNormal);
+                    pass.read(depth);
+                    hdrColor = pass.write(hdrColor);
+                    brightColor = pass.write(brightColor);
+                }, [&](const rg::RenderGraph::Resources& resources) {
+                    // the sky is left out by the lighting, it gets the clear colour until the skybox
+                    glClear(GL_COLOR_BUFFER_BIT);
+                    glState.disable(GL_DEPTH_TEST);
+                    Shader& deferredShader = deferredShaders.get(lightingFeatures);
+                    deferredShader.use();
+                    deferredShader.setMat4("inverseProjection", glm::inverse(projection));
+                    deferredShader.setMat4("inverseView", glm::inverse(view));
+                    deferredShader.setVec2("uvScale", uvScale);
+                    setNightLights(deferredShader, frame);
+                    glState.bindTexture(0, GL_TEXTURE_2D, resources.texture(gAlbedo));
+                    glState.bindTexture(1, GL_TEXTURE_2D, resources.texture(gNormal));
+                    glState.bindTexture(2, GL_TEXTURE_2D, resources.texture(depth));
+                    renderQuad();
+                    glState.enable(GL_DEPTH_TEST);
+                });
+            }
+
+            // the alpha-tested quads, the occlusion queries and the sky, on top of the lit image;
+            // the queries answer for the next packet, so this pass always runs
+            float objectPassMs = 0.0f;
+            renderGraph.addPass("Alpha-tested and sky", [&](rg::RenderGraph::Builder& pass) {
+                hdrColor = pass.modify(hdrColor);
+                brightColor = pass.modify(brightColor);
+                depth = pass.modifyDepth(depth);
+                pass.sideEffect();
+            }, [&](const rg::RenderGraph::Resources&) {
+                // the pre-pass only covered lit geometry
+                glState.depthFunc(GL_LESS);
+                glState.depthMask(true);
+                if (litEnd != renderList.items.end()) {
+                    discardShader.use();
+                    discardShader.setMat4("view", view);
+                    discardShader.setMat4("projection", projection);
+                    glState.bindVertexArray(transparentVAO);
+                }
+                for (std::vector<rg::RenderItem>::const_iterator item = litEnd; item != renderList.items.end(); ++item) {
+                    unsigned int r = item->renderable;
+                    glState.setEnabled(GL_CULL_FACE, renderables.flags[r] & rg::RENDER_CULL_BACK_FACES);
+                    discardShader.setInt("objectIndex", item->entity);
+                    glState.bindTexture(0, GL_TEXTURE_2D, renderables.texture[r]);
+                    glDrawArrays(GL_TRIANGLES, 0, 6);
+                }
+                glState.disable(GL_CULL_FACE);
+                objectPassTimer.end();
+                objectPassMs = objectPassTimer.milliseconds();
+                if (!frame.occlusionCulling && objectPassTimer.hasResult())
+                    objectPassMsWithoutOcclusion = objectPassMs;
+
+                // test the boxes of everything in the frustum against this frame's depth; big occluders
+                // like the terrain opt out, light sources have nothing to draw
+                if (frame.occlusionCulling) {
+                    occlusionCuller.beginQueries(occlusionShader, projection * view);
+                    for (unsigned int r = 0; r < renderables.size(); ++r) {
+                        unsigned int entity = renderables.entity[r];
+                        if ((renderables.flags[r] & rg::RENDER_OCCLUSION_TEST) && renderList.frustumVisible[entity])
+                            occlusionCuller.issue(occlusionShader, entity, entityBounds[entity], frame.cameraPosition);
+                    }
+                    occlusionCuller.endQueries();
+                }
+
+                glState.depthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+                skyboxShader.use();
+                skyboxShader.setMat4("view", glm::mat4(glm::mat3(view))); // remove translation from the view matrix
+                skyboxShader.setMat4("projection", projection);
+                // skybox cube
+                glState.bindVertexArray(skyboxVAO);
+                glState.bindTexture(0, GL_TEXTURE_CUBE_MAP, skyboxTexture);
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+                glState.depthFunc(GL_LESS);
+            });
+
+            // bloom from the bright pass, into the pyramid's own levels
+            float bloomPassMs = 0.0f;
+            rg::RenderGraphHandle bloom = renderGraph.import("bloom", bloomPyramid.texture());
+            renderGraph.addPass("Bloom", [&](rg::RenderGraph::Builder& pass) {
+                pass.read(brightColor);
+                bloom = pass.write(bloom);
+            }, [&](const rg::RenderGraph::Resources& resources) {
+                bloomPassTimer.begin();
+                bloomPyramid.render(resources.texture(brightColor), bloomDownsampleShader, bloomUpsampleShader,
+                                    frame.bloomScatter, renderQuad, uvScale);
+                bloomPassTimer.end();
+                bloomPassMs = bloomPassTimer.milliseconds();
+            });
+
+            // the blur effect, one pass per direction
+            rg::RenderGraphHandle blurHorizontal = renderGraph.create("horizontal blur", hdrDesc);
+            rg::RenderGraphHandle blurred = renderGraph.create("blurred", hdrDesc);
+            renderGraph.addPass("Horizontal blur", [&](rg::RenderGraph::Builder& pass) {
+                pass.read(hdrColor);
+                blurHorizontal = pass.write(blurHorizontal);
+            }, [&](const rg::RenderGraph::Resources& resources) {
+                blurEngine.pass(resources.texture(hdrColor), resources.texture(blurHorizontal), false, renderWidth,
+                                renderHeight, frame.blurRadius, frame.computeBlur, renderQuad, uvScale);
+            });
+            renderGraph.addPass("Vertical blur", [&](rg::RenderGraph::Builder& pass) {
+                pass.read(blurHorizontal);
+                blurred = pass.write(blurred);
+            }, [&](const rg::RenderGraph::Resources& resources) {
+                blurEngine.pass(resources.texture(blurHorizontal), resources.texture(blurred), true, renderWidth,
+                                renderHeight, frame.blurRadius, frame.computeBlur, renderQuad, uvScale);
+            });
+
+            // Render the quad plane on default framebuffer, with the UI on top; the whole post chain
+            // runs here as one program, reading each scene texel and writing each pixel once
+            rg::RenderGraphHandle screenSource = frame.kernelEffects == 0 ? blurred : hdrColor;
+            renderGraph.addPass("Screen", [&](rg::RenderGraph::Builder& pass) {
+                pass.read(screenSource);
+                if (screenBloom)
+                    pass.read(bloom);
+                pass.sideEffect();
+            }, [&](const rg::RenderGraph::Resources& resources) {
+                glState.bindFramebuffer(GL_FRAMEBUFFER, 0);
+                glState.viewport(0, 0, viewportWidth, viewportHeight);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                Shader& screenShader = screenShaders.get(frame.postStages);
+                screenShader.use();
+                screenShader.setFloat("exposure", frame.exposure);
+                screenShader.setFloat("gamma", frame.gamma);
+                screenShader.setVec2("uvScale", uvScale);
+                // Bind bloom and non bloom
+                glState.bindTexture(0, GL_TEXTURE_2D, resources.texture(screenSource));
+                if (screenBloom)
+                    glState.bindTexture(1, GL_TEXTURE_2D, resources.texture(bloom));
+                renderQuad();
+
+                if (frame.ui.data.Valid)
+                    ImGui_ImplOpenGL3_RenderDrawData(&frame.ui.data);
+            });
+            renderGraph.execute();
+            frameTimer.end();
+
+            glfwSwapBuffers(window);
+
+            {
+                std::lock_guard<std::mutex> lock(feedback.mutex);
+                feedback.frame = frame.frame;
+                for (unsigned int id = 0; id < entityCount; ++id)
+                    feedback.occluded[id] = occlusionCuller.occluded(id);
+                feedback.gl = glState.lastFrame();
+                feedback.meshCulling = meshCulling;
+                feedback.depthPassMs = depthPassMs;
+                feedback.shadowPassMs = shadowPassMs;
+                feedback.bloomPassMs = bloomPassMs;
+                feedback.gpuFrameMs = frameTimer.hasResult() ? frameTimer.milliseconds() : 0.0f;
+                feedback.gpuFrameSampleMs = frameTimer.hasResult() ? frameTimer.lastMilliseconds() : 0.0f;
+                feedback.gpuFrameSampleOf = frameTimer.lastFrame();
+                feedback.renderGraph = renderGraph.stats();
+                feedback.blurComputeSupported = blurEngine.computeSupported();
+                if (!blurTimings.empty())
+                    feedback.blurTimings = std::move(blurTimings);
+                feedback.shadowStaticRedraws = shadowStaticRedraws;
+                feedback.objectPassMs = objectPassMs;
+                feedback.objectPassMsWithoutOcclusion = objectPassMsWithoutOcclusion;
+                feedback.submitMs = (float) (glfwGetTime() - submitStart) * 1000.0f;
+            }
+            frameQueue.recycle(std::move(packet));
+        }
+    });
+
+    // main loop: input, simulation and culling, one packet per frame
+    // --------------------------------------------------------------
+    unsigned int frameIndex = 0;
+    // occlusion answers read for packets before this one describe another view
+    unsigned int validOcclusionFrame = 0;
+    rg::DynamicResolution dynamicResolution;
+    unsigned int lastFeedbackFrame = 0;
+    unsigned int lastGpuFrameSample = 0;
     while (!glfwWindowShouldClose(window)) {
         // per-frame time logic
         // --------------------
@@ -378,168 +1078,223 @@ int main() {
         // input
         // -----
         processInput(window);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // render
-        // ------
-        glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        // don't forget to enable shader before setting uniforms
-        objectShader.use();
-        objectShader.setBool("blinn", blinn);
-        objectShader.setVec3("viewPosition", programState->camera.Position);
-
-        setNightLights(objectShader, currentFrame);
-        if (spotlightEnabled) {
-            objectShader.setVec3("spotLight.position", programState->camera.Position);
-            objectShader.setVec3("spotLight.direction", programState->camera.Front);
-            objectShader.setFloat("spotLight.cutOff", glm::cos(glm::radians(13.5f)));
-            objectShader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(18.5f)));
-            objectShader.setFloat("spotLight.constant", 0.8f);
-            objectShader.setFloat("spotLight.linear", 0.2f);
-            objectShader.setFloat("spotLight.quadratic", 0.12f);
-            objectShader.setVec3("spotLight.ambient", glm::vec3(1.0f, 1.0f, 1.0f));
-            objectShader.setVec3("spotLight.diffuse", glm::vec3(0.8f, 0.8f, 0.8f));
-            objectShader.setVec3("spotLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
-        } else {
-            objectShader.setVec3("spotLight.ambient", glm::vec3(0.0f, 0.0f, 0.0f));
-            objectShader.setVec3("spotLight.diffuse", glm::vec3(0.0f, 0.0f, 0.0f));
-            objectShader.setVec3("spotLight.specular", glm::vec3(0.0f, 0.0f, 0.0f));
-        }
+
+        frameQueue.setDepth(programState->frameQueueDepth);
+        std::unique_ptr<FramePacket> packet = frameQueue.acquire();
+        FramePacket& frame = *packet;
+        frame.frame = frameIndex;
+        frame.framebufferWidth = framebufferWidth;
+        frame.framebufferHeight = framebufferHeight;
 
         // view/projection transformations
-        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                                (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = programState->camera.GetViewMatrix();
-        objectShader.setMat4("projection", projection);
-        objectShader.setMat4("view", view);
+        Camera& camera = programState->camera;
+        // a minimised window is 0 high
+        const float aspect = framebufferHeight > 0 ? (float) framebufferWidth / (float) framebufferHeight
+                                                   : (float) SCR_WIDTH / (float) SCR_HEIGHT;
+        frame.projection = glm::perspective(glm::radians(camera.Zoom), aspect, NEAR_PLANE, FAR_PLANE);
+        frame.view = camera.GetViewMatrix();
+        frame.frustum = programState->frustumCulling ? rg::Frustum(frame.projection * frame.view) : rg::Frustum::infinite();
+        frame.cameraPosition = camera.Position;
+        frame.cameraFront = camera.Front;
+        frame.cameraJumped = glm::length(camera.Position - lastCameraPosition) > 1.0f ||
+                             glm::dot(camera.Front, lastCameraFront) < glm::cos(glm::radians(5.0f));
+        lastCameraPosition = camera.Position;
+        lastCameraFront = camera.Front;
+
+        // what the render thread reported for the packets it finished meanwhile
+        {
+            std::lock_guard<std::mutex> lock(feedback.mutex);
+            if (frame.cameraJumped || !programState->occlusionCulling) {
+                validOcclusionFrame = frameIndex;
+                occluded.assign(entityCount, 0);
+            } else if (feedback.frame >= validOcclusionFrame) {
+                occluded = feedback.occluded;
+            }
+            programState->glStats = feedback.gl;
+            programState->meshCulling = feedback.meshCulling;
+            programState->depthPassMs = feedback.depthPassMs;
+            programState->shadowPassMs = feedback.shadowPassMs;
+            programState->bloomPassMs = feedback.bloomPassMs;
+            programState->blurComputeSupported = feedback.blurComputeSupported;
+            programState->blurTimings = feedback.blurTimings;
+            programState->renderGraph = feedback.renderGraph;
+            programState->shadowStaticRedraws = feedback.shadowStaticRedraws;
+            programState->objectPassMs = feedback.objectPassMs;
+            programState->objectPassMsWithoutOcclusion = feedback.objectPassMsWithoutOcclusion;
+            programState->renderThreadMs = feedback.submitMs;
+            if (feedback.frame != lastFeedbackFrame) {
+                lastFeedbackFrame = feedback.frame;
+                programState->gpuFrameMs = feedback.gpuFrameMs;
+            }
+            // a reading is only new when it measured another packet than the last one did
+            if (programState->dynamicResolution && feedback.gpuFrameSampleOf != lastGpuFrameSample) {
+                lastGpuFrameSample = feedback.gpuFrameSampleOf;
+                dynamicResolution.update(feedback.gpuFrameSampleMs, feedback.gpuFrameSampleOf, frame.frame,
+                                         programState->gpuBudgetMs);
+            }
+        }
+        if (programState->dynamicResolution)
+            programState->renderScale = dynamicResolution.scale();
+        else
+            dynamicResolution.reset(frame.frame);
+        glm::ivec2 renderSize = rg::DynamicResolution::renderSize(framebufferWidth, framebufferHeight,
+                                                                   programState->renderScale);
+        frame.renderWidth = renderSize.x;
+        frame.renderHeight = renderSize.y;
 
         // -------- Objects --------
-        // terrain
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-15.0f, -12.5, -15.0f));
-        model = glm::scale(model, glm::vec3(10.0f, 10.0f, 10.0f));
-        objectShader.setMat4("model", model);
-        terrain.Draw(objectShader);
-
-        // temple
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-10.0f, -8.7f, -10.0f));
-        model = glm::scale(model, glm::vec3(4.0f,  4.0f, 4.0f));
-        objectShader.setMat4("model", model);
-        temple.Draw(objectShader);
-
-        // totem 1
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-15.0f, -8.8f, 8.9f));
-        model = glm::rotate(model, glm::radians(10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(1.7f, 1.7f, 1.7f));
-        objectShader.setMat4("model", model);
-        totem.Draw(objectShader);
-
-        // totem 2
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-5.0f, -8.7f, 8.9f));
-        model = glm::rotate(model, glm::radians(10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(1.7f, 1.7f, 1.7f));
-        objectShader.setMat4("model", model);
-        totem.Draw(objectShader);
-
-        // moon
-        glEnable(GL_CULL_FACE);
-        glCullFace(GL_BACK);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(25.0f, 38.0f, -40.5f));
-        model = glm::rotate(model, currentFrame / 3.0f, glm::vec3(0.0f, 1.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(5.0f, 5.0f, 5.0f));
-        objectShader.setMat4("model", model);
-        moon.Draw(objectShader);
-        glDisable(GL_CULL_FACE);
-
-        // palm trees
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(-29.108009f, -7.468780f, -23.254124f));
-        model = glm::rotate(model, glm::radians(-50.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.1f));
-        objectShader.setMat4("model", model);
-        tree.Draw(objectShader);
-
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(10.238466f, -9.35f, -23.254124f));
-        model = glm::rotate(model, glm::radians(-64.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        model = glm::scale(model, glm::vec3(0.1f));
-        objectShader.setMat4("model", model);
-        tree.Draw(objectShader);
-
-        // grass
-        discardShader.use();
-        glBindVertexArray(transparentVAO);
-        discardShader.setMat4("view", view);
-        discardShader.setMat4("projection", projection);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, grassTexture);
-        for (unsigned int i = 0; i < vegetation.size(); ++i) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, vegetation[i]);
-            model = glm::scale(model, glm::vec3(4.0f));
-            discardShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        // only the spinning and orbiting entities move, static ones were computed once at startup
+        double jobsStart = glfwGetTime();
+        scene.animate(currentFrame);
+        scene.updateTransforms();
+        // matrices are copied into the packet on the workers, the BVH is updated here
+        const std::vector<unsigned int>& moved = frameIndex == 0 ? allEntities : scene.changedEntities();
+        frame.transforms.resize(moved.size());
+        jobs.parallelFor(moved.size(), 64, [&](unsigned int, unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; ++i) {
+                unsigned int id = moved[i];
+                frame.transforms[i] = {id, scene.graph.world(id), scene.graph.normalMatrix(id), scene.worldBounds[id]};
+            }
+        });
+        for (unsigned int id : scene.changedEntities())
+            sceneBVH.moveProxy(entityProxies[id], scene.worldBounds[id]);
+
+        rg::FrameView frameView;
+        frameView.frustum = frame.frustum;
+        frameView.eye = camera.Position;
+        frameView.projectionScale = frame.renderHeight / (2.0f * glm::tan(glm::radians(camera.Zoom) / 2.0f));
+        frameView.minPixelRadius = programState->minPixelRadius;
+        renderListBuilder.build(scene, sceneBVH, occluded, frameView, frame.renderList);
+        programState->frameJobsMs = (float) (glfwGetTime() - jobsStart) * 1000.0f;
+
+        const rg::RenderList& renderList = frame.renderList;
+        rg::CullStats& objectCulling = programState->objectCulling;
+        objectCulling = rg::CullStats();
+        for (unsigned int id = 0; id < entityCount; ++id) {
+            if (renderList.frustumVisible[id])
+                ++objectCulling.visible;
+            else
+                ++objectCulling.culled;
+        }
+        programState->occludedObjects = renderList.occluded;
+        programState->tooSmallObjects = renderList.tooSmall;
+
+        // what the camera is looking at, closest bounding box along the view direction
+        programState->pickedObject = -1;
+        float pickDistance = 100.0f;
+        sceneBVH.raycast(camera.Position, camera.Front, pickDistance, [&](unsigned int id, float t) {
+            if (scene.renderableOf[id] == rg::Scene::NONE || t >= pickDistance)
+                return pickDistance;
+            programState->pickedObject = (int) id;
+            pickDistance = t;
+            return t;
+        });
+
+        // the current lightmap stays in use while a new one bakes
+        if (programState->bakeLightmap && !lightmapBake && !lightmapAtlas.renderables().empty())
+            lightmapBake = scheduleLightmapBake(jobs, lightmapBaker, scene, lightmapAtlas, programState->dirLight,
+                                                bakedLightmap);
+        programState->bakeLightmap = false;
+        if (lightmapBake && lightmapBake->finished()) {
+            lightmapBake = nullptr;
+            if (bakedLightmap) {
+                lightmap = std::move(bakedLightmap);
+                reportLightmapBake(lightmapBaker);
+            }
+        }
+        programState->lightmapBaking = lightmapBake != nullptr;
+
+        // lights, with their animation resolved
+        frame.dirLight = programState->dirLight;
+        frame.pointLights.clear();
+        const rg::Scene::PointLights& lights = scene.lights;
+        for (unsigned int i = 0; i < lights.size(); ++i) {
+            rg::PointLight light;
+            light.position = scene.position(lights.entity[i]);
+            light.ambient = lights.ambient[i];
+            light.diffuse = lights.diffuse[i];
+            if (lights.pulse[i]) {
+                light.ambient *= cos(currentFrame);
+                light.diffuse *= sin(currentFrame);
+            }
+            light.specular = lights.specular[i];
+            light.constant = lights.constant[i];
+            light.linear = lights.linear[i];
+            light.quadratic = lights.quadratic[i];
+            frame.pointLights.push_back(light);
+        }
+        if (programState->lightBenchmark)
+            addBenchmarkLights(frame.pointLights, programState->benchmarkLights, currentFrame);
+
+        double clustersStart = glfwGetTime();
+        lightClusterBuilder.build(frame.pointLights, frame.view, glm::radians(camera.Zoom), aspect, NEAR_PLANE, FAR_PLANE,
+                                  frame.lightClusters);
+        programState->lightClustersMs = (float) (glfwGetTime() - clustersStart) * 1000.0f;
+        programState->pointLightCount = frame.pointLights.size();
+        programState->maxLightsPerCluster = frame.lightClusters.maxLightsPerCluster;
+
+        frame.objectLightLists = programState->objectLightLists && !programState->deferredShading;
+        if (frame.objectLightLists) {
+            double listsStart = glfwGetTime();
+            lightClusterBuilder.addObjectLists(scene.worldBounds, frame.renderList.frustumVisible, frame.lightClusters);
+            programState->objectLightListsMs = (float) (glfwGetTime() - listsStart) * 1000.0f;
+            programState->maxLightsPerObject = frame.lightClusters.maxLightsPerObject;
         }
+        frame.spotlight = spotlightEnabled;
+        frame.blinn = blinn;
+        frame.shadows.enabled = false;
+        if (programState->shadows) {
+            if (!programState->shadowCaching)
+                shadowCascadeBuilder.invalidate();
+            shadowCascadeBuilder.build(scene, frame.dirLight.direction, frame.view, glm::radians(camera.Zoom), aspect,
+                                       NEAR_PLANE, SHADOW_DISTANCE, frame.shadows);
+        }
+
+        // the G-buffer has no room for the lightmap, the deferred path lights everything dynamically
+        const DirLight& moonlight = frame.dirLight;
+        programState->lightmapStale =
+                lightmap && !lightmap->lights.sameMoonlight(moonlight.direction, moonlight.ambient, moonlight.diffuse);
+        bool useLightmap = programState->lightmap && lightmap && !programState->lightmapStale &&
+                           !programState->deferredShading;
+        frame.lightmap = useLightmap ? lightmap : nullptr;
+
+        frame.depthPrepass = programState->depthPrepass;
+        frame.deferredShading = programState->deferredShading;
+        frame.occlusionCulling = programState->occlusionCulling;
+        frame.bloomScatter = programState->bloomScatter;
+        frame.exposure = programState->exposure;
+        frame.gamma = programState->gamma;
+        frame.kernelEffects = programState->kernelEffects;
+        buildPostChain(*programState, frame.postStages);
+        frame.blurRadius = programState->blurRadius;
+        frame.computeBlur = programState->computeBlur && programState->blurComputeSupported;
+        frame.blurBenchmark = programState->blurBenchmark;
+        programState->blurBenchmark = false;
 
-        glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
-        skyboxShader.use();
-        view = glm::mat4(glm::mat3(programState->camera.GetViewMatrix())); // remove translation from the view matrix
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
-        // skybox cube
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
-
-        // blur
-        bool horizontal = true, first_iteration = true;
-        unsigned int amount = 5;
-        blurShader.use();
-        for (unsigned int i = 0; i < amount; ++i) {
-            glBindFramebuffer(GL_FRAMEBUFFER, pingpongFBO[horizontal]);
-            blurShader.setInt("horizontal", horizontal);
-            glBindTexture(GL_TEXTURE_2D, first_iteration ? colorBuffers[1] : pingpongColorbuffers[!horizontal]);
-            renderQuad();
-            horizontal = !horizontal;
-            if (first_iteration)
-                first_iteration = false;
+        if (programState->ImGuiEnabled) {
+            DrawImGui(programState, scene);
+            frame.ui.capture(ImGui::GetDrawData());
+        } else {
+            frame.ui.clear();
         }
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // Render the quad plane on default framebuffer
-        screenShader.use();
-        screenShader.setInt("bloom", programState->bloom);
-        screenShader.setInt("effect", programState->kernelEffects);
-        screenShader.setInt("hdr", programState->hdr);
-        screenShader.setFloat("exposure", programState->exposure);
-        screenShader.setFloat("gamma", programState->gamma);
-        // Bind bloom and non bloom
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, colorBuffers[0]);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, pingpongColorbuffers[!horizontal]);
-
-        renderQuad();
-
-        if (programState->ImGuiEnabled)
-            DrawImGui(programState);
-
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
+
+        // waits while the render thread is a full queue behind
+        frameQueue.push(std::move(packet));
+        ++frameIndex;
+
+        // glfw: poll IO events (keys pressed/released, mouse moved etc.)
+        // ---------------------------------------------------------------
         glfwPollEvents();
     }
 
+    if (lightmapBake) {
+        lightmapBaker.cancel();
+        jobs.wait(lightmapBake);
+    }
+    frameQueue.close();
+    renderThread.join();
+    glfwMakeContextCurrent(window);
+
     programState->SaveToFile("resources/program_state.txt");
     delete programState;
     ImGui_ImplOpenGL3_Shutdown();
@@ -582,9 +1337,9 @@ void processInput(GLFWwindow *window) {
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
-    // make sure the viewport matches the new window dimensions; note that width and
-    // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    // the render thread resizes its targets when the next packet arrives with the new size
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -612,8 +1367,8 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
     programState->camera.ProcessMouseScroll(yoffset);
 }
 
-void DrawImGui(ProgramState *programState) {
-    ImGui_ImplOpenGL3_NewFrame();
+// builds the UI; the draw data is drawn by the render thread
+void DrawImGui(ProgramState *programState, const rg::Scene& scene) {
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
@@ -628,6 +1383,10 @@ void DrawImGui(ProgramState *programState) {
         ImGui::Checkbox("HDR", &programState->hdr);
         if (programState->hdr) {
             ImGui::Checkbox("Bloom", &programState->bloom);
+            if (programState->bloom) {
+                ImGui::SliderFloat("Bloom scatter", &programState->bloomScatter, 0.0f, 1.0f);
+                ImGui::Text("Bloom GPU time: %.3f ms", programState->bloomPassMs);
+            }
             ImGui::DragFloat("Exposure", &programState->exposure, 0.05f, 0.0f, 5.0f);
             ImGui::DragFloat("Gamma factor", &programState->gamma, 0.05f, 0.0f, 4.0f);
         }
@@ -637,6 +1396,24 @@ void DrawImGui(ProgramState *programState) {
         ImGui::RadioButton("Grayscale", &programState->kernelEffects, 1);
         ImGui::RadioButton("Edge detection", &programState->kernelEffects, 2);
         ImGui::RadioButton("None", &programState->kernelEffects, 3);
+        if (programState->hdr && (programState->kernelEffects == 1 || programState->kernelEffects == 2))
+            ImGui::Checkbox("After tone mapping", &programState->effectAfterToneMap);
+        if (programState->kernelEffects == 0) {
+            ImGui::SliderInt("Blur radius", &programState->blurRadius, 1, rg::BlurEngine::MAX_RADIUS);
+            if (programState->blurComputeSupported)
+                ImGui::Checkbox("Compute shader blur", &programState->computeBlur);
+            else
+                ImGui::Text("Compute shader blur needs GL 4.3");
+        }
+        if (ImGui::Button("Run blur benchmark"))
+            programState->blurBenchmark = true;
+        for (const rg::BlurTiming& timing : programState->blurTimings) {
+            if (timing.computeMs >= 0.0f)
+                ImGui::Text("%dx%d r%d: fragment %.3f ms, compute %.3f ms", timing.width, timing.height,
+                            timing.radius, timing.fragmentMs, timing.computeMs);
+            else
+                ImGui::Text("%dx%d r%d: fragment %.3f ms", timing.width, timing.height, timing.radius, timing.fragmentMs);
+        }
 
         ImGui::Text("Directional light adjustment");
         ImGui::DragFloat3("Direction", (float*)&programState->dirLight.direction, 0.05, -1.0f, 1.0f, "%.4f", 0);
@@ -657,8 +1434,98 @@ void DrawImGui(ProgramState *programState) {
         ImGui::End();
     }
 
+    {
+        ImGui::Begin("Render stats");
+        const rg::GLStateCache::FrameStats& gl = programState->glStats;
+        ImGui::Text("Frame jobs CPU time: %.3f ms", programState->frameJobsMs);
+        ImGui::Text("Render thread CPU time: %.3f ms", programState->renderThreadMs);
+        ImGui::Text("GPU frame time: %.3f ms", programState->gpuFrameMs);
+        ImGui::Checkbox("Dynamic resolution", &programState->dynamicResolution);
+        if (programState->dynamicResolution)
+            ImGui::SliderFloat("GPU budget (ms)", &programState->gpuBudgetMs, 2.0f, 50.0f);
+        else
+            ImGui::SliderFloat("Resolution scale", &programState->renderScale, rg::DynamicResolution::MIN_SCALE,
+                               rg::DynamicResolution::MAX_SCALE);
+        glm::ivec2 renderSize = rg::DynamicResolution::renderSize(framebufferWidth, framebufferHeight,
+                                                                   programState->renderScale);
+        ImGui::Text("Render resolution: %dx%d (%.0f%%)", renderSize.x, renderSize.y, programState->renderScale * 100.0f);
+        ImGui::SliderInt("Frame queue depth", &programState->frameQueueDepth, 1, rg::FrameQueue<FramePacket>::MAX_DEPTH);
+        ImGui::Text("GL state calls issued: %u", gl.issued);
+        ImGui::Text("GL state calls elided: %u", gl.elided);
+        const rg::RenderGraph::Stats& graph = programState->renderGraph;
+        ImGui::Text("Render graph passes: %u, culled %u", graph.passes, graph.culledPasses);
+        if (!graph.culled.empty())
+            ImGui::Text("Culled: %s", graph.culled.c_str());
+        ImGui::Text("Targets: %u in %u textures, %.1f of %.1f MB", graph.targets, graph.textures,
+                    graph.textureBytes / (1024.0f * 1024.0f), graph.targetBytes / (1024.0f * 1024.0f));
+        if (rg::programCache().enabled()) {
+            rg::ProgramCache::Stats shaderStats = rg::programCache().stats();
+            ImGui::Text("Programs from cache: %u, saved %.1f ms", shaderStats.hits, shaderStats.savedMs);
+            ImGui::Text("Programs compiled: %u, %.1f ms", shaderStats.misses, shaderStats.compileMs);
+        }
+        ImGui::Checkbox("Light benchmark", &programState->lightBenchmark);
+        if (programState->lightBenchmark)
+            ImGui::SliderInt("Benchmark lights", &programState->benchmarkLights, 256, 2048);
+        ImGui::Checkbox("Moonlight shadows", &programState->shadows);
+        if (programState->shadows) {
+            ImGui::Checkbox("Cache static shadow casters", &programState->shadowCaching);
+            ImGui::Text("Shadow pass GPU time: %.3f ms", programState->shadowPassMs);
+            ImGui::Text("Static shadow layers redrawn: %u", programState->shadowStaticRedraws);
+        }
+        ImGui::Checkbox("Baked lighting", &programState->lightmap);
+        if (programState->lightmap) {
+            static const unsigned int minSamples = 8, maxSamples = 1024, maxBounces = 4, minBounces = 0;
+            rg::LightmapSettings& bake = programState->lightmapSettings;
+            ImGui::SliderScalar("Lightmap samples", ImGuiDataType_U32, &bake.samples, &minSamples, &maxSamples);
+            ImGui::SliderScalar("Lightmap bounces", ImGuiDataType_U32, &bake.bounces, &minBounces, &maxBounces);
+            ImGui::DragFloat("Bake time budget (s)", &bake.timeBudgetSeconds, 1.0f, 1.0f, 600.0f);
+            if (programState->lightmapBaking)
+                ImGui::Text("Baking the lightmap...");
+            else if (ImGui::Button("Bake lightmap"))
+                programState->bakeLightmap = true;
+            ImGui::Text("Lightmap: %u samples per texel, baked in %.1f s", programState->lightmapSamples,
+                        programState->lightmapBakeMs / 1000.0f);
+            if (programState->lightmapRaysPerSecond > 0.0f)
+                ImGui::Text("Bake speed: %.2f Mrays/s", programState->lightmapRaysPerSecond / 1e6f);
+            if (programState->lightmapStale)
+                ImGui::Text("The moonlight changed since the bake, lit dynamically until the next one");
+            else if (programState->deferredShading)
+                ImGui::Text("Deferred shading doesn't use the lightmap");
+        }
+        ImGui::Text("Point lights: %u", programState->pointLightCount);
+        ImGui::Text("Light clustering CPU time: %.3f ms", programState->lightClustersMs);
+        ImGui::Text("Most lights in one cluster: %u", programState->maxLightsPerCluster);
+        if (!programState->deferredShading) {
+            ImGui::Checkbox("Per-object light lists", &programState->objectLightLists);
+            if (programState->objectLightLists) {
+                ImGui::Text("Object light lists CPU time: %.3f ms", programState->objectLightListsMs);
+                ImGui::Text("Most lights on one object: %u", programState->maxLightsPerObject);
+            }
+        }
+        ImGui::Checkbox("Frustum culling", &programState->frustumCulling);
+        ImGui::Text("Objects visible: %u", programState->objectCulling.visible);
+        ImGui::Text("Objects culled: %u", programState->objectCulling.culled);
+        ImGui::Text("Meshes visible: %u", programState->meshCulling.visible);
+        ImGui::Text("Meshes culled: %u", programState->meshCulling.culled);
+        ImGui::Text("Looking at: %s", scene.name(programState->pickedObject));
+        ImGui::Checkbox("Deferred shading", &programState->deferredShading);
+        if (!programState->deferredShading)
+            ImGui::Checkbox("Depth pre-pass", &programState->depthPrepass);
+        if (programState->depthPrepass && !programState->deferredShading)
+            ImGui::Text("Depth pre-pass GPU time: %.2f ms", programState->depthPassMs);
+        ImGui::Checkbox("Occlusion culling", &programState->occlusionCulling);
+        ImGui::Text("Objects occluded: %u", programState->occludedObjects);
+        ImGui::DragFloat("Min pixel radius", &programState->minPixelRadius, 0.1f, 0.0f, 20.0f);
+        ImGui::Text("Objects too small: %u", programState->tooSmallObjects);
+        ImGui::Text("Object pass GPU time: %.2f ms", programState->objectPassMs);
+        if (programState->occlusionCulling && programState->objectPassMsWithoutOcclusion > 0.0f)
+            ImGui::Text("Shading time saved: %.2f ms", programState->objectPassMsWithoutOcclusion - programState->objectPassMs);
+        else
+            ImGui::Text("Shading time saved: turn occlusion culling off once to measure the baseline");
+        ImGui::End();
+    }
+
     ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
@@ -682,27 +1549,18 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
     }
 }
 
-unsigned int loadCubemap(vector<std::string> faces)
+unsigned int loadCubemap(const std::vector<rg::Image>& faces)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    stbi_set_flip_vertically_on_load(true);
-    int width, height, nrChannels;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
+        if (faces[i].valid())
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, faces[i].width, faces[i].height, 0, GL_RGB, GL_UNSIGNED_BYTE, faces[i].pixels.data());
         else
-        {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
+            std::cout << "Cubemap texture failed to load at path: " << faces[i].path << std::endl;
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -713,14 +1571,13 @@ unsigned int loadCubemap(vector<std::string> faces)
     return textureID;
 }
 
-unsigned int loadTexture(char const * path, bool gammaCorrection)
+unsigned int loadTexture(const rg::Image& image, bool gammaCorrection)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+    int nrComponents = image.channels;
+    if (image.valid())
     {
         GLenum internalFormat;
         GLenum dataFormat;
@@ -740,20 +1597,17 @@ unsigned int loadTexture(char const * path, bool gammaCorrection)
         }
 
         glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, dataFormat, GL_UNSIGNED_BYTE, data);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, dataFormat, GL_UNSIGNED_BYTE, image.pixels.data());
         glGenerateMipmap(GL_TEXTURE_2D);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, internalFormat == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT); // for this tutorial: use GL_CLAMP_TO_EDGE to prevent semi-transparent borders. Due to interpolation it takes texels from next repeat
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, internalFormat == GL_RGBA ? GL_CLAMP_TO_EDGE : GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        std::cout << "Texture failed to load at path: " << image.path << std::endl;
     }
 
     return textureID;
@@ -775,7 +1629,7 @@ void renderQuad()
         // setup plane VAO
         glGenVertexArrays(1, &quadVAO);
         glGenBuffers(1, &quadVBO);
-        glBindVertexArray(quadVAO);
+        rg::glState().bindVertexArray(quadVAO);
         glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
@@ -783,52 +1637,142 @@ void renderQuad()
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     }
-    glBindVertexArray(quadVAO);
+    rg::glState().bindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
 }
 
-void setNightLights(Shader& shader, float currentFrame)
+// everything the forward and the deferred lighting shaders share
+void setNightLights(Shader& shader, const FramePacket& frame)
 {
-    shader.setVec3("dirLight.direction", programState->dirLight.direction);
-    shader.setVec3("dirLight.ambient", programState->dirLight.ambient);
-    shader.setVec3("dirLight.diffuse", programState->dirLight.diffuse);
-    shader.setVec3("dirLight.specular", programState->dirLight.specular);
-
-    // point lights
-    shader.setVec3("pointLights[0].position", glm::vec3(-10.007275f, 4.587323f, -9.562702));
-    shader.setVec3("pointLights[0].ambient", glm::vec3(3.0f, 0.0f, 0.0f) * cos(currentFrame));
-    shader.setVec3("pointLights[0].diffuse", glm::vec3(3.0f, 0.0f, 0.0f) * sin(currentFrame));
-    shader.setVec3("pointLights[0].specular", glm::vec3(3.0f, 0.0f, 0.0f));
-    shader.setFloat("pointLights[0].constant", 0.783f);
-    shader.setFloat("pointLights[0].linear", 0.21f);
-    shader.setFloat("pointLights[0].quadratic", 0.045f);
-    shader.setFloat("material.shininess", 8.0f);
-
-    shader.setVec3("pointLights[1].position", glm::vec3(21.882572f, 35.517292f, -37.401550f));
-    shader.setVec3("pointLights[1].ambient", glm::vec3(10.0f, 10.0f, 10.0f));
-    shader.setVec3("pointLights[1].diffuse", glm::vec3(10.0f, 10.0f, 10.0f));
-    shader.setVec3("pointLights[1].specular", glm::vec3(3.0f, 3.0f, 3.0f));
-    shader.setFloat("pointLights[1].constant", 0.45f);
-    shader.setFloat("pointLights[1].linear", 0.54f);
-    shader.setFloat("pointLights[1].quadratic", 0.78f);
+    shader.setVec3("viewPosition", frame.cameraPosition);
+    shader.setVec3("dirLight.direction", frame.dirLight.direction);
+    shader.setVec3("dirLight.ambient", frame.dirLight.ambient);
+    shader.setVec3("dirLight.diffuse", frame.dirLight.diffuse);
+    shader.setVec3("dirLight.specular", frame.dirLight.specular);
     shader.setFloat("material.shininess", 64.0f);
+    shader.setFloat("shininess", 64.0f);
+
+    if (frame.spotlight) {
+        shader.setVec3("spotLight.position", frame.cameraPosition);
+        shader.setVec3("spotLight.direction", frame.cameraFront);
+        shader.setFloat("spotLight.cutOff", glm::cos(glm::radians(13.5f)));
+        shader.setFloat("spotLight.outerCutOff", glm::cos(glm::radians(18.5f)));
+        shader.setFloat("spotLight.constant", 0.8f);
+        shader.setFloat("spotLight.linear", 0.2f);
+        shader.setFloat("spotLight.quadratic", 0.12f);
+        shader.setVec3("spotLight.ambient", glm::vec3(1.0f, 1.0f, 1.0f));
+        shader.setVec3("spotLight.diffuse", glm::vec3(0.8f, 0.8f, 0.8f));
+        shader.setVec3("spotLight.specular", glm::vec3(1.0f, 1.0f, 1.0f));
+    }
+
+    // point lights come from the light clusters
+    shader.setVec2("clusterTileScale", glm::vec2((float) rg::LightClusters::TILES_X / frame.renderWidth,
+                                                 (float) rg::LightClusters::TILES_Y / frame.renderHeight));
+    shader.setVec2("clusterSliceScaleBias", frame.lightClusters.sliceScaleBias);
+
+    if (frame.lightmap)
+        shader.setUint("bakedPointLights", frame.lightmap->lights.pointMask);
+
+    if (frame.shadows.enabled) {
+        for (unsigned int c = 0; c < rg::ShadowFrame::CASCADES; ++c) {
+            const rg::ShadowCascade& cascade = frame.shadows.cascades[c];
+            std::string index = "[" + std::to_string(c) + "]";
+            shader.setMat4("cascadeLightSpace" + index, cascade.lightSpace);
+            shader.setFloat("cascadeSplits" + index, cascade.splitDepth);
+            shader.setFloat("cascadeTexelSizes" + index, cascade.texelSize);
+        }
+    }
+}
+
+// the screen pass's post chain: the kernel effect and the tone mapping with bloom, in the order
+// the UI asks for; the blur has run already, in its own passes
+void buildPostChain(const ProgramState& state, std::vector<rg::PostStage>& stages)
+{
+    stages.clear();
+    bool effect = state.kernelEffects == 1 || state.kernelEffects == 2;
+    const rg::PostStage effectStage = state.kernelEffects == 1 ? rg::POST_GRAYSCALE : rg::POST_EDGE_DETECTION;
+    if (effect && !state.effectAfterToneMap)
+        stages.push_back(effectStage);
+    if (state.hdr && state.bloom)
+        stages.push_back(rg::POST_BLOOM);
+    if (state.hdr)
+        stages.push_back(rg::POST_TONE_MAP);
+    if (effect && state.effectAfterToneMap)
+        stages.push_back(effectStage);
+}
 
-    std::vector<glm::vec3> positions = {
-            glm::vec3(-11.023065f, 8.9135011f * cos(currentFrame / 2.5f), 14.310511f * sin(currentFrame / 2.5f)),
-            glm::vec3(13.824927f * sin(currentFrame / 2.5f), 8.9135011f * cos(currentFrame / 2.5f), -9.308303f),
-            glm::vec3(-9.759034f, 8.9135011f * cos(currentFrame / 2.5f), -30.399181f * sin(currentFrame /2.5f)),
-            glm::vec3(-34.675980f * sin(currentFrame / 2.5f), 8.9135011f * cos(currentFrame / 2.5f), -9.308303f)
+// a swarm of coloured lights circling the temple at different radii and heights, to see
+// how the shading cost follows the lights near each fragment rather than all of them
+void addBenchmarkLights(std::vector<rg::PointLight>& lights, unsigned int count, float time)
+{
+    const glm::vec3 center(-10.0f, -7.0f, -10.0f);
+    for (unsigned int i = 0; i < count; ++i) {
+        float phase = i * 2.39996f; // golden angle, spreads them evenly
+        float radius = 5.0f + 20.0f * (float) (i % 17) / 17.0f;
+        float speed = (0.15f + 0.05f * (i % 5)) * (i % 2 ? 1.0f : -1.0f);
+        float angle = phase + speed * time;
+        float height = 0.5f * (i % 9) + sin(1.3f * time + phase);
+        glm::vec3 colour = 0.5f + 0.5f * glm::cos(6.28318f * (0.618f * i + glm::vec3(0.0f, 0.33f, 0.67f)));
+
+        rg::PointLight light;
+        light.position = center + glm::vec3(radius * cos(angle), height, radius * sin(angle));
+        light.ambient = glm::vec3(0.0f);
+        light.diffuse = 0.8f * colour;
+        light.specular = 0.3f * colour;
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        lights.push_back(light);
+    }
+}
+
+// bakes with the current moonlight and the scene's static point lights as a background job,
+// which keeps the image on disk and leaves it in result. Without worker threads nothing would
+// ever pick the job up, so the bake runs right here and the returned job is already finished.
+rg::JobHandle scheduleLightmapBake(rg::JobSystem& jobs, rg::LightmapBaker& baker, const rg::Scene& scene,
+                                   const rg::LightmapAtlas& atlas, const DirLight& dirLight,
+                                   std::shared_ptr<const rg::LightmapImage>& result)
+{
+    rg::LightmapLights lights = rg::LightmapLights::of(scene, dirLight.direction, dirLight.ambient, dirLight.diffuse);
+    rg::LightmapSettings settings = programState->lightmapSettings;
+    auto bake = [&baker, &scene, &atlas, &result, lights, settings]() {
+        std::shared_ptr<rg::LightmapImage> image = baker.bake(scene, atlas, lights, settings);
+        if (image)
+            image->save(LIGHTMAP_PATH);
+        result = std::move(image);
     };
+    if (jobs.workerCount() == 0) {
+        std::cout << "No worker threads, baking the lightmap on the main thread" << std::endl;
+        rg::JobHandle job = jobs.schedule(bake);
+        jobs.wait(job);
+        // the render thread kept drawing the packets it had, don't count the wait as a frame
+        lastFrame = glfwGetTime();
+        return job;
+    }
+    return jobs.scheduleBackground(bake);
+}
 
-    for (unsigned int i = 0; i < 4; ++i) {
-        shader.setVec3("pointLights[" + std::to_string(i + 2) + "].position", positions[i]);
-        shader.setVec3("pointLights[" + std::to_string(i + 2) + "].ambient", glm::vec3(1.5f, 1.5f, 1.5f));
-        shader.setVec3("pointLights[" + std::to_string(i + 2) + "].diffuse", glm::vec3(0.9f, 0.9f, 0.9f));
-        shader.setVec3("pointLights[" + std::to_string(i + 2) + "].specular", glm::vec3(0.5f, 0.5f, 0.5f));
-        shader.setFloat("pointLights[" + std::to_string(i + 2) + "].constant", 0.9f);
-        shader.setFloat("pointLights[" + std::to_string(i + 2) + "].linear", 0.47f);
-        shader.setFloat("pointLights[" + std::to_string(i + 2) + "].quadratic", 0.024f);
-        shader.setFloat("material.shininess", 64.0f);
-    }
-}
\ No newline at end of file
+// call once the bake job has finished
+void reportLightmapBake(const rg::LightmapBaker& baker)
+{
+    const rg::LightmapBaker::Stats& stats = baker.stats();
+    programState->lightmapSamples = stats.samples;
+    programState->lightmapBakeMs = stats.bakeMs;
+    programState->lightmapRaysPerSecond = stats.bakeMs > 0.0f ? stats.rays / (stats.bakeMs / 1000.0f) : 0.0f;
+    std::cout << "Lightmap: " << stats.texels << " texels over " << stats.triangles << " triangles, "
+              << stats.samples << " samples per texel, " << stats.rays << " rays in " << stats.bakeMs << " ms"
+              << std::endl;
+}
+
+void printBlurTimings(const std::vector<rg::BlurTiming>& timings)
+{
+    std::cout << "Blur benchmark, GPU ms per two-pass blur:\n";
+    for (const rg::BlurTiming& timing : timings) {
+        std::cout << "  " << timing.width << "x" << timing.height << " radius " << timing.radius
+                  << ": fragment " << timing.fragmentMs;
+        if (timing.computeMs >= 0.0f)
+            std::cout << ", compute " << timing.computeMs;
+        std::cout << "\n";
+    }
+    std::cout << std::flush;
+}
@@ -0,0 +1,299 @@
+// Renders a lit test surface offscreen with every variant of resources/shaders/model_lighting.fs
+// and with the same variant of test/model_lighting_reference.fs, the shader as it was before the
+// material is sampled once per fragment, and compares the two images. Both colour outputs have
+// to match to MAX_RELATIVE_DIFFERENCE. Needs EGL, a headless driver is enough; run it from the
+// repository root.
+
+#include <glad/glad.h>
+#include <EGL/egl.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/shader.h>
+#include <rg/ShaderPermutations.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const int WIDTH = 480;
+const int HEIGHT = 270;
+const unsigned LIGHTS = 24;
+const unsigned CLUSTERS = 16 * 9 * 24;
+const unsigned GRID = 128;
+const unsigned SHADOW_CASCADES = 3;
+const double MAX_RELATIVE_DIFFERENCE = 1e-4;
+
+const unsigned TRANSFORM_BUFFER_UNIT = 8;
+const unsigned CLUSTER_LIGHTS_UNIT = 9;
+const unsigned CLUSTER_RANGES_UNIT = 10;
+const unsigned CLUSTER_INDICES_UNIT = 11;
+const unsigned SHADOW_MAP_UNIT = 12;
+const unsigned LIGHTMAP_UNIT = 13;
+
+std::mt19937 generator(7);
+
+float uniform() {
+    return std::uniform_real_distribution<float>(0.0f, 1.0f)(generator);
+}
+
+bool createContext() {
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr) || !eglBindAPI(EGL_OPENGL_API))
+        return false;
+    const EGLint configAttributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config;
+    EGLint configs = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs == 0)
+        return false;
+    const EGLint contextAttributes[] = {EGL_CONTEXT_MAJOR_VERSION, 3, EGL_CONTEXT_MINOR_VERSION, 3,
+                                       EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE};
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    const EGLint surfaceAttributes[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+    if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context))
+        return false;
+    return gladLoadGLLoader((GLADloadproc) eglGetProcAddress) != 0;
+}
+
+void noiseTexture(unsigned unit, int size) {
+    std::vector<float> texels(size * size * 3);
+    for (float& texel : texels)
+        texel = uniform();
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, size, size, 0, GL_RGB, GL_FLOAT, texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+void bufferTexture(unsigned unit, GLenum format, const void* data, size_t bytes) {
+    GLuint buffer, texture;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STATIC_DRAW);
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+// a wavy grid with both UV sets, so every light and the lightmap land on varying normals
+GLsizei createSurface() {
+    std::vector<float> vertices;
+    for (unsigned z = 0; z <= GRID; ++z) {
+        for (unsigned x = 0; x <= GRID; ++x) {
+            float px = x / (float) GRID * 20.0f - 10.0f, pz = z / (float) GRID * 20.0f - 10.0f;
+            float py = 0.6f * std::sin(px * 1.3f) * std::cos(pz * 0.9f);
+            glm::vec3 normal = glm::normalize(glm::vec3(-0.78f * std::cos(px * 1.3f) * std::cos(pz * 0.9f), 1.0f,
+                                                        0.54f * std::sin(px * 1.3f) * std::sin(pz * 0.9f)));
+            float vertex[] = {px, py, pz, normal.x, normal.y, normal.z, x / 16.0f, z / 16.0f,
+                              x / (float) GRID, z / (float) GRID};
+            vertices.insert(vertices.end(), vertex, vertex + 10);
+        }
+    }
+    std::vector<unsigned> indices;
+    for (unsigned z = 0; z < GRID; ++z) {
+        for (unsigned x = 0; x < GRID; ++x) {
+            unsigned a = z * (GRID + 1) + x, b = a + 1, c = a + GRID + 1, d = c + 1;
+            unsigned quad[] = {a, c, b, b, c, d};
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+    GLuint vao, vbo, ebo;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned), indices.data(), GL_STATIC_DRAW);
+    const GLsizei stride = 10 * sizeof(float);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*) 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*) (3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*) (6 * sizeof(float)));
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, stride, (void*) (8 * sizeof(float)));
+    return (GLsizei) indices.size();
+}
+
+// material textures, one object transform, LIGHTS point lights all listed in every cluster,
+// a noise shadow map and a noise lightmap
+void createInputs() {
+    noiseTexture(0, 64);
+    noiseTexture(1, 64);
+    noiseTexture(LIGHTMAP_UNIT, 32);
+
+    glm::mat4 model(1.0f), normalMatrix(1.0f);
+    std::vector<glm::vec4> transforms = {model[0], model[1], model[2], model[3],
+                                         normalMatrix[0], normalMatrix[1], normalMatrix[2]};
+    bufferTexture(TRANSFORM_BUFFER_UNIT, GL_RGBA32F, transforms.data(), transforms.size() * sizeof(glm::vec4));
+
+    std::vector<glm::vec4> lights;
+    for (unsigned i = 0; i < LIGHTS; ++i) {
+        lights.push_back(glm::vec4(uniform() * 20.0f - 10.0f, 0.5f + uniform() * 2.0f, uniform() * 20.0f - 10.0f, 10.0f));
+        lights.push_back(glm::vec4(glm::vec3(uniform(), uniform(), uniform()) * 0.05f, 1.0f));
+        lights.push_back(glm::vec4(uniform(), uniform(), uniform(), 0.35f));
+        lights.push_back(glm::vec4(uniform(), uniform(), uniform(), 0.44f));
+    }
+    bufferTexture(CLUSTER_LIGHTS_UNIT, GL_RGBA32F, lights.data(), lights.size() * sizeof(glm::vec4));
+    std::vector<glm::uvec2> ranges(CLUSTERS + 1, glm::uvec2(0, LIGHTS));
+    bufferTexture(CLUSTER_RANGES_UNIT, GL_RG32UI, ranges.data(), ranges.size() * sizeof(glm::uvec2));
+    std::vector<GLuint> indices(LIGHTS);
+    for (unsigned i = 0; i < LIGHTS; ++i)
+        indices[i] = i;
+    bufferTexture(CLUSTER_INDICES_UNIT, GL_R32UI, indices.data(), indices.size() * sizeof(GLuint));
+
+    std::vector<float> depths(256 * 256 * SHADOW_CASCADES);
+    for (float& depth : depths)
+        depth = 0.3f + uniform() * 0.5f;
+    GLuint shadowMap;
+    glGenTextures(1, &shadowMap);
+    glActiveTexture(GL_TEXTURE0 + SHADOW_MAP_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, 256, 256, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT,
+                 GL_FLOAT, depths.data());
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+// float colour and bright targets, like the scene framebuffer
+void createTarget() {
+    GLuint fbo, color[2], depth;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenTextures(2, color);
+    for (unsigned i = 0; i < 2; ++i) {
+        glBindTexture(GL_TEXTURE_2D, color[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, WIDTH, HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, color[i], 0);
+    }
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, WIDTH, HEIGHT);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    const GLenum buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, buffers);
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void draw(Shader& shader, GLsizei indexCount) {
+    const glm::vec3 eye(0.0f, 6.0f, 12.0f);
+    const glm::vec3 sunDirection(-0.3f, -1.0f, -0.2f);
+    const glm::mat4 lightSpace = glm::ortho(-12.0f, 12.0f, -12.0f, 12.0f, -20.0f, 20.0f) *
+                                 glm::lookAt(glm::vec3(0.0f), sunDirection, glm::vec3(0.0f, 0.0f, 1.0f));
+    shader.use();
+    shader.setMat4("view", glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+    shader.setMat4("projection", glm::perspective(glm::radians(45.0f), WIDTH / (float) HEIGHT, 0.1f, 100.0f));
+    shader.setInt("objectIndex", 0);
+    shader.setVec3("viewPosition", eye);
+    shader.setFloat("material.shininess", 32.0f);
+    shader.setVec2("clusterTileScale", glm::vec2(16.0f / WIDTH, 9.0f / HEIGHT));
+    shader.setVec2("clusterSliceScaleBias", glm::vec2(3.0f, 2.0f));
+    shader.setVec3("dirLight.direction", sunDirection);
+    shader.setVec3("dirLight.ambient", glm::vec3(0.05f));
+    shader.setVec3("dirLight.diffuse", glm::vec3(0.4f, 0.4f, 0.5f));
+    shader.setVec3("dirLight.specular", glm::vec3(0.5f));
+    shader.setVec3("spotLight.position", eye);
+    shader.setVec3("spotLight.direction", -eye);
+    shader.setFloat("spotLight.cutOff", std::cos(glm::radians(12.5f)));
+    shader.setFloat("spotLight.outerCutOff", std::cos(glm::radians(15.0f)));
+    shader.setFloat("spotLight.constant", 1.0f);
+    shader.setFloat("spotLight.linear", 0.09f);
+    shader.setFloat("spotLight.quadratic", 0.032f);
+    shader.setVec3("spotLight.ambient", glm::vec3(0.0f));
+    shader.setVec3("spotLight.diffuse", glm::vec3(1.0f));
+    shader.setVec3("spotLight.specular", glm::vec3(1.0f));
+    for (unsigned i = 0; i < SHADOW_CASCADES; ++i) {
+        shader.setMat4("cascadeLightSpace[" + std::to_string(i) + "]", lightSpace);
+        shader.setFloat("cascadeSplits[" + std::to_string(i) + "]", 5.0f + 8.0f * i);
+        shader.setFloat("cascadeTexelSizes[" + std::to_string(i) + "]", 0.05f);
+    }
+    shader.setVec4("lightmapScaleOffset", glm::vec4(1.0f, 1.0f, 0.0f, 0.0f));
+    // every other point light counts as baked
+    shader.setUint("bakedPointLights", 0x55555555u);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+}
+
+std::vector<float> readPixels(unsigned attachment) {
+    std::vector<float> pixels(WIDTH * HEIGHT * 4);
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_FLOAT, pixels.data());
+    return pixels;
+}
+
+// largest difference relative to the reference value, absolute below 1
+double maxRelativeDifference(const std::vector<float>& reference, const std::vector<float>& image) {
+    double worst = 0.0;
+    for (size_t i = 0; i < reference.size(); ++i)
+        worst = std::max(worst, std::abs(reference[i] - image[i]) / (double) std::max(1.0f, std::abs(reference[i])));
+    return worst;
+}
+
+}
+
+int main() {
+    if (!createContext()) {
+        std::cerr << "No OpenGL 3.3 context" << std::endl;
+        return 1;
+    }
+    std::cout << glGetString(GL_RENDERER) << std::endl;
+    GLsizei indexCount = createSurface();
+    createInputs();
+    createTarget();
+
+    auto setup = [](Shader& shader) {
+        shader.use();
+        shader.setInt("material.texture_diffuse1", 0);
+        shader.setInt("material.texture_specular1", 1);
+        shader.setInt("transforms", TRANSFORM_BUFFER_UNIT);
+        shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+        shader.setInt("clusterRanges", CLUSTER_RANGES_UNIT);
+        shader.setInt("clusterIndices", CLUSTER_INDICES_UNIT);
+        shader.setInt("shadowMap", SHADOW_MAP_UNIT);
+        shader.setInt("lightmap", LIGHTMAP_UNIT);
+    };
+    const std::vector<std::string> features = {"BLINN", "SPOTLIGHT", "SHADOWS", "OBJECT_LIGHT_LISTS", "LIGHTMAP"};
+    rg::ShaderPermutations reference("resources/shaders/model_lighting.vs", "test/model_lighting_reference.fs",
+                                     features, setup);
+    rg::ShaderPermutations current("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs",
+                                   features, setup);
+
+    unsigned failed = 0;
+    for (unsigned variant = 0; variant < (1u << features.size()); ++variant) {
+        draw(reference.get(variant), indexCount);
+        std::vector<float> referenceColor = readPixels(0), referenceBright = readPixels(1);
+        draw(current.get(variant), indexCount);
+        double color = maxRelativeDifference(referenceColor, readPixels(0));
+        double bright = maxRelativeDifference(referenceBright, readPixels(1));
+        bool passed = color <= MAX_RELATIVE_DIFFERENCE && bright <= MAX_RELATIVE_DIFFERENCE;
+        std::cout << "variant " << variant << " (";
+        for (unsigned i = 0; i < features.size(); ++i)
+            std::cout << (variant & (1u << i) ? features[i] : std::string(features[i].size(), '-')) << ' ';
+        std::cout << "): colour " << color << ", bright " << bright << (passed ? "" : "  FAILED") << std::endl;
+        if (!passed)
+            ++failed;
+    }
+    if (glGetError() != GL_NO_ERROR) {
+        std::cerr << "OpenGL error while rendering" << std::endl;
+        return 1;
+    }
+    std::cout << (failed ? "images differ" : "images match") << std::endl;
+    return failed ? 1 : 0;
+}